@@ -11,6 +11,22 @@ const IS_LITTLE_ENDIAN = true; //BLE protocol is little endian
 const NAME_DESCRIPTOR_UUID = BluetoothUUID.canonicalUUID('0x2901');
 const PRES_DESCRIPTOR_UUID = BluetoothUUID.canonicalUUID('0x2904');
 const PRES_DESCRIPTOR_LENGTH = 7; //bytes
+const TIME_SYNC_UUID = 'f2b7d4e9-1c6a-4b38-9e5d-7a3c8f1b6d42';
+const TIME_SYNC_PERIOD = 5000; //ms
+const CONFIG_UUID = 'b7e1c5a9-2f4d-4e83-9c6b-1d8a3f7e5b20';
+const LOG_RECORDS_UUID = '6f3a1c8e-4d2b-4e97-a6c5-1b8d3f9e7a24';
+const LOG_CONTROL_UUID = 'a3d8f1c6-5e2b-4c79-9f14-8b6e2d7a3c51';
+
+/*
+ * Data log transfer, see datalog.cpp. Each frame is a frame counter followed by 16 byte records. Frames are acknowledged by number,
+ * and an empty frame marks the end of the log
+ */
+const LOG_CONTROL_START = 0x01;
+const LOG_CONTROL_ACK = 0x02;
+const LOG_FRAME_HEADER_LENGTH = 4; //bytes
+const LOG_RECORD_LENGTH = 16; //bytes
+const LOG_TYPE_TIME = 0;
+const LOG_TYPE_NAMES = ['Time', 'Environment', 'Air quality', 'Light', 'Orientation', 'Vibration', 'Magnetic field', 'Battery'];
 
 /*
  * GATT format types defined in Bluetooth Assigned Numbers specification, section 2.4.1
@@ -19,21 +35,29 @@ const PRES_DESCRIPTOR_LENGTH = 7; //bytes
 const BLE_FORMAT_BOOLEAN = 0x01;
 const BLE_FORMAT_UINT8 = 0x04;
 const BLE_FORMAT_UINT16 = 0x06;
+const BLE_FORMAT_UINT24 = 0x07;
 const BLE_FORMAT_UINT32 = 0x08;
 const BLE_FORMAT_SINT8 = 0x0C;
 const BLE_FORMAT_SINT16 = 0x0E;
 const BLE_FORMAT_SINT32 = 0x10;
 const BLE_FORMAT_FLOAT32 = 0x14;
+const BLE_FORMAT_UTF8 = 0x19;
+const BLE_FORMAT_OPAQUE = 0x1B;
 
 const BLE_UNITS = new Map([
 	[0x2700, ''], //Unitless
+	[0x2705, 'K'],
 	[0x2713, 'm/s2'],
 	[0x2720, 'rad'],
+	[0x2722, 'Hz'],
 	[0x2724, 'Pa'],
+	[0x2725, 'J'],
 	[0x2728, 'V'],
 	[0x272D, 'uT'],
 	[0x272F, '°C'],
+	[0x2731, 'lx'],
 	[0x2743, 'rad/s'],
+	[0x2760, 'min'],
 	[0x27AD, '%'],
 	[0x27C4, 'ppm'],
 	[0x27C5, 'ppb']
@@ -44,7 +68,12 @@ const supportedServices = new Map([
 	[BluetoothUUID.canonicalUUID(0x181A), 'Environmental Sensor'],
 	[BluetoothUUID.canonicalUUID(0x054D), 'Light Sensor'],
 	['606a0692-1e69-422a-9f73-de87d239aade', 'Inertial Measurement Unit'],
-	['7749eb1b-2b16-4d32-8422-e792dae7adb8', 'Magnetic Field Sensor']
+	['7749eb1b-2b16-4d32-8422-e792dae7adb8', 'Magnetic Field Sensor'],
+	['0b8a7f6e-2c4d-4e19-a5b3-6d9f1c2e8a47', 'Energy Monitor'],
+	['2d7e9b41-8c3f-4a6d-b5e2-9f1c4a7d3e58', 'Data Log'],
+	['e81c4b7a-3d9f-4a26-b1e8-5c7f2a9d4e13', 'Error Log'],
+	['c5e3a8d1-7b2f-4e94-a6c0-8d1f3b7e5a29', 'Time Sync'],
+	['4a8f2d6b-e3c1-4b97-a5d8-7f1e9c3b6a42', 'Configuration']
 ]);
 
 const readCharacteristicList = new Map();
@@ -62,6 +91,18 @@ const servicesArea = document.getElementById('servicesArea');
 
 let bleServer;
 let logTimer;
+let syncTimer;
+let logRecordsCharacteristic;
+let logControlCharacteristic;
+
+const logDownload = {
+	active: false,
+	expectedFrame: 0,
+	ackFrame: -1, //Newest frame not yet acknowledged, -1 if none
+	ackBusy: false,
+	time: 0, //ms, device millis() of last record
+	rows: []
+};
 
 bttnConnect.addEventListener('click', bluetoothConnect);
 bttnLogStart.addEventListener('click', logStart);
@@ -138,6 +179,8 @@ function onDisconnect(event) {
 	console.log('Disconnected from: ', event.target.device.name);
 	statusReady('Disconnected');
 	servicesArea.replaceChildren();
+	clearInterval(syncTimer);
+	logDownload.active = false; //Device keeps anything not acknowledged
 	logStop();
 	disableButton(bttnLogStart);
 	enableButton(bttnConnect);
@@ -172,9 +215,23 @@ function initCharacteristics(table, serviceName, characteristics) {
 			characteristicName = decoder.decode(arrBuffer);
 			console.log('Found characteristic "', characteristicName, '" with UUID "', characteristic.uuid, '"');
 
+			if (characteristic.uuid == LOG_RECORDS_UUID) { //Only subscribed while downloading, as the device waits for acknowledgements
+				logRecordsCharacteristic = characteristic;
+				return;
+			} else if (characteristic.uuid == LOG_CONTROL_UUID) { //Write only, starts a download
+				logControlCharacteristic = characteristic;
+				showLogDownload(table, characteristicName);
+				return;
+			}
+
 			//All characteristics should have Read and Notify properties set at minimum, ignore any that don't
 			if (characteristic.properties.read && characteristic.properties.notify) {			
-				if (characteristic.properties.write) { //Writeable characteristics should also have Write property set
+				if (characteristic.uuid == TIME_SYNC_UUID) { //Written with our clock rather than toggled, shows the fitted offset and drift
+					initReadCharacteristic(table, serviceName, characteristic, characteristicName);
+					startTimeSync(characteristic);
+				} else if (characteristic.uuid == CONFIG_UUID) { //Written by field tools with a parameter list, not a toggle. Show current values
+					initReadCharacteristic(table, serviceName, characteristic, characteristicName);
+				} else if (characteristic.properties.write) { //Writeable characteristics should also have Write property set
 					initWriteCharacteristic(table, characteristic, characteristicName);
 				} else { //Otherwise it must be a read-only characteristic
 					initReadCharacteristic(table, serviceName, characteristic, characteristicName);
@@ -216,6 +273,21 @@ function initWriteCharacteristic(table, characteristic, characteristicName) {
 	console.log('Started notifications for UUID "', characteristic.uuid, '"');
 }
 
+function startTimeSync(characteristic) {
+	clearInterval(syncTimer);
+	sendTime(characteristic);
+	syncTimer = setInterval(sendTime, TIME_SYNC_PERIOD, characteristic);
+}
+
+function sendTime(characteristic) {
+	const dataView = new DataView(new ArrayBuffer(8));
+	const now = BigInt(Math.round((performance.timeOrigin + performance.now()) * 1000)); //Microseconds since Unix epoch
+	dataView.setBigUint64(0, now, IS_LITTLE_ENDIAN);
+	characteristic.writeValueWithResponse(dataView.buffer).catch(error => {
+		console.log('Error sending time sync: ', error);
+	});
+}
+
 function readPresInfo(dataView) {
 	if (dataView.byteLength < PRES_DESCRIPTOR_LENGTH) {
 		console.log('Characteristic presentation descriptor received was in invalid format');
@@ -332,6 +404,11 @@ function readValue(dataView, presInfo) {
 			decodeFunc = (x) => { return x.getUint16(0, IS_LITTLE_ENDIAN); };
 			break;
 
+		case BLE_FORMAT_UINT24:
+			length = 3;
+			decodeFunc = (x) => { return x.getUint16(0, IS_LITTLE_ENDIAN) + (x.getUint8(2) << 16); };
+			break;
+
 		case BLE_FORMAT_UINT32:
 			length = 4;
 			decodeFunc = (x) => { return x.getUint32(0, IS_LITTLE_ENDIAN); };
@@ -357,6 +434,12 @@ function readValue(dataView, presInfo) {
 			decodeFunc = (x) => { return x.getFloat32(0, IS_LITTLE_ENDIAN); };
 			break;
 
+		case BLE_FORMAT_UTF8:
+			return new TextDecoder().decode(dataView);
+
+		case BLE_FORMAT_OPAQUE: //Packed frames are shown as raw hex, layout is specific to each characteristic
+			return readHex(dataView);
+
 		default:
 			return 0;
 	}
@@ -379,8 +462,17 @@ function readValue(dataView, presInfo) {
 	}
 }
 
+function readHex(dataView) {
+	let str = '';
+	for (let i = 0; i < dataView.byteLength; i++) {
+		str += dataView.getUint8(i).toString(16).padStart(2, 0);
+	}
+
+	return str;
+}
+
 function formatValue(val, presInfo) {
-	if (presInfo.format == BLE_FORMAT_BOOLEAN) {
+	if ((presInfo.format == BLE_FORMAT_BOOLEAN) || (presInfo.format == BLE_FORMAT_UTF8) || (presInfo.format == BLE_FORMAT_OPAQUE)) {
 		return val;
 	} else {
 		let numDecimals = -presInfo.exponent;
@@ -485,12 +577,136 @@ function doPad(num) {
 	return num.toString().padStart(2, 0);
 }
 
-function saveLog(logstr) {
+function saveLog(logstr, filename = 'log.csv') {
 	const element = document.createElement('a');
 	element.setAttribute('href', 'data:text/csv;charset=utf-8,' + encodeURIComponent(logstr));
-	element.setAttribute('download', 'log.csv');
+	element.setAttribute('download', filename);
 	element.style.display = 'none';
 	document.body.appendChild(element);
 	element.click();
 	document.body.removeChild(element);
 }
+
+function showLogDownload(table, characteristicName) {
+	let row = document.createElement('tr');
+	table.appendChild(row);
+
+	let cell = document.createElement('td');
+	cell.colSpan = 2;
+	row.appendChild(cell);
+
+	let bttn = document.createElement('button');
+	bttn.type = 'button';
+	bttn.innerHTML = 'Download log';
+	bttn.addEventListener('click', startLogDownload);
+	cell.appendChild(bttn);
+}
+
+function startLogDownload(event) {
+	if (logDownload.active || !logRecordsCharacteristic || !logControlCharacteristic) {
+		return;
+	}
+
+	const bttn = event.target;
+	disableButton(bttn);
+	logDownload.active = true;
+	logDownload.expectedFrame = 0;
+	logDownload.ackFrame = -1;
+	logDownload.time = 0;
+	logDownload.rows = [];
+
+	logRecordsCharacteristic.addEventListener('characteristicvaluechanged', onLogFrame);
+	logRecordsCharacteristic.startNotifications().then(() => {
+		const dataView = new DataView(new ArrayBuffer(1));
+		dataView.setUint8(0, LOG_CONTROL_START);
+		return logControlCharacteristic.writeValueWithResponse(dataView.buffer);
+	}).then(() => {
+		console.log('Started data log download');
+	}).catch(error => {
+		console.log('Error starting data log download: ', error);
+		endLogDownload();
+	}).finally(() => {
+		enableButton(bttn);
+	});
+}
+
+function onLogFrame(event) {
+	const dataView = event.target.value;
+	if (!logDownload.active || (dataView.byteLength < LOG_FRAME_HEADER_LENGTH)) {
+		return;
+	}
+
+	const frame = dataView.getUint32(0, IS_LITTLE_ENDIAN);
+	if (frame != logDownload.expectedFrame) {
+		return; //Missed a frame, device sends it again when it isn't acknowledged
+	}
+
+	logDownload.expectedFrame++;
+	for (let offset = LOG_FRAME_HEADER_LENGTH; offset + LOG_RECORD_LENGTH <= dataView.byteLength; offset += LOG_RECORD_LENGTH) {
+		readLogRecord(new DataView(dataView.buffer, dataView.byteOffset + offset, LOG_RECORD_LENGTH));
+	}
+
+	logDownload.ackFrame = frame;
+	sendLogAck();
+	if (dataView.byteLength == LOG_FRAME_HEADER_LENGTH) { //End of log
+		console.log('Downloaded ', logDownload.rows.length, ' data log records');
+		saveLog(printLogRecords(), 'datalog.csv');
+		endLogDownload();
+	}
+}
+
+function readLogRecord(dataView) {
+	const type = dataView.getUint8(0);
+	if (type == LOG_TYPE_TIME) {
+		logDownload.time = dataView.getUint32(4, IS_LITTLE_ENDIAN);
+		return;
+	}
+
+	logDownload.time += dataView.getUint16(2, IS_LITTLE_ENDIAN);
+	logDownload.rows.push([
+		logDownload.time,
+		(type < LOG_TYPE_NAMES.length) ? LOG_TYPE_NAMES[type] : type,
+		dataView.getFloat32(4, IS_LITTLE_ENDIAN),
+		dataView.getFloat32(8, IS_LITTLE_ENDIAN),
+		dataView.getFloat32(12, IS_LITTLE_ENDIAN)
+	]);
+}
+
+/*
+ * Acknowledgements are cumulative, so only the newest is sent if one is already in progress
+ */
+function sendLogAck() {
+	if (logDownload.ackBusy || (logDownload.ackFrame < 0)) {
+		return;
+	}
+
+	const dataView = new DataView(new ArrayBuffer(5));
+	dataView.setUint8(0, LOG_CONTROL_ACK);
+	dataView.setUint32(1, logDownload.ackFrame, IS_LITTLE_ENDIAN);
+	logDownload.ackFrame = -1;
+	logDownload.ackBusy = true;
+	logControlCharacteristic.writeValueWithoutResponse(dataView.buffer).catch(error => {
+		console.log('Error acknowledging data log frame: ', error);
+	}).finally(() => {
+		logDownload.ackBusy = false;
+		sendLogAck();
+	});
+}
+
+function endLogDownload() {
+	logDownload.active = false;
+	logRecordsCharacteristic.removeEventListener('characteristicvaluechanged', onLogFrame);
+	logRecordsCharacteristic.stopNotifications().catch(error => {
+		console.log('Error stopping data log notifications: ', error);
+	});
+}
+
+function printLogRecords() {
+	let csv = 'Device time (ms),Record type,Value 1,Value 2,Value 3\n';
+	for (const row of logDownload.rows) {
+		csv += row.join(',') + '\n';
+	}
+
+	return csv;
+}
+
@@ -0,0 +1,128 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module detects whether the hand is moving or still from the accelerometer stream. Other modules use the current activity
+ * profile to select their sample rates, so that we save power while the glove is lying on a bench.
+ *
+ * Gravity is tracked with a slow low pass filter on the acceleration vector. Motion is the magnitude of the difference between
+ * the latest sample and the gravity estimate. To avoid flapping between profiles there are separate thresholds for entering and
+ * leaving the moving profile, and a minimum dwell time in each profile before we will leave it.
+ */
+
+#include <math.h>
+#include <Arduino.h>
+
+#include "activity.h"
+#include "config.h"
+
+#define GRAVITY_TIME_CONSTANT 0.5f //seconds
+#define MOTION_THRES 0.6f //m/s^2, deviation from gravity above which the hand is moving
+#define STILL_THRES 0.3f //m/s^2, deviation from gravity below which the hand may be still
+
+/*
+ * Minimum time to stay in each profile before switching (ms), indexed by activity_profile_t. Longer dwell in the moving profile
+ * improves responsiveness to short pauses; shorter dwell saves more battery. By default the still profile is left immediately when
+ * motion is detected. Both are runtime parameters, so the hysteresis can be tuned to the work done at each site
+ */
+static const config_param_t DWELL_PARAM[NUM_ACTIVITY_PROFILES] = {
+  config_param_activityDwellTime,      //activity_profile_moving
+  config_param_activityStillDwellTime  //activity_profile_still
+};
+
+static activity_profile_t m_profile = activity_profile_moving;
+static unsigned long m_profileStartTime;
+static unsigned long m_quietStartTime;
+static bool m_quiet = false;
+static unsigned long m_dwellTime[NUM_ACTIVITY_PROFILES];
+
+static float m_alpha;
+static float m_gravity[3];
+static bool m_gravityValid = false;
+
+static unsigned long minDwell(activity_profile_t profile) {
+  return config_getUint(DWELL_PARAM[profile]);
+}
+
+static void setProfile(activity_profile_t profile, unsigned long now) {
+  m_dwellTime[m_profile] += now - m_profileStartTime;
+  m_profileStartTime = now;
+  m_profile = profile;
+}
+
+void activity_init(float sampleRate) {
+  int i;
+  for (i = 0; i < NUM_ACTIVITY_PROFILES; i++) {
+    m_dwellTime[i] = 0;
+  }
+
+  m_profile = activity_profile_moving; //Start in moving profile so that nothing is slowed down until we know the hand is still
+  m_profileStartTime = millis();
+  m_quiet = false;
+  m_gravityValid = false;
+  activity_setSampleRate(sampleRate);
+}
+
+void activity_setSampleRate(float sampleRate) {
+  float dt = 1.0f / sampleRate;
+  m_alpha = dt / (GRAVITY_TIME_CONSTANT + dt);
+}
+
+bool activity_update(float x, float y, float z, unsigned long now) {
+  float in[3] = { x, y, z };
+  int i;
+  if (!m_gravityValid) {
+    for (i = 0; i < 3; i++) {
+      m_gravity[i] = in[i];
+    }
+
+    m_gravityValid = true;
+  }
+
+  float sumSquares = 0.0f;
+  for (i = 0; i < 3; i++) {
+    m_gravity[i] += m_alpha * (in[i] - m_gravity[i]);
+    float diff = in[i] - m_gravity[i];
+    sumSquares += diff * diff;
+  }
+
+  float motion = sqrtf(sumSquares);
+  activity_profile_t oldProfile = m_profile;
+
+  if (motion >= MOTION_THRES) {
+    m_quiet = false;
+    if ((m_profile == activity_profile_still) && (now - m_profileStartTime >= minDwell(activity_profile_still))) {
+      setProfile(activity_profile_moving, now); //React on the first sample showing motion
+    }
+  } else if (motion < STILL_THRES) {
+    if (!m_quiet) {
+      m_quiet = true;
+      m_quietStartTime = now;
+    }
+
+    if ((m_profile == activity_profile_moving) && (now - m_quietStartTime >= minDwell(activity_profile_moving)) &&
+        (now - m_profileStartTime >= minDwell(activity_profile_moving))) {
+      setProfile(activity_profile_still, now);
+    }
+  } else {
+    m_quiet = false; //Between thresholds: not enough to wake up, but not quiet enough to count towards going still
+  }
+
+  return (m_profile != oldProfile);
+}
+
+activity_profile_t activity_getProfile(void) {
+  return m_profile;
+}
+
+unsigned long activity_getDwellTime(activity_profile_t profile) {
+  unsigned long dwell = m_dwellTime[profile];
+  if (profile == m_profile) {
+    dwell += millis() - m_profileStartTime; //Include time spent in current profile so far
+  }
+
+  return dwell;
+}
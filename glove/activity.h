@@ -0,0 +1,25 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __ACTIVITY_H
+#define __ACTIVITY_H
+
+typedef enum {
+  activity_profile_moving = 0,
+  activity_profile_still
+} activity_profile_t;
+
+#define NUM_ACTIVITY_PROFILES 2
+
+void activity_init(float sampleRate);
+void activity_setSampleRate(float sampleRate);
+bool activity_update(float x, float y, float z, unsigned long now);
+activity_profile_t activity_getProfile(void);
+unsigned long activity_getDwellTime(activity_profile_t profile);
+
+#endif /* __ACTIVITY_H */
@@ -26,6 +26,19 @@
 #include <BLEUtils.h>
 
 #include "blewrapper.h"
+#include "adaf1080.h"
+#include "activity.h"
+#include "energy.h"
+#include "idle.h"
+#include "i2cbus.h"
+#include "powermgmt.h"
+#include "retained.h"
+#include "datalog.h"
+#include "timebase.h"
+#include "config.h"
+#include "trace.h"
+#include "bench.h"
+#include "profile.h"
 #include "err.h"
 
 typedef struct {
@@ -77,23 +90,20 @@ typedef struct {
 #define PIN_FLIP_DRV 33
 #define PIN_CNV A5
 
-/*
- * Diag coil produces approx. -18uT field strength based on empirical measurments. This is less than datasheet value of 22.8uT (for 100mA drive).
- * Upper and lower limits allow for noise, as 18uT is close to noise floor even with averaging.
- */
-#define DIAG_FIELD_MIN -20.0F
-#define DIAG_FIELD_MAX -16.0F
-
 #define STARTUP_DELAY 50 //ms
 #define FLIP_DELAY 1 //ms
 #define DIAG_DELAY 100 //us
-#define SAMPLE_TIME 4000 //4000us = 250Hz
-#define NUM_SAMPLES 250 //Calculate statistics every second
 #define CAL_AVERAGE_SAMPLES 32 //Average over multiple samples during calibration process to reduce noise
 #define SAT_AVERAGE_SAMPLES 8
 
+/*
+ * Sample time and number of samples per statistics window are runtime parameters (250Hz, every second by default).
+ * Decimation factor for each activity profile, indexed by activity_profile_t. Statistics are still calculated at the same interval
+ */
+static const int DECIMATION[NUM_ACTIVITY_PROFILES] = { 1, 5 }; //250Hz when moving, 50Hz when still
+
 #define BLE_INST_ID 0
-#define NUM_CHARACTERISTICS 9
+#define NUM_CHARACTERISTICS 10
 
 #define BLE_SERVICE_UUID BLEUUID("7749eb1b-2b16-4d32-8422-e792dae7adb8")
 #define CALIBRATE_UUID BLEUUID("0b541f35-34c1-4769-b206-8deaaa7e0922")
@@ -105,18 +115,22 @@ typedef struct {
 #define PP_UUID BLEUUID("eea8f3a7-d5b1-4454-8e5b-44ce3c0fb372")
 #define MIN_UUID BLEUUID("f3303f8c-89f4-4020-9912-de79a9617da1")
 #define MAX_UUID BLEUUID("fc13446a-8329-4a00-8b74-6119d1129485")
+#define FRAME_UUID BLEUUID("a3d6e1f8-5b2c-4f97-8e4a-1c7b9d3f6e25")
 
 #define CALIBRATE_FORMAT BLE2904::FORMAT_BOOLEAN
 #define SATURATED_FORMAT BLE2904::FORMAT_BOOLEAN
 #define MAGFIELD_FORMAT BLE2904::FORMAT_SINT32
+#define FRAME_FORMAT BLE2904::FORMAT_OPAQUE
 
 #define CALIBRATE_EXPONENT 0
 #define SATURATED_EXPONENT 0
 #define MAGFIELD_EXPONENT -2 //10nT precision
+#define FRAME_EXPONENT 0
 
 #define CALIBRATE_UNIT BLEUnit::Unitless
 #define SATURATED_UNIT BLEUnit::Unitless
 #define MAGFIELD_UNIT BLEUnit::uTesla
+#define FRAME_UNIT BLEUnit::Unitless
 
 #define CALIBRATE_NAME "Calibrate sensor"
 #define SATURATED_NAME "Sensor saturated"
@@ -127,6 +141,16 @@ typedef struct {
 #define PP_NAME "Peak-to-peak"
 #define MIN_NAME "Minimum"
 #define MAX_NAME "Maximum"
+#define FRAME_NAME "Statistics frame"
+
+#define FRAME_NUM_VALUES 3 //Average, RMS, peak (uT)
+
+#define RESULT_AVG 0 //Order of statistics in results, ADAF1080_NUM_RESULTS in total
+#define RESULT_AC_RMS 1
+#define RESULT_PK 2
+#define RESULT_PP 3
+#define RESULT_MIN 4
+#define RESULT_MAX 5
 
 static BLECharacteristic m_calibrateCharacteristic(CALIBRATE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_saturatedCharacteristic(SATURATED_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
@@ -137,6 +161,7 @@ static BLECharacteristic m_pkCharacteristic(PK_UUID, BLECharacteristic::PROPERTY
 static BLECharacteristic m_ppCharacteristic(PP_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_minCharacteristic(MIN_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_maxCharacteristic(MAX_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_frameCharacteristic(FRAME_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 
 static BLEWrapper m_calibrateWrapper(&m_calibrateCharacteristic, CALIBRATE_NAME, CALIBRATE_FORMAT, CALIBRATE_EXPONENT, CALIBRATE_UNIT);
 static BLEWrapper m_saturatedWrapper(&m_saturatedCharacteristic, SATURATED_NAME, SATURATED_FORMAT, SATURATED_EXPONENT, SATURATED_UNIT);
@@ -147,17 +172,20 @@ static BLEWrapper m_pkWrapper(&m_pkCharacteristic, PK_NAME, MAGFIELD_FORMAT, MAG
 static BLEWrapper m_ppWrapper(&m_ppCharacteristic, PP_NAME, MAGFIELD_FORMAT, MAGFIELD_EXPONENT, MAGFIELD_UNIT);
 static BLEWrapper m_minWrapper(&m_minCharacteristic, MIN_NAME, MAGFIELD_FORMAT, MAGFIELD_EXPONENT, MAGFIELD_UNIT);
 static BLEWrapper m_maxWrapper(&m_maxCharacteristic, MAX_NAME, MAGFIELD_FORMAT, MAGFIELD_EXPONENT, MAGFIELD_UNIT);
+static BLEWrapper m_frameWrapper(&m_frameCharacteristic, FRAME_NAME, FRAME_FORMAT, FRAME_EXPONENT, FRAME_UNIT);
 
 static unsigned long m_lastTime;
 static bool m_ready = false;
 static volatile bool m_requestCalibration = false;
 static int32_t m_offsetCorrection = 0; //Offset correction factor measured in ADC counts
 
-static int m_sampleCount;
-static float m_minValue;
-static float m_maxValue;
-static double m_avgAccum; //Use double precision for accumulators to prevent "catastrophic cancellation" error when calculating ACRMS = sqrt(RMS^2 - Average^2)
-static double m_rmsAccum;
+static int m_sampleCount = 0;
+static float m_minValue = FLT_MAX;
+static float m_maxValue = -FLT_MAX;
+static double m_avgAccum = 0.0; //Use double precision for accumulators to prevent "catastrophic cancellation" error when calculating ACRMS = sqrt(RMS^2 - Average^2)
+static double m_rmsAccum = 0.0;
+static uint64_t m_firstSampleTime; //Timebase, statistics are stamped with the middle of the window
+static uint64_t m_lastSampleTime;
 
 class CalibrateCallbacks : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
@@ -178,6 +206,7 @@ class CalibrateCallbacks : public BLECharacteristicCallbacks {
 };
 
 static void ad4002_writeConfig(ad4002_cfg_t cfg) {
+  PROFILE_ZONE("ad4002 SPI");
   /*
    * AD4002 config register write requires writing 16 bits and reading 18 bits, but Arduino only allows SPI transactions in multiples of 8 bits.
    * Pad transaction to 24 bits by stuffing with 1s so that MOSI idles HIGH.
@@ -197,6 +226,7 @@ static void ad4002_writeConfig(ad4002_cfg_t cfg) {
 }
 
 static ad4002_cfg_t ad4002_readConfig(void) {
+  PROFILE_ZONE("ad4002 SPI");
   uint8_t buffer[] = { AD4002_REG_READ_CMD, 0xFFU }; //Trailing 8 transmitted bits should be 1s
 
   digitalWrite(PIN_CNV, HIGH); //Generate CNV pulse. tCNVH assured by MCU clock speed
@@ -214,7 +244,18 @@ static ad4002_cfg_t ad4002_readConfig(void) {
   return cfg;
 }
 
+/*
+ * 24 bits read, of which the first 18 are the result
+ */
+static uint32_t ad4002_decode(const uint8_t *buffer) {
+  uint32_t result = buffer[0] << 10;
+  result |= buffer[1] << 2;
+  result |= buffer[2] >> 6; //Only use 2 MSBs of last byte, discarding 6 LSBs
+  return result;
+}
+
 static uint32_t ad4002_readResult(void) {
+  PROFILE_ZONE("ad4002 SPI");
   /*
    * AD4002 data read requires reading 18 bits, but Arduino only allows SPI transactions in multiples of 8 bits. Read 24 bits but discard 6 LSBs.
    */
@@ -227,11 +268,8 @@ static uint32_t ad4002_readResult(void) {
   SPI.beginTransaction(SPISettings(SPI_CLOCK_RATE, SPI_BIT_ORDER, SPI_MODE));
   SPI.transfer(buffer, 3);
   SPI.endTransaction();
-
-  uint32_t result = buffer[0] << 10;
-  result |= buffer[1] << 2;
-  result |= buffer[2] >> 6; //Only use 2 MSBs of last byte, discarding 6 LSBs
-  return result;
+  energy_addOp(energy_subsystem_adaf1080, energy_op_spi, 1);
+  return ad4002_decode(buffer);
 }
 
 static float ad4002_readAverage(int nSamples) {
@@ -251,12 +289,75 @@ static void resetStatistics(void) {
   m_avgAccum = m_rmsAccum = 0.0f;
 }
 
-static float readSensor(void) {
-  uint32_t adcCounts = ad4002_readResult(); //18 bit unipolar ADC result
+static float toMagField(uint32_t adcCounts) {
   int32_t bipolar = (int32_t)adcCounts - AD4002_MIDCODE; //18 bit bipolar ADC result i.e symmetrical about 0
   return (float)(bipolar - m_offsetCorrection) * ADAF1080_SCALE_FACTOR;
 }
 
+/*
+ * Returns true when the statistics window is complete
+ */
+static bool addSample(float magField) {
+  m_sampleCount++;
+  if (magField < m_minValue) {
+    m_minValue = magField;
+  }
+
+  if (magField > m_maxValue) {
+    m_maxValue = magField;
+  }
+
+  /*
+   * Use double precision for accumulators to prevent "catastrophic cancellation" bug when calculating ACRMS = sqrt(RMS^2 - Average^2)
+   */
+  double dMagField = (double)magField;
+  m_avgAccum += dMagField;
+  m_rmsAccum += dMagField * dMagField;
+
+  int decimation = DECIMATION[activity_getProfile()];
+  return (m_sampleCount >= (int)config_getUint(config_param_adaf1080NumSamples) / decimation);
+}
+
+/*
+ * Fills pResults (ADAF1080_NUM_RESULTS values) from the completed window, then starts the next one
+ */
+static void calcStatistics(float *pResults) {
+  double dAvg = m_avgAccum / (double)m_sampleCount;
+  double rawRmsSquared = m_rmsAccum / (double)m_sampleCount;
+  double acRmsSquared = rawRmsSquared - dAvg * dAvg; //Remove DC offset when calculating RMS - more useful for cable detection
+  if (acRmsSquared < 0.0f) {
+    /*
+     * Final layer of protection in case "catastrophic cancellation" bug still shows up despite best efforts (using double precision).
+     *
+     * In theory, RMS >= Average, therefore ACRMS = sqrt(RMS^2 - Average^2) should always yield a valid value. Even when no AC field is present,
+     * (RMS^2 - Average^2) = 0 but never becomes negative.
+     *
+     * In practice, in presence of large DC magnetic field, RMS and Average may both be very large and so subject to floating point rounding errors.
+     * (RMS^2 - Average^2) may become negative, and sqrt() returns NaN. This gets even worse because BLE stack internally uses fixed-point numbers
+     * which have no representation for NaN. End result is that NaN becomes INT32_MIN i.e. very large negative number.
+     *
+     * This hack will cause a "wrong" result in this rare edge case, but user seeing 0 is better than INT32_MIN (especially as correct result is ~0 anyway).
+     */
+    acRmsSquared = 0.0f;
+    ERROR("Catastrophic cancellation error detected in calculation of AC RMS");
+  }
+
+  float avg = (float)dAvg;
+  pResults[RESULT_AVG] = avg;
+  pResults[RESULT_AC_RMS] = (float)sqrt(acRmsSquared);
+  pResults[RESULT_PP] = m_maxValue - m_minValue; //Peak-to-peak is the difference between largest and smallest values
+  pResults[RESULT_MIN] = m_minValue;
+  pResults[RESULT_MAX] = m_maxValue;
+
+  if (m_maxValue > -m_minValue) { //Peak is the difference between the largest peak (+ve or -ve) and the average
+    pResults[RESULT_PK] = m_maxValue - avg;
+  } else {
+    pResults[RESULT_PK] = avg - m_minValue;
+  }
+
+  resetStatistics();
+}
+
 static float readSensorAverage(int nSamples) {
   float avgAdcCounts = ad4002_readAverage(nSamples);
   float totalOffset = (float)(AD4002_MIDCODE + m_offsetCorrection);
@@ -279,6 +380,8 @@ static float calibrateSensor(void) {
   
   float fOffsetCorrection = posReading - negReading;
   m_offsetCorrection = (int32_t)round(fOffsetCorrection); //AD4002 output is only 18-bit so we don't have to worry about overflowing 32-bit integer
+  retained_get()->adaf1080Offset = m_offsetCorrection; //Keep offset through deep sleep so sensor doesn't need recalibrating
+  retained_commit(RETAINED_ADAF1080);
 
   resetStatistics(); //Previously gathered statistics are now invalid due to change of offset, start from scratch
   return fOffsetCorrection * ADAF1080_SCALE_FACTOR; //We now know the sensor offset in raw ADC counts. Convert that back to uTesla for reporting
@@ -307,10 +410,18 @@ static bool isSensorSaturated(void) {
   float diagOff = readSensorAverage(SAT_AVERAGE_SAMPLES);
 
   float diff = diagOn - diagOff;
-  return (diff <= DIAG_FIELD_MIN) || (diff >= DIAG_FIELD_MAX); //If measured field strength change is outside of limits, sensor is likely saturated
+  return (diff <= config_get(config_param_adaf1080DiagMin)) || (diff >= config_get(config_param_adaf1080DiagMax)); //If measured field strength change is outside of limits, sensor is likely saturated
+}
+
+/*
+ * Returns true once the 5V boost converter has had time to start
+ */
+bool adaf1080_canInit(void) {
+  return (millis() - powermgmt_getDcdcOnTime() >= STARTUP_DELAY);
 }
 
 bool adaf1080_init(void) {
+  m_ready = false; //May be called again to recover from failure
   pinMode(PIN_FLIP_DRV, OUTPUT);
   digitalWrite(PIN_FLIP_DRV, LOW); //Start with FLIP_DRV low ready to generate positive edge
   pinMode(PIN_DIAG_EN, OUTPUT);
@@ -318,7 +429,11 @@ bool adaf1080_init(void) {
   pinMode(PIN_CNV, OUTPUT);
   digitalWrite(PIN_CNV, LOW); //CNV should idle low between transactions
 
-  delay(STARTUP_DELAY); //Allow boost converter to start
+  unsigned long dcdcOnTime = millis() - powermgmt_getDcdcOnTime();
+  if (dcdcOnTime < STARTUP_DELAY) {
+    delay(STARTUP_DELAY - dcdcOnTime); //Allow boost converter to start. Not reached from bring-up, which waits for adaf1080_canInit()
+  }
+
   digitalWrite(PIN_FLIP_DRV, HIGH); //Flip sensor back to positive direction
   SPI.begin();
 
@@ -348,6 +463,11 @@ bool adaf1080_init(void) {
   pinMode(MOSI, OUTPUT);
   digitalWrite(MOSI, HIGH);
 
+  if (retained_isValid(RETAINED_ADAF1080)) {
+    m_offsetCorrection = retained_get()->adaf1080Offset; //Waking from sleep, use offset measured before
+    m_offsetWrapper.writeValue((float)m_offsetCorrection * ADAF1080_SCALE_FACTOR);
+  }
+
   resetStatistics(); //Initialise counters for statistical measurement
   m_lastTime = millis();
   m_ready = true;
@@ -355,15 +475,10 @@ bool adaf1080_init(void) {
 }
 
 bool adaf1080_addService(BLEServer *pServer) {
-  if (!m_ready) {
-    return false;
-  }
-
   int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
   BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
   if (pService == NULL) {
     ERROR("Cannot add BLE service");
-    m_ready = false;
     return false;
   }
 
@@ -376,87 +491,103 @@ bool adaf1080_addService(BLEServer *pServer) {
   pService->addCharacteristic(&m_ppCharacteristic);
   pService->addCharacteristic(&m_minCharacteristic);
   pService->addCharacteristic(&m_maxCharacteristic);
+  pService->addCharacteristic(&m_frameCharacteristic);
   m_calibrateCharacteristic.setCallbacks(new CalibrateCallbacks());
   pService->start();
 
   uint8_t temp = 0;
   m_calibrateCharacteristic.setValue(&temp, 1);
-  m_calibrateCharacteristic.notify();
+  m_calibrateWrapper.notify();
   return true;
 }
 
 void adaf1080_loop(void) {
+  PROFILE_ZONE("adaf1080_loop");
   if (m_ready && m_requestCalibration) { //BTC_TASK thread has requsted calibration
     m_requestCalibration = false;
     float offset = calibrateSensor();
     uint8_t temp = 0;
     m_calibrateCharacteristic.setValue(&temp, 1); //Set value back to '0' when calibration is complete
-    m_calibrateCharacteristic.notify();
+    m_calibrateWrapper.notify();
     m_offsetWrapper.writeValue(offset);
   }
 
+  int decimation = DECIMATION[activity_getProfile()];
+  unsigned long period = config_getUint(config_param_adaf1080SampleTime) * decimation;
   unsigned long now = micros();
-  if (m_ready && (now - m_lastTime >= SAMPLE_TIME)) {
+  if (m_ready && (now - m_lastTime >= period)) {
     m_lastTime = now;
-    m_sampleCount++;
-    float magField = readSensor();
-    
-    if (magField < m_minValue) {
-      m_minValue = magField;
+    m_lastSampleTime = timebase_now();
+    if (m_sampleCount == 0) {
+      m_firstSampleTime = m_lastSampleTime;
     }
 
-    if (magField > m_maxValue) {
-      m_maxValue = magField;
-    }
-
-    /*
-     * Use double precision for accumulators to prevent "catastrophic cancellation" bug when calculating ACRMS = sqrt(RMS^2 - Average^2)
-     */
-    double dMagField = (double)magField;
-    m_avgAccum += dMagField;
-    m_rmsAccum += dMagField * dMagField;
-
-    if (m_sampleCount >= NUM_SAMPLES) {
-      double dAvg = m_avgAccum / (double)m_sampleCount;
-      double rawRmsSquared = m_rmsAccum / (double)m_sampleCount;
-      double acRmsSquared = rawRmsSquared - dAvg * dAvg; //Remove DC offset when calculating RMS - more useful for cable detection
-      if (acRmsSquared < 0.0f) {
-        /*
-         * Final layer of protection in case "catastrophic cancellation" bug still shows up despite best efforts (using double precision).
-         *
-         * In theory, RMS >= Average, therefore ACRMS = sqrt(RMS^2 - Average^2) should always yield a valid value. Even when no AC field is present,
-         * (RMS^2 - Average^2) = 0 but never becomes negative.
-         *
-         * In practice, in presence of large DC magnetic field, RMS and Average may both be very large and so subject to floating point rounding errors.
-         * (RMS^2 - Average^2) may become negative, and sqrt() returns NaN. This gets even worse because BLE stack internally uses fixed-point numbers
-         * which have no representation for NaN. End result is that NaN becomes INT32_MIN i.e. very large negative number.
-         *
-         * This hack will cause a "wrong" result in this rare edge case, but user seeing 0 is better than INT32_MIN (especially as correct result is ~0 anyway).
-         */
-        acRmsSquared = 0.0f;
-        ERROR("Catastrophic cancellation error detected in calculation of AC RMS");
-      }
-
-      float avg = (float)dAvg;
-      float acRms = (float)sqrt(acRmsSquared);
-      float pp = m_maxValue - m_minValue; //Peak-to-peak is the difference between largest and smallest values
-
-      float pk; //Peak is the difference between the largest peak (+ve or -ve) and the average
-      if (m_maxValue > -m_minValue) {
-        pk = m_maxValue - avg;
-      } else {
-        pk = avg - m_minValue;
-      }
+    uint32_t adcCounts = ad4002_readResult(); //18 bit unipolar ADC result
+    trace_record(trace_source_ad4002, &adcCounts, sizeof(adcCounts));
+    if (addSample(toMagField(adcCounts))) {
+      float results[ADAF1080_NUM_RESULTS];
+      calcStatistics(results);
+      float avg = results[RESULT_AVG];
+      float acRms = results[RESULT_AC_RMS];
+      float pk = results[RESULT_PK];
 
       m_saturatedWrapper.writeValue(isSensorSaturated());
       m_avgWrapper.writeValue(avg);
       m_rmsWrapper.writeValue(acRms);
       m_pkWrapper.writeValue(pk);
-      m_ppWrapper.writeValue(pp);
-      m_minWrapper.writeValue(m_minValue);
-      m_maxWrapper.writeValue(m_maxValue);
-
-      resetStatistics();
+      m_ppWrapper.writeValue(results[RESULT_PP]);
+      m_minWrapper.writeValue(results[RESULT_MIN]);
+      m_maxWrapper.writeValue(results[RESULT_MAX]);
+      datalog_write(datalog_type_magnetic, avg, acRms, pk);
+
+      float frameValues[FRAME_NUM_VALUES] = { avg, acRms, pk };
+      uint8_t frame[TIMEBASE_FRAME_LEN(FRAME_NUM_VALUES)];
+      uint64_t timestamp = m_firstSampleTime + (m_lastSampleTime - m_firstSampleTime) / 2;
+      int frameLen = timebase_packFrame(frame, timestamp, frameValues, FRAME_NUM_VALUES);
+      m_frameCharacteristic.setValue(frame, frameLen);
+      m_frameWrapper.notify();
     }
   }
+
+  if (m_ready) {
+    unsigned long elapsed = micros() - m_lastTime;
+    idle_wakeAfter((elapsed < period) ? (period - elapsed) : 0);
+    i2cbus_setDeadline(m_lastTime + period); //Keep I2C devices from holding up next sample
+  }
+}
+
+/*
+ * Trace replay: runs one recorded ADC code through the same statistics as adaf1080_loop(). Returns true and fills pResults
+ * (ADAF1080_NUM_RESULTS values) when a window completes
+ */
+bool adaf1080_replaySample(uint32_t adcCounts, float *pResults) {
+  if (!addSample(toMagField(adcCounts))) {
+    return false;
+  }
+
+  calcStatistics(pResults);
+  return true;
+}
+
+static void benchDecode(uint32_t iteration) {
+  uint8_t buffer[] = { (uint8_t)(iteration >> 2), (uint8_t)iteration, 0xFF };
+  bench_keep((float)ad4002_decode(buffer));
+}
+
+static void benchToMagField(uint32_t iteration) {
+  bench_keep(toMagField(AD4002_MIDCODE + (iteration & 0x3FF)));
+}
+
+static void benchStatistics(uint32_t iteration) {
+  float results[ADAF1080_NUM_RESULTS];
+  if (addSample(toMagField(AD4002_MIDCODE + (iteration & 0x3FF)))) {
+    calcStatistics(results); //Once per window, so cost is spread over the samples as it is in the loop
+    bench_keep(results[RESULT_AC_RMS]);
+  }
+}
+
+void adaf1080_bench(void) {
+  bench_run("ad4002_decode", benchDecode);
+  bench_run("adaf1080 toMagField", benchToMagField);
+  bench_run("adaf1080 statistics update", benchStatistics);
 }
@@ -9,8 +9,16 @@
 #ifndef __ADAF1080_H
 #define __ADAF1080_H
 
+#include <stdint.h>
+#include <BLEServer.h>
+
+#define ADAF1080_NUM_RESULTS 6 //Average, AC RMS, peak, peak-to-peak, min, max (uT)
+
+bool adaf1080_canInit(void);
 bool adaf1080_init(void);
 bool adaf1080_addService(BLEServer *pServer);
 void adaf1080_loop(void);
+bool adaf1080_replaySample(uint32_t adcCounts, float *pResults);
+void adaf1080_bench(void);
 
 #endif /* __ADAF1080_H */
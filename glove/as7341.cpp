@@ -8,12 +8,27 @@
 
 #define ERR_MODULE_NAME "AS7341"
 
+#include <math.h>
+#include <string.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <Adafruit_AS7341.h>
+#include <Adafruit_BusIO_Register.h>
 
 #include "i2c_address.h"
 #include "blewrapper.h"
+#include "colorimetry.h"
+#include "flicker.h"
+#include "activity.h"
+#include "idle.h"
+#include "i2cbus.h"
+#include "retained.h"
+#include "datalog.h"
+#include "timebase.h"
+#include "config.h"
+#include "trace.h"
+#include "bench.h"
+#include "profile.h"
 #include "err.h"
 
 #define NUM_GAINS 11
@@ -47,25 +62,140 @@ const float AS7341_GAIN_VALS[NUM_GAINS] = {
 
 /*
  * Integration time = (ATIME + 1) * (ASTEP + 1) * 2.78us
- *                  = (599 + 1) * (29 + 1) * 2.78us
- *                  = 50ms
+ *
+ * ATIME and the default ASTEP are runtime parameters, 50ms by default. See config.cpp
  */
-#define DEFAULT_ATIME 29
-#define DEFAULT_ASTEP 599
 #define DEFAULT_GAIN_INDEX 9
-#define MAX_ADC_COUNTS ((DEFAULT_ATIME + 1) * (DEFAULT_ASTEP + 1))
+#define ADC_COUNTS_LIMIT 65535 //ADC full scale is (ATIME + 1) * (ASTEP + 1), limited to 16 bits
+#define ASTEP_PERIOD 278 //Integration step time in units of 10ns (2.78us)
 
-#define AUTOGAIN_INCR_THRES (25 * (MAX_ADC_COUNTS / 100))
-#define AUTOGAIN_DECR_THRES (75 * (MAX_ADC_COUNTS / 100))
-#define AUTOGAIN_MIN_INDEX 0
-#define AUTOGAIN_MAX_INDEX (NUM_GAINS - 1)
+/*
+ * Auto-exposure adjusts gain first, keeping integration time at the default. Integration time is only extended when gain
+ * is already at maximum, up to the largest ASTEP that does not exceed 16 bit full scale (~180ms at the default ATIME).
+ *
+ * Shortening integration time would not help in bright light: full scale shrinks in proportion, so a saturated reading stays saturated.
+ * Target and thresholds are therefore fixed ADC counts based on the default full scale.
+ *
+ * A saturated peak doesn't show how far over full scale the light is. The channels differ in sensitivity by up to 10x, so in most
+ * cases some are still in range, and the share of the peak each channel had in the last reading where nothing saturated gives the
+ * true peak. Exposure then moves straight to the target, as for an unsaturated reading. This assumes the spectrum hasn't changed
+ * much; if it has, the next reading corrects the difference. Only if every channel is saturated is nothing known, and then one
+ * probe integration is taken at minimum gain and 1/AUTOEXP_PROBE_DIV of the default integration time. The probe covers the whole
+ * range the sensor can measure, in a fraction of the time of a full reading.
+ */
+#define AUTOEXP_TARGET_PCT 50 //Aim for peak channel reading at 50% of default full scale
+#define AUTOEXP_INCR_PCT 25 //Only change exposure if peak falls outside 25% - 75% of default full scale
+#define AUTOEXP_DECR_PCT 75
+#define AUTOEXP_SAT_PCT 95 //Peak above this percentage of actual full scale is treated as saturated
+#define AUTOEXP_SHARE_MIN_COUNTS 100 //Channels below this are too noisy to estimate the peak from
+#define AUTOEXP_PROBE_DIV 8
+#define AUTOEXP_MIN_INDEX 0
+#define AUTOEXP_MAX_INDEX (NUM_GAINS - 1)
 
 #define NUM_CHANNELS 12
-#define SAMPLE_TIME 1000 //milliseconds
+#define HIGH_CHANNEL_OFFSET 6 //F5-F8 pass is stored in second half of readings buffer
+
+/*
+ * AS7341 INT pin (open drain, active low) signals end of each integration, so we don't have to keep polling over I2C.
+ * If an interrupt is missed for any reason, fall back to checking the sensor after a timeout.
+ */
+#define PIN_INT 32
+#define INT_TIMEOUT 1000 //milliseconds
+
+/*
+ * Channel modes. In "all" mode, two SMUX passes are required to read all 8 spectral channels. The subset modes only need one SMUX pass,
+ * so measurements run continuously at twice the rate.
+ */
+typedef enum {
+  channel_mode_all = 0,
+  channel_mode_low,  //F1-F4, Clear, NIR
+  channel_mode_high  //F5-F8, Clear, NIR
+} channel_mode_t;
+
+#define NUM_MODES 3
+#define DEFAULT_MODE channel_mode_all
+
+/*
+ * Index of characteristic for each entry in readings buffer, or -1 if not reported. Indexed by [mode][channel]
+ */
+static const int CHANNEL_MAP[NUM_MODES][NUM_CHANNELS] = {
+  { 0, 1, 2, 3, -1, -1, 4, 5, 6, 7, 8, 9 }, //Clear and NIR are read in both passes, only report the second copy
+  { 0, 1, 2, 3, 8, 9, -1, -1, -1, -1, -1, -1 },
+  { -1, -1, -1, -1, -1, -1, 4, 5, 6, 7, 8, 9 }
+};
+
+#define CLEAR_CHARACTERISTIC 8
+#define NIR_CHARACTERISTIC 9
+
+/*
+ * Flicker measurement. The spectral and flicker engines share the SMUX, so they are time-sliced: every FLICKER_INTERVAL the spectral
+ * measurement is paused for one flicker capture (~200ms), then resumed.
+ *
+ * Raw flicker channel samples are written to the AS7341's internal FIFO, which we drain into a buffer. The Adafruit library only supports
+ * the built-in 100/120Hz detector, so the registers below are accessed directly. See AS7341 datasheet section 10 for register descriptions.
+ *
+ * Sample time = (FD_TIME + 1) * 2.78us
+ *             = (359 + 1) * 2.78us
+ *             = 1.0008ms
+ *
+ * 200 samples at ~1kHz puts 50, 60, 100 and 120Hz on (almost) exact Goertzel bins.
+ */
+#define FLICKER_INTERVAL 5000 //milliseconds
+#define FLICKER_NUM_SAMPLES 200
+#define FLICKER_FD_TIME 359
+#define FLICKER_SAMPLE_RATE (1.0f / ((FLICKER_FD_TIME + 1) * 2.78e-6f))
+#define FLICKER_FULL_SCALE (FLICKER_FD_TIME + 1)
+#define FLICKER_GAIN_OFFSET 4 //Flicker integration is 50x shorter than spectral, so start 16x higher than spectral gain
+#define FLICKER_POLL_TIME 20 //milliseconds. FIFO holds 128 samples (128ms) so must be drained faster than this
+#define FLICKER_TIMEOUT 1000 //milliseconds
+#define SMUX_TIMEOUT 100 //milliseconds
+
+#define REG_ENABLE 0x80
+#define REG_CH0_DATA_L 0x95 //Start of 6 channel results, 16 bits each, low byte first
+#define REG_CFG6 0xAF
+#define REG_FD_CFG0 0xD7
+#define REG_FD_TIME1 0xD8
+#define REG_FD_TIME2 0xDA
+#define REG_CONTROL 0xFA
+#define REG_FIFO_MAP 0xFC
+#define REG_FIFO_LVL 0xFD
+#define REG_FDATA 0xFE
+#define NUM_SMUX_REGS 0x14
+#define CHANNEL_DATA_LEN 12 //bytes, one SMUX pass (6 channels)
+
+#define ENABLE_PON (1U << 0U)
+#define ENABLE_SP_EN (1U << 1U)
+#define ENABLE_SMUXEN (1U << 4U)
+#define ENABLE_FDEN (1U << 6U)
+#define CFG6_SMUX_CMD_WRITE (2U << 3U)
+#define FD_CFG0_FIFO_WRITE_FD (1U << 7U)
+#define CONTROL_FIFO_CLR (1U << 1U)
+
+/*
+ * SMUX RAM contents for each single pass configuration. Values are from the AMS application note, as used by the library's
+ * setup_F1F4_Clear_NIR() and setup_F5F8_Clear_NIR() (which are private). Flicker has every photodiode disconnected except the flicker
+ * photodiode, connected to ADC5
+ */
+static const uint8_t SMUX_LOW[NUM_SMUX_REGS] = {
+  0x30, 0x01, 0x00, 0x00, 0x00, 0x42, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x20, 0x04, 0x00, 0x30, 0x01, 0x50, 0x00, 0x06
+};
+
+static const uint8_t SMUX_HIGH[NUM_SMUX_REGS] = {
+  0x00, 0x00, 0x00, 0x40, 0x02, 0x00, 0x10, 0x03, 0x50, 0x10, 0x03, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x50, 0x00, 0x06
+};
+
+static const uint8_t SMUX_FLICKER[NUM_SMUX_REGS] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60
+};
 
 #define BLE_INST_ID 0
 #define NUM_SENSOR_CHARACTERISTICS 10
-#define NUM_CHARACTERISTICS (NUM_SENSOR_CHARACTERISTICS + 1) //Add 1 for gain characeristic
+#define NUM_COLOUR_CHARACTERISTICS 5
+#define NUM_FLICKER_CHARACTERISTICS 3
+#if NUM_SENSOR_CHARACTERISTICS != COLORIMETRY_NUM_CHANNELS
+  #error "Colorimetry matrix does not match number of reported channels"
+#endif
+#define NUM_CHARACTERISTICS (NUM_SENSOR_CHARACTERISTICS + NUM_COLOUR_CHARACTERISTICS + NUM_FLICKER_CHARACTERISTICS + 3) //Add 3 for gain, channel mode and frame characteristics
 
 #define BLE_SERVICE_UUID BLEUUID((uint16_t)0x054D)
 #define LIGHT_415NM_UUID "0091c8af-1571-4857-ad20-3979ad0988a6"
@@ -79,13 +209,47 @@ const float AS7341_GAIN_VALS[NUM_GAINS] = {
 #define LIGHT_CLEAR_UUID "b640e35f-e4b0-4a89-922a-eea4e6af30e6"
 #define LIGHT_NIR_UUID "d5b7ab0d-aab7-4016-8dfa-6b1977fa4870"
 #define GAIN_UUID "e75ed433-6c87-4c78-bdbd-6b8d0398f237"
+#define MODE_UUID "f2c4a8e1-5b3d-4e97-8a06-c1d9e7b35f28"
+#define FLICKER_FREQ_UUID "4fb16d25-087c-4e3b-a194-d6c3ebf5af78"
+#define FLICKER_DEPTH_UUID "50c27e36-198d-4f4c-b2a5-e7d4fc06b089"
+#define LIGHT_SOURCE_UUID "61d38f47-2a9e-405d-83b6-f8e50d17c19a"
+#define CIE_X_UUID "1c7e3a92-d54f-4b08-9e61-a3f0b8d27c45"
+#define CIE_Y_UUID "2d9f4b03-e65a-4c19-8f72-b4a1c9e38d56"
+#define CIE_Z_UUID "3ea05c14-f76b-4d2a-9083-c5b2dae49e67"
+#define LUX_UUID BLEUUID((uint16_t)0x2AFB)
+#define CCT_UUID BLEUUID((uint16_t)0x2AE9)
+#define FRAME_UUID BLEUUID("b8e2f5a1-3d7c-4e96-a4b1-6f9c2d8e7a34")
 
 #define LIGHT_FORMAT BLE2904::FORMAT_UINT16
 #define GAIN_FORMAT BLE2904::FORMAT_UINT16
+#define MODE_FORMAT BLE2904::FORMAT_UINT8
+#define CIE_FORMAT BLE2904::FORMAT_UINT32
+#define LUX_FORMAT BLE2904::FORMAT_UINT24 //SIG Illuminance is uint24 in units of 0.01 lux
+#define CCT_FORMAT BLE2904::FORMAT_UINT16
+#define FLICKER_FREQ_FORMAT BLE2904::FORMAT_UINT8
+#define FLICKER_DEPTH_FORMAT BLE2904::FORMAT_UINT16
+#define LIGHT_SOURCE_FORMAT BLE2904::FORMAT_UINT8
+#define FRAME_FORMAT BLE2904::FORMAT_OPAQUE
 #define LIGHT_EXPONENT -2
 #define GAIN_EXPONENT -1
+#define MODE_EXPONENT 0
+#define CIE_EXPONENT -2
+#define LUX_EXPONENT -2
+#define CCT_EXPONENT 0
+#define FLICKER_FREQ_EXPONENT 0
+#define FLICKER_DEPTH_EXPONENT -1
+#define LIGHT_SOURCE_EXPONENT 0
+#define FRAME_EXPONENT 0
 #define LIGHT_UNIT BLEUnit::Unitless
 #define GAIN_UNIT BLEUnit::Unitless
+#define MODE_UNIT BLEUnit::Unitless
+#define CIE_UNIT BLEUnit::Unitless
+#define LUX_UNIT BLEUnit::Lux
+#define CCT_UNIT BLEUnit::Kelvin
+#define FLICKER_FREQ_UNIT BLEUnit::Hertz
+#define FLICKER_DEPTH_UNIT BLEUnit::Percent
+#define LIGHT_SOURCE_UNIT BLEUnit::Unitless
+#define FRAME_UNIT BLEUnit::Unitless
 
 #define LIGHT_415NM_NAME "Violet (415nm)"
 #define LIGHT_445NM_NAME "Dark blue (445nm)"
@@ -98,6 +262,18 @@ const float AS7341_GAIN_VALS[NUM_GAINS] = {
 #define LIGHT_CLEAR_NAME "Clear"
 #define LIGHT_NIR_NAME "Near infrared"
 #define GAIN_NAME "Gain"
+#define MODE_NAME "Fast channel mode"
+#define CIE_X_NAME "CIE X"
+#define CIE_Y_NAME "CIE Y"
+#define CIE_Z_NAME "CIE Z"
+#define LUX_NAME "Illuminance"
+#define CCT_NAME "Correlated colour temperature"
+#define FLICKER_FREQ_NAME "Flicker frequency"
+#define FLICKER_DEPTH_NAME "Flicker modulation depth"
+#define LIGHT_SOURCE_NAME "Light source type"
+#define FRAME_NAME "Colour frame"
+
+#define FRAME_NUM_VALUES 3 //Illuminance (lux), CCT (K), gain
 
 static BLECharacteristic m_characteristics[] = {
   BLECharacteristic(LIGHT_415NM_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
@@ -127,39 +303,238 @@ static BLEWrapper m_wrappers[] = {
 
 static BLECharacteristic m_gainCharacteristic(GAIN_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLEWrapper m_gainWrapper(&m_gainCharacteristic, GAIN_NAME, GAIN_FORMAT, GAIN_EXPONENT, GAIN_UNIT);
+static BLECharacteristic m_colourCharacteristics[] = {
+  BLECharacteristic(CIE_X_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(CIE_Y_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(CIE_Z_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(LUX_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(CCT_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY)
+};
+
+static BLEWrapper m_cieXWrapper(&(m_colourCharacteristics[0]), CIE_X_NAME, CIE_FORMAT, CIE_EXPONENT, CIE_UNIT);
+static BLEWrapper m_cieYWrapper(&(m_colourCharacteristics[1]), CIE_Y_NAME, CIE_FORMAT, CIE_EXPONENT, CIE_UNIT);
+static BLEWrapper m_cieZWrapper(&(m_colourCharacteristics[2]), CIE_Z_NAME, CIE_FORMAT, CIE_EXPONENT, CIE_UNIT);
+static BLEWrapper m_luxWrapper(&(m_colourCharacteristics[3]), LUX_NAME, LUX_FORMAT, LUX_EXPONENT, LUX_UNIT);
+static BLEWrapper m_cctWrapper(&(m_colourCharacteristics[4]), CCT_NAME, CCT_FORMAT, CCT_EXPONENT, CCT_UNIT);
+
+static BLECharacteristic m_flickerCharacteristics[] = {
+  BLECharacteristic(FLICKER_FREQ_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(FLICKER_DEPTH_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(LIGHT_SOURCE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY)
+};
+
+static BLEWrapper m_flickerFreqWrapper(&(m_flickerCharacteristics[0]), FLICKER_FREQ_NAME, FLICKER_FREQ_FORMAT, FLICKER_FREQ_EXPONENT, FLICKER_FREQ_UNIT);
+static BLEWrapper m_flickerDepthWrapper(&(m_flickerCharacteristics[1]), FLICKER_DEPTH_NAME, FLICKER_DEPTH_FORMAT, FLICKER_DEPTH_EXPONENT, FLICKER_DEPTH_UNIT);
+static BLEWrapper m_lightSourceWrapper(&(m_flickerCharacteristics[2]), LIGHT_SOURCE_NAME, LIGHT_SOURCE_FORMAT, LIGHT_SOURCE_EXPONENT, LIGHT_SOURCE_UNIT);
+
+static BLECharacteristic m_modeCharacteristic(MODE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_modeWrapper(&m_modeCharacteristic, MODE_NAME, MODE_FORMAT, MODE_EXPONENT, MODE_UNIT);
+
+static BLECharacteristic m_frameCharacteristic(FRAME_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_frameWrapper(&m_frameCharacteristic, FRAME_NAME, FRAME_FORMAT, FRAME_EXPONENT, FRAME_UNIT);
 
 static Adafruit_AS7341 m_sensor;
 static int m_gainIndex = DEFAULT_GAIN_INDEX;
+static uint8_t m_atime; //Integration settings from config
+static uint16_t m_defaultAstep;
+static uint16_t m_astep;
+static float m_channelShare[NUM_CHANNELS]; //Reading / peak, from last reading with nothing saturated. 0 if not known
+static uint32_t m_configGeneration;
 static bool m_gainChanged = false;
+static channel_mode_t m_mode = DEFAULT_MODE;
+static volatile channel_mode_t m_requestedMode = DEFAULT_MODE;
+static volatile bool m_intFlag = false;
+static volatile uint64_t m_intTimestamp; //Timebase, end of integration
 static unsigned long m_lastTime;
+static unsigned long m_lastIntTime;
 static bool m_ready = false;
 
+static Adafruit_I2CDevice *m_pI2cDev = NULL; //Direct register access for flicker engine
+static bool m_flickerActive = false;
+static bool m_flickerPending = false; //Flicker measurement starts on the next loop iteration
+static unsigned long m_lastFlickerTime;
+static unsigned long m_lastFlickerPollTime;
+static uint16_t m_flickerBuf[FLICKER_NUM_SAMPLES];
+static int m_flickerCount;
+static int m_flickerGainIndex;
+static float m_nirRatio = 0.0f; //NIR / Clear from latest spectral reading, used to classify light source
+
+class ModeCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    if (pCharacteristic == NULL) {
+      return;
+    }
+
+    size_t dataLen = pCharacteristic->getLength();
+    if (dataLen < 1) {
+      return;
+    }
+
+    uint8_t *pData = pCharacteristic->getData();
+    if (pData[0] < NUM_MODES) {
+      m_requestedMode = (channel_mode_t)pData[0]; //Callback runs in different thread. Main thread reconfigures sensor
+    }
+  }
+};
+
+static void IRAM_ATTR onInterrupt(void) {
+  m_intTimestamp = timebase_now();
+  m_intFlag = true;
+  idle_wakeFromISR();
+}
+
+static void loadConfig(void) {
+  m_configGeneration = config_getGeneration();
+  m_atime = (uint8_t)config_getUint(config_param_as7341Atime);
+  m_defaultAstep = (uint16_t)config_getUint(config_param_as7341Astep);
+}
+
+static void resetChannelShares(void) {
+  int i;
+  for (i = 0; i < NUM_CHANNELS; i++) {
+    m_channelShare[i] = 0.0f;
+  }
+}
+
+static uint16_t getMaxAstep(void) {
+  return (uint16_t)(ADC_COUNTS_LIMIT / (m_atime + 1) - 1); //Largest ASTEP that does not exceed 16 bit full scale
+}
+
+/*
+ * Time between reports (ms), indexed by activity_profile_t. Sensor is sampled continuously regardless
+ */
+static unsigned long getReportTime(activity_profile_t profile) {
+  return config_getUint((config_param_t)(config_param_as7341SampleTime + profile));
+}
+
+static bool writeRegister(uint8_t reg, uint8_t value) {
+  PROFILE_ZONE("as7341 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_as7341);
+  Adafruit_BusIO_Register r(m_pI2cDev, reg);
+  return r.write(value);
+}
+
+static uint8_t readRegister(uint8_t reg) {
+  PROFILE_ZONE("as7341 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_as7341);
+  Adafruit_BusIO_Register r(m_pI2cDev, reg);
+  return (uint8_t)r.read();
+}
+
+static bool setGain(as7341_gain_t gain) {
+  PROFILE_ZONE("as7341 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_as7341);
+  return m_sensor.setGain(gain);
+}
+
+static bool setAstep(uint16_t astep) {
+  PROFILE_ZONE("as7341 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_as7341);
+  return m_sensor.setASTEP(astep);
+}
+
+/*
+ * Measurement must be stopped first, SMUX can't be reconfigured while it is running
+ */
+static bool configureSmux(const uint8_t *config) {
+  writeRegister(REG_CFG6, CFG6_SMUX_CMD_WRITE);
+  uint8_t reg;
+  for (reg = 0; reg < NUM_SMUX_REGS; reg++) {
+    writeRegister(reg, config[reg]);
+  }
+
+  writeRegister(REG_ENABLE, readRegister(REG_ENABLE) | ENABLE_SMUXEN);
+  unsigned long start = millis();
+  while (readRegister(REG_ENABLE) & ENABLE_SMUXEN) { //SMUXEN clears itself when configuration is complete
+    if (millis() - start >= SMUX_TIMEOUT) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void startMeasurement(void) {
+  /*
+   * In subset modes SMUX only needs configuring once, then the sensor measures continuously. In "all" mode the library
+   * state machine alternates SMUX configuration between each integration.
+   */
+  m_intFlag = false;
+  {
+    PROFILE_ZONE("as7341 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_as7341);
+    m_sensor.clearInterruptStatus();
+  }
+
+  if (m_mode == channel_mode_all) {
+    PROFILE_ZONE("as7341 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_as7341);
+    m_sensor.startReading();
+  } else {
+    writeRegister(REG_ENABLE, ENABLE_PON); //Stop measurement while SMUX is reconfigured
+    if (!configureSmux((m_mode == channel_mode_low) ? SMUX_LOW : SMUX_HIGH)) {
+      ERROR("Could not configure SMUX for channel mode %d", (int)m_mode);
+    }
+
+    PROFILE_ZONE("as7341 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_as7341);
+    m_sensor.enableSpectralMeasurement(true);
+  }
+
+  m_lastIntTime = millis();
+}
+
 bool as7341_init(i2c_address_t addr) {
+  m_ready = false; //May be called again to recover from failure
   if (!m_sensor.begin(addr)) {
     ERROR("Could not initialise sensor");
     return false;
   }
 
-  m_sensor.setATIME(DEFAULT_ATIME);
-  m_sensor.setASTEP(DEFAULT_ASTEP);
+  if (m_pI2cDev == NULL) {
+    m_pI2cDev = new Adafruit_I2CDevice(addr, &Wire);
+  }
+
+  if ((m_pI2cDev == NULL) || !m_pI2cDev->begin()) {
+    ERROR("Could not initialise flicker register access");
+    return false;
+  }
+
+  loadConfig();
+  resetChannelShares();
+  m_astep = m_defaultAstep;
+  if (retained_isValid(RETAINED_AS7341) && (retained_get()->as7341GainIndex < NUM_GAINS)) {
+    m_gainIndex = retained_get()->as7341GainIndex; //Waking from sleep, start auto-exposure from where it left off
+    uint16_t astep = retained_get()->as7341Astep;
+    if ((astep >= m_defaultAstep) && (astep <= getMaxAstep())) { //Config may have changed since
+      m_astep = astep;
+    }
+  }
+
+  m_flickerGainIndex = DEFAULT_GAIN_INDEX;
+  m_sensor.setATIME(m_atime);
+  m_sensor.setASTEP(m_astep);
   m_sensor.setGain(AS7341_GAIN_LIST[m_gainIndex]);
-  m_sensor.startReading();
+  m_sensor.setAPERS(AS7341_INT_COUNT_ALL); //Interrupt at the end of every integration
+  m_sensor.enableSpectralInterrupt(true);
+
+  pinMode(PIN_INT, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(PIN_INT), onInterrupt, FALLING);
+  startMeasurement();
+  m_gainWrapper.writeValue(AS7341_GAIN_VALS[m_gainIndex]);
+  m_modeWrapper.writeValue((float)m_mode);
 
-  m_lastTime = millis();
+  m_flickerPending = false;
+  m_lastTime = m_lastFlickerTime = millis();
   m_ready = true;
   return true;
 }
 
 bool as7341_addService(BLEServer *pServer) {
-  if (!m_ready) {
-    return false;
-  }
-
   int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
   BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
   if (pService == NULL) {
     ERROR("Cannot add BLE service");
-    m_ready = false;
     return false;
   }
   
@@ -168,44 +543,174 @@ bool as7341_addService(BLEServer *pServer) {
     pService->addCharacteristic(&(m_characteristics[i]));
   }
 
+  for (i = 0; i < NUM_COLOUR_CHARACTERISTICS; i++) {
+    pService->addCharacteristic(&(m_colourCharacteristics[i]));
+  }
+
+  for (i = 0; i < NUM_FLICKER_CHARACTERISTICS; i++) {
+    pService->addCharacteristic(&(m_flickerCharacteristics[i]));
+  }
+
   pService->addCharacteristic(&m_gainCharacteristic);
+  pService->addCharacteristic(&m_modeCharacteristic);
+  pService->addCharacteristic(&m_frameCharacteristic);
+  m_modeCharacteristic.setCallbacks(new ModeCallbacks());
   pService->start();
-  m_gainWrapper.writeValue(AS7341_GAIN_VALS[m_gainIndex]);
   return true;
 }
 
-int autogain(int currGainIndex, uint16_t *readings) {
-  uint16_t maxReading = 0;
+static uint32_t getFullScale(uint16_t astep) {
+  uint32_t fullScale = (uint32_t)(m_atime + 1) * (uint32_t)(astep + 1);
+  if (fullScale > ADC_COUNTS_LIMIT) {
+    fullScale = ADC_COUNTS_LIMIT;
+  }
+
+  return fullScale;
+}
+
+/*
+ * Only channels with enough counts are updated. Channels not read in the current mode are zero, so keep their last share
+ */
+static void updateChannelShares(const uint16_t *readings, uint16_t peak) {
   int i;
   for (i = 0; i < NUM_CHANNELS; i++) {
-    if (readings[i] > maxReading) {
-      maxReading = readings[i];
+    if (readings[i] >= AUTOEXP_SHARE_MIN_COUNTS) {
+      m_channelShare[i] = (float)readings[i] / (float)peak;
     }
   }
+}
 
-  if (maxReading > AUTOGAIN_DECR_THRES) { //Decrease gain
-    if (currGainIndex > AUTOGAIN_MIN_INDEX) {
-      currGainIndex--;
+/*
+ * True peak of a saturated reading, from the highest channel still in range. Returns 0 if every channel is saturated or unknown
+ */
+static float estimatePeak(const uint16_t *readings, uint32_t satCounts) {
+  int best = -1;
+  int i;
+  for (i = 0; i < NUM_CHANNELS; i++) {
+    if ((readings[i] < satCounts) && (readings[i] >= AUTOEXP_SHARE_MIN_COUNTS) && (m_channelShare[i] > 0.0f) &&
+        ((best < 0) || (readings[i] > readings[best]))) {
+      best = i;
     }
-  } else if (maxReading < AUTOGAIN_DECR_THRES) {
-    if (currGainIndex < AUTOGAIN_MAX_INDEX) {
-      currGainIndex++;
+  }
+
+  if (best < 0) {
+    return 0.0f;
+  }
+
+  float estimate = (float)readings[best] / m_channelShare[best];
+  return (estimate > (float)satCounts) ? estimate : (float)satCounts; //Peak is at least full scale, whatever the spectrum
+}
+
+static bool setExposure(int newGainIndex, uint16_t newAstep, int *pGainIndex, uint16_t *pAstep) {
+  bool changed = (newGainIndex != *pGainIndex) || (newAstep != *pAstep);
+  *pGainIndex = newGainIndex;
+  *pAstep = newAstep;
+  return changed;
+}
+
+static bool autoexposure(uint16_t *readings, int *pGainIndex, uint16_t *pAstep) {
+  /*
+   * Gain settings are all powers of 2, so we can think of exposure on a log2 scale where each gain index is one "stop".
+   * Integration time is included as a fractional number of stops relative to the default. Work out how many stops we need to move
+   * to bring the peak reading to the target level, then convert back into a gain index and (only if gain is at its limit) integration time.
+   */
+  uint16_t peak = 0;
+  int i;
+  for (i = 0; i < NUM_CHANNELS; i++) {
+    if (readings[i] > peak) {
+      peak = readings[i];
     }
   }
 
-  return currGainIndex;
+  uint32_t defaultCounts = getFullScale(m_defaultAstep);
+  uint32_t satCounts = AUTOEXP_SAT_PCT * getFullScale(*pAstep) / 100;
+  float target = (float)(AUTOEXP_TARGET_PCT * defaultCounts / 100);
+  float stops;
+  if (peak >= satCounts) {
+    float estimate = estimatePeak(readings, satCounts);
+    if (estimate == 0.0f) { //Nothing in range to estimate from
+      if (*pGainIndex > AUTOEXP_MIN_INDEX) {
+        uint16_t probeAstep = (uint16_t)((m_defaultAstep + 1) / AUTOEXP_PROBE_DIV);
+        return setExposure(AUTOEXP_MIN_INDEX, (probeAstep > 0) ? probeAstep - 1 : 0, pGainIndex, pAstep);
+      }
+
+      return setExposure(AUTOEXP_MIN_INDEX, m_defaultAstep, pGainIndex, pAstep); //Saturated even at the probe, beyond sensor range
+    }
+
+    stops = log2f(target / estimate);
+  } else if ((peak < AUTOEXP_INCR_PCT * defaultCounts / 100) || (peak > AUTOEXP_DECR_PCT * defaultCounts / 100)) {
+    if (peak > 0) {
+      updateChannelShares(readings, peak);
+    }
+
+    stops = log2f(target / (float)((peak > 0) ? peak : 1));
+  } else {
+    updateChannelShares(readings, peak);
+    return false; //Peak is within limits, no change needed
+  }
+
+  float currPos = (float)*pGainIndex + log2f((float)(*pAstep + 1) / (float)(m_defaultAstep + 1));
+  float newPos = currPos + stops;
+
+  uint16_t newAstep = m_defaultAstep;
+  int newGainIndex = (int)lroundf(newPos);
+  if (newGainIndex < AUTOEXP_MIN_INDEX) {
+    newGainIndex = AUTOEXP_MIN_INDEX;
+  } else if (newGainIndex > AUTOEXP_MAX_INDEX) { //Make up the remaining stops with integration time
+    newGainIndex = AUTOEXP_MAX_INDEX;
+    float astep = (float)(m_defaultAstep + 1) * exp2f(newPos - (float)newGainIndex) - 1.0f;
+    float maxAstep = (float)getMaxAstep();
+    if (astep > maxAstep) {
+      astep = maxAstep;
+    }
+
+    newAstep = (uint16_t)lroundf(astep);
+  }
+
+  return setExposure(newGainIndex, newAstep, pGainIndex, pAstep);
 }
 
-static void reportReadings(uint16_t *readings) {
-  int nChannel, nCharacteristic = 0;
+/*
+ * Same as library toBasicCounts(), but uses the settings the reading was taken with rather than reading the gain back over I2C
+ */
+static float toBasicCounts(uint16_t raw, int gainIndex, uint16_t astep) {
+  float integrationTime = (float)(m_atime + 1) * (float)(astep + 1) * (float)ASTEP_PERIOD / 100000.0f; //ms
+  return (float)raw / (AS7341_GAIN_VALS[gainIndex] * integrationTime);
+}
+
+static void reportReadings(uint16_t *readings, uint64_t timestamp) {
+  float basicCounts[NUM_SENSOR_CHARACTERISTICS];
+  int nChannel;
   for (nChannel = 0; nChannel < NUM_CHANNELS; nChannel++) {
-    if ((nChannel != 4) && (nChannel != 5)) {  //Skip channels 4 and 5 - these are duplicates
-      float corrected = m_sensor.toBasicCounts(readings[nChannel]);
-      m_wrappers[nCharacteristic].writeValue(corrected);
-      nCharacteristic++;
+    int nCharacteristic = CHANNEL_MAP[m_mode][nChannel];
+    if (nCharacteristic >= 0) {
+      float corrected = toBasicCounts(readings[nChannel], m_gainIndex, m_astep);
+      if (m_mode == channel_mode_all) {
+        m_wrappers[nCharacteristic].setValue(corrected); //Colour frame carries the result, raw channels are read on demand
+      } else {
+        m_wrappers[nCharacteristic].writeValue(corrected); //Subset modes are for live display of the raw channels
+      }
+      basicCounts[nCharacteristic] = corrected;
     }
   }
 
+  if (m_mode == channel_mode_all) { //Colorimetry needs the full spectrum
+    colorimetry_t colour;
+    colorimetry_calculate(basicCounts, &colour);
+    m_cieXWrapper.writeValue(colour.X);
+    m_cieYWrapper.writeValue(colour.Y);
+    m_cieZWrapper.writeValue(colour.Z);
+    m_luxWrapper.writeValue(colour.lux);
+    m_cctWrapper.writeValue(colour.cct);
+    datalog_write(datalog_type_light, colour.lux, colour.cct, AS7341_GAIN_VALS[m_gainIndex]);
+
+    float frameValues[FRAME_NUM_VALUES] = { colour.lux, colour.cct, AS7341_GAIN_VALS[m_gainIndex] };
+    uint8_t frame[TIMEBASE_FRAME_LEN(FRAME_NUM_VALUES)];
+    int frameLen = timebase_packFrame(frame, timestamp, frameValues, FRAME_NUM_VALUES);
+    m_frameCharacteristic.setValue(frame, frameLen);
+    m_frameWrapper.notify();
+  }
+
   if (m_gainChanged) {
     m_gainChanged = false;
     float gainVal = AS7341_GAIN_VALS[m_gainIndex];
@@ -213,38 +718,365 @@ static void reportReadings(uint16_t *readings) {
   }
 }
 
-static void handleReadings(uint16_t *readings) {
+static void updateNirRatio(uint16_t *readings) {
+  uint16_t clear = 0, nir = 0;
+  int nChannel;
+  for (nChannel = 0; nChannel < NUM_CHANNELS; nChannel++) {
+    int nCharacteristic = CHANNEL_MAP[m_mode][nChannel];
+    if (nCharacteristic == CLEAR_CHARACTERISTIC) {
+      clear = readings[nChannel];
+    } else if (nCharacteristic == NIR_CHARACTERISTIC) {
+      nir = readings[nChannel];
+    }
+  }
+
+  m_nirRatio = (clear > 0) ? ((float)nir / (float)clear) : 0.0f; //Same gain and integration time, so raw counts can be compared directly
+}
+
+static bool handleReadings(uint16_t *readings, uint64_t timestamp) {
+  updateNirRatio(readings);
+
   /*
    * Readings are reported at the "sample rate", but we actually sample the sensor continually.
-   * This allows the autogain algorithm to react quickly.
+   * This allows the auto-exposure algorithm to react quickly.
    */
   unsigned long now = millis();
-  if (now - m_lastTime >= SAMPLE_TIME) {
+  if (now - m_lastTime >= getReportTime(activity_getProfile())) {
     m_lastTime = now;
-    reportReadings(readings);
+    reportReadings(readings, timestamp);
   }
 
   /*
    * Do any gain changes AFTER reporting the readings so that we don't screw up gain correction.
    * Gain change will apply to next reading
    */
-  int newGainIndex = autogain(m_gainIndex, readings);
+  int newGainIndex = m_gainIndex;
+  uint16_t newAstep = m_astep;
+  if (!autoexposure(readings, &newGainIndex, &newAstep)) {
+    return false;
+  }
+
   as7341_gain_t newGain = AS7341_GAIN_LIST[newGainIndex];
-  if ((newGainIndex != m_gainIndex) && m_sensor.setGain(newGain)) { //Only report gain change if applied successfully
+  if ((newGainIndex != m_gainIndex) && setGain(newGain)) { //Only report gain change if applied successfully
     m_gainIndex = newGainIndex;
     m_gainChanged = true;
   }
+
+  if ((newAstep != m_astep) && setAstep(newAstep)) {
+    m_astep = newAstep;
+  }
+
+  retained_state_t *pRetained = retained_get(); //Cheap enough (CRC of a few bytes) to update after every reading
+  pRetained->as7341GainIndex = (uint8_t)m_gainIndex;
+  pRetained->as7341Astep = m_astep;
+  retained_commit(RETAINED_AS7341);
+
+  return true;
+}
+
+static void startFlicker(void) {
+  writeRegister(REG_ENABLE, ENABLE_PON); //Stop spectral measurement, SMUX can't be reconfigured while it is running
+  if (!configureSmux(SMUX_FLICKER)) {
+    ERROR("Could not configure SMUX for flicker measurement");
+    m_lastFlickerTime = millis(); //Try again next interval
+    startMeasurement();
+    return;
+  }
+
+  uint16_t fdTime = FLICKER_FD_TIME;
+  writeRegister(REG_FD_TIME1, fdTime & 0xFFU);
+  writeRegister(REG_FD_TIME2, (uint8_t)(m_flickerGainIndex << 3U) | ((fdTime >> 8U) & 0x07U)); //FD_GAIN uses same encoding as AGAIN
+  writeRegister(REG_FIFO_MAP, 0x00); //Only flicker samples in FIFO, no spectral channels
+  writeRegister(REG_FD_CFG0, FD_CFG0_FIFO_WRITE_FD);
+  writeRegister(REG_CONTROL, CONTROL_FIFO_CLR);
+  writeRegister(REG_ENABLE, ENABLE_PON | ENABLE_FDEN);
+
+  m_flickerCount = 0;
+  m_flickerActive = true;
+  m_lastFlickerTime = m_lastFlickerPollTime = millis();
+}
+
+static void stopFlicker(void) {
+  writeRegister(REG_ENABLE, ENABLE_PON);
+  writeRegister(REG_FD_CFG0, 0x00);
+  m_flickerActive = false;
+  startMeasurement(); //Resume spectral measurement
+}
+
+static void adjustFlickerGain(void) {
+  /*
+   * Simple one-step gain control. Flicker is only measured every few seconds and modulation depth is a ratio, so precise exposure isn't needed.
+   */
+  uint16_t peak = 0;
+  int i;
+  for (i = 0; i < FLICKER_NUM_SAMPLES; i++) {
+    if (m_flickerBuf[i] > peak) {
+      peak = m_flickerBuf[i];
+    }
+  }
+
+  if ((peak >= FLICKER_FULL_SCALE) && (m_flickerGainIndex > AUTOEXP_MIN_INDEX)) {
+    m_flickerGainIndex--;
+  } else if ((peak < FLICKER_FULL_SCALE / 4) && (m_flickerGainIndex < AUTOEXP_MAX_INDEX)) {
+    m_flickerGainIndex++;
+  }
+}
+
+static void handleFlicker(void) {
+  unsigned long now = millis();
+  if (now - m_lastFlickerTime >= FLICKER_TIMEOUT) {
+    ERROR("Timed out waiting for flicker samples");
+    stopFlicker();
+    return;
+  }
+
+  if (now - m_lastFlickerPollTime < FLICKER_POLL_TIME) {
+    return;
+  }
+
+  m_lastFlickerPollTime = now;
+  int level = readRegister(REG_FIFO_LVL); //Number of 16 bit samples waiting in FIFO
+  Adafruit_BusIO_Register fifoData(m_pI2cDev, REG_FDATA, 2, LSBFIRST);
+  while ((level > 0) && (m_flickerCount < FLICKER_NUM_SAMPLES)) {
+    {
+      PROFILE_ZONE("as7341 I2C");
+      I2CBUS_TRANSFER(i2cbus_device_as7341);
+      m_flickerBuf[m_flickerCount] = (uint16_t)fifoData.read();
+    }
+
+    m_flickerCount++;
+    level--;
+  }
+
+  if (m_flickerCount < FLICKER_NUM_SAMPLES) {
+    return;
+  }
+
+  stopFlicker();
+
+  flicker_t result;
+  flicker_analyse(m_flickerBuf, FLICKER_NUM_SAMPLES, FLICKER_SAMPLE_RATE, m_nirRatio, &result);
+  m_flickerFreqWrapper.writeValue(result.frequency);
+  m_flickerDepthWrapper.writeValue(result.maxDepth);
+  m_lightSourceWrapper.writeValue((float)result.source);
+
+  adjustFlickerGain();
+}
+
+/*
+ * Middle of the integration(s) that produced the readings, given the time they finished. "All" mode takes one integration per SMUX pass
+ */
+static uint64_t getSampleTime(uint64_t endTime) {
+  uint64_t integrationTime = (uint64_t)(m_atime + 1) * (uint64_t)(m_astep + 1) * ASTEP_PERIOD / 100ULL; //us
+  int passes = (m_mode == channel_mode_all) ? 2 : 1;
+  return endTime - integrationTime * passes / 2;
+}
+
+static bool readChannels(uint16_t *readings) {
+  PROFILE_ZONE("as7341 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_as7341);
+  if (m_mode == channel_mode_all) {
+    return m_sensor.getAllChannels(readings);
+  }
+
+  int offset = (m_mode == channel_mode_high) ? HIGH_CHANNEL_OFFSET : 0;
+  int i;
+  for (i = 0; i < NUM_CHANNELS; i++) {
+    readings[i] = 0; //Unused half of buffer must not affect auto-exposure
+  }
+
+  /*
+   * One SMUX pass is already complete, so just read its 6 results. The library's readAllChannels() would run both passes again,
+   * reprogramming SMUX twice and writing 12 values from the offset
+   */
+  Adafruit_BusIO_Register channelData(m_pI2cDev, REG_CH0_DATA_L, CHANNEL_DATA_LEN);
+  return channelData.read((uint8_t *)&readings[offset], CHANNEL_DATA_LEN); //ESP32 is little endian, same as sensor
+}
+
+static void service(void) {
+  if (m_flickerActive) {
+    handleFlicker();
+    return;
+  }
+
+  if (m_flickerPending) { //SMUX reconfiguration is a bus slice of its own, separate from the reading before it
+    m_flickerPending = false;
+    startFlicker();
+    return;
+  }
+
+  if (m_requestedMode != m_mode) {
+    m_mode = m_requestedMode;
+    startMeasurement();
+    m_modeWrapper.writeValue((float)m_mode);
+    return;
+  }
+
+  if (config_getGeneration() != m_configGeneration) {
+    uint8_t oldAtime = m_atime;
+    uint16_t oldDefaultAstep = m_defaultAstep;
+    loadConfig();
+    if ((m_atime != oldAtime) || (m_defaultAstep != oldDefaultAstep)) { //Report times are read from config as they are needed
+      m_astep = m_defaultAstep; //Auto-exposure starts again from new default integration time
+      {
+        PROFILE_ZONE("as7341 I2C");
+        I2CBUS_TRANSFER(i2cbus_device_as7341);
+        m_sensor.setATIME(m_atime);
+      }
+
+      setAstep(m_astep);
+      startMeasurement();
+      return;
+    }
+  }
+
+  unsigned long now = millis();
+  bool intFlag = m_intFlag;
+  uint64_t endTime = m_intTimestamp; //Read after flag, as ISR writes it before setting the flag
+  if (!intFlag) {
+    if (now - m_lastIntTime < INT_TIMEOUT) {
+      return; //Integration still in progress
+    }
+
+    m_lastIntTime = now;
+    bool ready;
+    {
+      PROFILE_ZONE("as7341 I2C");
+      I2CBUS_TRANSFER(i2cbus_device_as7341);
+      ready = m_sensor.getIsDataReady();
+    }
+
+    if (!ready) { //Interrupt may have been missed, check sensor directly
+      return;
+    }
+
+    endTime = timebase_now(); //Integration finished some time in the last INT_TIMEOUT, best we can do
+  }
+
+  m_intFlag = false;
+  m_lastIntTime = now;
+  {
+    PROFILE_ZONE("as7341 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_as7341);
+    m_sensor.clearInterruptStatus(); //Release INT pin so it can signal the next integration
+  }
+
+  if (m_mode == channel_mode_all) {
+    bool complete;
+    {
+      PROFILE_ZONE("as7341 I2C");
+      I2CBUS_TRANSFER(i2cbus_device_as7341);
+      complete = m_sensor.checkReadingProgress();
+    }
+
+    if (!complete) {
+      return; //First SMUX pass complete, library has started second pass
+    }
+  }
+
+  uint16_t readings[NUM_CHANNELS];
+  bool restart = true;
+  bool ok = readChannels(readings);
+  i2cbus_reportResult(i2cbus_device_as7341, ok);
+  if (ok && (m_mode == channel_mode_all)) { //Subset modes are for display only, so aren't traced
+    trace_as7341_t trace;
+    memcpy(trace.readings, readings, sizeof(trace.readings));
+    trace.gainIndex = (uint8_t)m_gainIndex;
+    trace.astep = m_astep;
+    trace_record(trace_source_as7341, &trace, sizeof(trace));
+  }
+
+  if (ok) {
+    bool exposureChanged = handleReadings(readings, getSampleTime(endTime));
+    restart = (m_mode == channel_mode_all) || exposureChanged; //Subset modes run continuously unless settings changed
+  } else {
+    ERROR("Error reading sensor");
+  }
+
+  if (millis() - m_lastFlickerTime >= FLICKER_INTERVAL) {
+    m_flickerPending = true; //Spectral reading is complete, so this is a good time to switch
+    idle_wakeAfter(0);
+  } else if (restart) {
+    startMeasurement();
+  }
 }
 
 void as7341_loop(void) {
-  if (m_ready && m_sensor.checkReadingProgress()) {
-    uint16_t readings[NUM_CHANNELS];
-    if (m_sensor.getAllChannels(readings)) {
-      handleReadings(readings);
-    } else {
-      ERROR("Error reading sensor");
+  PROFILE_ZONE("as7341_loop");
+  if (!m_ready) {
+    return;
+  }
+
+  idle_wakeAfter(1000UL * (m_flickerActive ? FLICKER_POLL_TIME : INT_TIMEOUT)); //Spectral readings wake the loop by interrupt
+
+  if (!i2cbus_acquire(i2cbus_device_as7341)) {
+    return; //Bus would delay next ADAF1080 sample, try again after it
+  }
+
+  service();
+  i2cbus_release(i2cbus_device_as7341);
+}
+
+/*
+ * Trace replay: restarts auto-exposure from the configured integration time
+ */
+void as7341_replayStart(void) {
+  loadConfig();
+  resetChannelShares();
+}
+
+/*
+ * Trace replay: one full spectrum reading, through the same gain correction, colorimetry and auto-exposure as the sensor loop.
+ * Gain index and ASTEP are updated with the settings auto-exposure would apply next. Fills pResults (AS7341_NUM_RESULTS values)
+ */
+void as7341_replayReadings(uint16_t *readings, int *pGainIndex, uint16_t *pAstep, float *pResults) {
+  float basicCounts[NUM_SENSOR_CHARACTERISTICS];
+  int nChannel;
+  for (nChannel = 0; nChannel < NUM_CHANNELS; nChannel++) {
+    int nCharacteristic = CHANNEL_MAP[channel_mode_all][nChannel];
+    if (nCharacteristic >= 0) {
+      basicCounts[nCharacteristic] = toBasicCounts(readings[nChannel], *pGainIndex, *pAstep);
     }
+  }
 
-    m_sensor.startReading();
+  colorimetry_t colour;
+  colorimetry_calculate(basicCounts, &colour);
+  pResults[0] = colour.lux;
+  pResults[1] = colour.cct;
+  autoexposure(readings, pGainIndex, pAstep);
+  pResults[2] = AS7341_GAIN_VALS[*pGainIndex];
+  pResults[3] = (float)*pAstep;
+}
+
+static uint16_t m_benchReadings[NUM_CHANNELS];
+
+static void benchToBasicCounts(uint32_t iteration) {
+  bench_keep(toBasicCounts((uint16_t)iteration, iteration % NUM_GAINS, m_defaultAstep));
+}
+
+static void benchColorimetry(uint32_t iteration) {
+  float basicCounts[NUM_SENSOR_CHARACTERISTICS];
+  int i;
+  for (i = 0; i < NUM_SENSOR_CHARACTERISTICS; i++) {
+    basicCounts[i] = (float)((iteration + i) & 0xFF);
   }
+
+  colorimetry_t colour;
+  colorimetry_calculate(basicCounts, &colour);
+  bench_keep(colour.cct);
+}
+
+static void benchAutoexposure(uint32_t iteration) {
+  m_benchReadings[iteration % NUM_CHANNELS] = (uint16_t)(iteration * 61); //Sweep peak across the range, so some calls change exposure
+  int gainIndex = DEFAULT_GAIN_INDEX;
+  uint16_t astep = m_defaultAstep;
+  autoexposure(m_benchReadings, &gainIndex, &astep);
+  bench_keep((float)gainIndex);
+}
+
+void as7341_bench(void) {
+  loadConfig(); //Integration settings, sensor may not have been initialised
+  bench_run("as7341 toBasicCounts", benchToBasicCounts);
+  bench_run("colorimetry_calculate", benchColorimetry);
+  bench_run("as7341 autoexposure", benchAutoexposure);
 }
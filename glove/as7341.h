@@ -9,12 +9,18 @@
 #ifndef __AS7341_H
 #define __AS7341_H
 
+#include <stdint.h>
 #include <BLEServer.h>
 
 #include "i2c_address.h"
 
+#define AS7341_NUM_RESULTS 4 //Illuminance (lux), CCT (K), next gain, next ASTEP
+
 bool as7341_init(i2c_address_t addr);
 bool as7341_addService(BLEServer *pServer);
 void as7341_loop(void);
+void as7341_replayStart(void);
+void as7341_replayReadings(uint16_t *readings, int *pGainIndex, uint16_t *pAstep, float *pResults);
+void as7341_bench(void);
 
 #endif /* __AS7341_H */
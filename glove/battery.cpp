@@ -12,63 +12,168 @@
 #include <BLEUtils.h>
 
 #include "blewrapper.h"
+#include "activity.h"
+#include "soc.h"
+#include "idle.h"
+#include "retained.h"
+#include "datalog.h"
+#include "config.h"
+#include "trace.h"
+#include "bench.h"
+#include "profile.h"
 #include "err.h"
 
-#define SAMPLE_TIME 1000 //milliseconds
-#define NUM_AVERAGE_SAMPLES 10 //Average battery voltage over 10 seconds to remove fluctuations due to load
+#define NUM_AVERAGE_SAMPLES 10 //Average battery voltage over 10 samples (10 seconds at default sample time) to remove fluctuations due to load
 #define PIN_VBAT A13
 #define VBAT_SCALE (1.0f / 500.0f)
-#define VBAT_FULL 4.10f
+
+/*
+ * Battery voltage is sampled using the ADC in continuous (DMA) mode. Each sample is the hardware average of a burst of conversions,
+ * which removes ADC noise without the CPU having to wait. The ADC is only started once per sample time and stopped again as soon as
+ * the burst has finished, so it doesn't draw power in between. 64 conversions at 20kHz (lowest rate supported) takes about 3ms.
+ */
+#define NUM_ADC_PINS 1
+#define ADC_CONVERSIONS 64
+#define ADC_SAMPLE_FREQ 20000 //Hz
+#define ADC_INIT_TIMEOUT 100 //milliseconds
+#define ADC_TIMEOUT 100 //milliseconds
+
+/*
+ * Load current (e.g. BLE transmit bursts) causes short dips in battery voltage. Reject samples that fall well below the running
+ * average, unless they keep happening, in which case the voltage really has dropped.
+ */
+#define DIP_THRES 50 //millivolts at ADC pin (100mV at battery)
+#define MAX_DIP_REJECTS 5
 #define VBAT_LOW 3.60f
 #define VBAT_CRITICAL 3.30f
-#define VBAT_EMPTY 3.20f
+
+/*
+ * Estimated load current in each power profile (mA), used for SoC load compensation and runtime prediction. Calibrate against
+ * current measured with a bench supply.
+ */
+#define DISCONNECTED_CURRENT 50.0f //All sensors run to feed the data log, but radio only advertises
+static const float CONNECTED_CURRENT[NUM_ACTIVITY_PROFILES] = {
+  75.0f, //activity_profile_moving
+  55.0f  //activity_profile_still
+};
 
 #define BLE_INST_ID 0
-#define NUM_CHARACTERISTICS 3
+#define NUM_CHARACTERISTICS 4
 
 #define BLE_SERVICE_UUID BLEUUID((uint16_t)0x180F)
 #define LEVEL_UUID BLEUUID((uint16_t)0x2A19)
 #define CRITICAL_UUID BLEUUID((uint16_t)0x2BE9)
 #define VOLTAGE_UUID "56b2c2d5-abc6-4801-a39a-02dee738b38c"
+#define RUNTIME_UUID "a8f3e61c-4d27-4b9a-9e05-1c7d3b82f4a6"
 
 #define LEVEL_FORMAT BLE2904::FORMAT_UINT8
 #define CRITICAL_FORMAT BLE2904::FORMAT_BOOLEAN
 #define VOLTAGE_FORMAT BLE2904::FORMAT_UINT16
+#define RUNTIME_FORMAT BLE2904::FORMAT_UINT16
 
 #define LEVEL_EXPONENT 0
 #define CRITICAL_EXPONENT 0
 #define VOLTAGE_EXPONENT -2
+#define RUNTIME_EXPONENT 0
 
 #define LEVEL_UNIT BLEUnit::Percent
 #define CRITICAL_UNIT BLEUnit::Unitless
 #define VOLTAGE_UNIT BLEUnit::Volt
+#define RUNTIME_UNIT BLEUnit::Minute
 
 #define LEVEL_NAME "Battery level"
 #define CRITICAL_NAME "Battery critical"
 #define VOLTAGE_NAME "Battery voltage"
+#define RUNTIME_NAME "Remaining runtime"
 
 static BLECharacteristic m_levelCharacteristic(LEVEL_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_criticalCharacteristic(CRITICAL_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_voltageCharacteristic(VOLTAGE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_runtimeCharacteristic(RUNTIME_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 
 static BLEWrapper m_levelWrapper(&m_levelCharacteristic, LEVEL_NAME, LEVEL_FORMAT, LEVEL_EXPONENT, LEVEL_UNIT);
 static BLEWrapper m_criticalWrapper(&m_criticalCharacteristic, CRITICAL_NAME, CRITICAL_FORMAT, CRITICAL_EXPONENT, CRITICAL_UNIT);
 static BLEWrapper m_voltageWrapper(&m_voltageCharacteristic, VOLTAGE_NAME, VOLTAGE_FORMAT, VOLTAGE_EXPONENT, VOLTAGE_UNIT);
+static BLEWrapper m_runtimeWrapper(&m_runtimeCharacteristic, RUNTIME_NAME, RUNTIME_FORMAT, RUNTIME_EXPONENT, RUNTIME_UNIT);
 
-static float m_avgBuf[NUM_AVERAGE_SAMPLES];
+static const uint8_t ADC_PINS[NUM_ADC_PINS] = { PIN_VBAT };
+
+static uint32_t m_avgBuf[NUM_AVERAGE_SAMPLES]; //millivolts at ADC pin
+static uint32_t m_avgSum = 0; //Running sum of m_avgBuf
 static int m_avgBufPos = 0;
+static int m_numDipRejects = 0;
 static unsigned long m_lastTime;
+static unsigned long m_adcStartTime;
+static volatile bool m_adcDone = false;
+static bool m_adcRunning = false;
+static bool m_continuous = false;
+static bool m_connected = false;
 static bool m_ready = false;
 
-static float readVoltage(void) {
-  return VBAT_SCALE * (float)analogReadMilliVolts(PIN_VBAT);
+static void ARDUINO_ISR_ATTR onAdcDone(void) {
+  m_adcDone = true;
+  idle_wakeFromISR();
 }
 
-bool battery_init(void) {
-  float vbat = readVoltage();
+static bool startAdc(void) {
+  m_adcDone = false;
+  m_adcStartTime = millis();
+  m_adcRunning = analogContinuousStart();
+  return m_adcRunning;
+}
+
+/*
+ * Returns averaged reading in millivolts, or 0 if no reading is available
+ */
+static uint32_t readAdc(uint32_t timeout) {
+  adc_continuous_data_t *pResult = NULL;
+  uint32_t mv = 0;
+  if (analogContinuousRead(&pResult, timeout) && (pResult != NULL)) {
+    mv = pResult[0].avg_read_mvolts;
+  }
+
+  analogContinuousStop();
+  m_adcRunning = false;
+  return mv;
+}
+
+static float getLoadCurrent(void) {
+  if (!m_connected) {
+    return DISCONNECTED_CURRENT;
+  }
+
+  return CONNECTED_CURRENT[activity_getProfile()];
+}
+
+static void initAverage(uint32_t mv) {
+  m_avgSum = 0;
   int i;
   for (i = 0; i < NUM_AVERAGE_SAMPLES; i++) {
-    m_avgBuf[i] = vbat; //Initialise average buffer
+    m_avgBuf[i] = mv; //Initialise average buffer
+    m_avgSum += mv;
+  }
+}
+
+bool battery_init(void) {
+  m_continuous = analogContinuous(ADC_PINS, NUM_ADC_PINS, ADC_CONVERSIONS, ADC_SAMPLE_FREQ, onAdcDone);
+  uint32_t mv = 0;
+  if (m_continuous && startAdc()) {
+    mv = readAdc(ADC_INIT_TIMEOUT);
+  }
+
+  if (mv == 0) {
+    ERROR("Continuous ADC mode not available, using single conversions");
+    m_continuous = false;
+    mv = analogReadMilliVolts(PIN_VBAT);
+  }
+
+  trace_record(trace_source_battery, &mv, sizeof(mv)); //First reading of a trace initialises the average on replay
+  initAverage(mv); //Battery may have been charged or run down while asleep, so average always starts from a fresh reading
+  if (retained_isValid(RETAINED_BATTERY)) {
+    retained_state_t *pRetained = retained_get(); //Waking from sleep, carry on from previous SoC state if it still agrees with the battery
+    soc_restore(pRetained->batterySoc, pRetained->batteryCurrent, VBAT_SCALE * (float)mv);
+  } else {
+    soc_init(VBAT_SCALE * (float)mv, getLoadCurrent());
   }
 
   m_lastTime = millis();
@@ -92,6 +197,7 @@ bool battery_addService(BLEServer *pServer) {
   pService->addCharacteristic(&m_levelCharacteristic);
   pService->addCharacteristic(&m_criticalCharacteristic);
   pService->addCharacteristic(&m_voltageCharacteristic);
+  pService->addCharacteristic(&m_runtimeCharacteristic);
 
   pService->start();
   return true;
@@ -103,27 +209,85 @@ static void printBatteryVoltage(float vbat) {
   Serial.println("V)");
 }
 
-static float getAverage(float next) {
-  m_avgBuf[m_avgBufPos++] = next;
-  if (m_avgBufPos >= NUM_AVERAGE_SAMPLES) {
-    m_avgBufPos = 0;
+static void saveRetained(void) {
+  retained_state_t *pRetained = retained_get();
+  pRetained->batterySoc = soc_getLevel();
+  pRetained->batteryCurrent = soc_getAverageCurrent();
+  retained_commit(RETAINED_BATTERY);
+}
+
+static float getAverage(uint32_t next) {
+  uint32_t avg = m_avgSum / NUM_AVERAGE_SAMPLES;
+  if ((next + DIP_THRES < avg) && (m_numDipRejects < MAX_DIP_REJECTS)) {
+    m_numDipRejects++; //Probably a load transient, ignore
+  } else {
+    m_numDipRejects = 0;
+    m_avgSum += next - m_avgBuf[m_avgBufPos]; //Running sum, no need to add up whole buffer each time
+    m_avgBuf[m_avgBufPos++] = next;
+    if (m_avgBufPos >= NUM_AVERAGE_SAMPLES) {
+      m_avgBufPos = 0;
+    }
   }
 
-  float sum = 0.0f;
-  int i;
-  for (i = 0; i < NUM_AVERAGE_SAMPLES; i++) {
-    sum += m_avgBuf[i];
+  return VBAT_SCALE * (float)m_avgSum / (float)NUM_AVERAGE_SAMPLES;
+}
+
+/*
+ * Returns latest reading in millivolts, or 0 if no new reading is ready yet
+ */
+static uint32_t pollAdc(unsigned long now) {
+  if (!m_continuous) {
+    return analogReadMilliVolts(PIN_VBAT);
+  }
+
+  if (!m_adcRunning) {
+    if (!startAdc()) {
+      ERROR("Cannot start ADC");
+      m_lastTime = now; //Try again next time
+    }
+
+    return 0;
   }
 
-  return sum / (float)NUM_AVERAGE_SAMPLES;
+  if (m_adcDone) {
+    return readAdc(0);
+  }
+
+  if (now - m_adcStartTime >= ADC_TIMEOUT) {
+    ERROR("ADC timed out");
+    analogContinuousStop();
+    m_adcRunning = false;
+    m_lastTime = now;
+  }
+
+  return 0;
+}
+
+void battery_setConnected(bool connected) {
+  m_connected = connected;
 }
 
 void battery_loop(void) {
+  PROFILE_ZONE("battery_loop");
+  unsigned long sampleTime = config_getUint(config_param_batterySampleTime);
   unsigned long now = millis();
-  if (m_ready && (now - m_lastTime >= SAMPLE_TIME)) {
-    m_lastTime = now;
+  if (m_adcRunning || (now - m_lastTime >= sampleTime)) {
+    idle_wakeAfter(1000UL * ADC_TIMEOUT); //ADC interrupt wakes the loop when conversion is done
+  } else {
+    idle_wakeAfter(1000UL * (sampleTime - (now - m_lastTime)));
+  }
 
-    float vbat = getAverage(readVoltage());
+  if (m_ready && (now - m_lastTime >= sampleTime)) {
+    uint32_t mv = pollAdc(now);
+    if (mv == 0) {
+      return; //Conversion still in progress. Only pick up finished averages, never wait for the ADC
+    }
+
+    trace_record(trace_source_battery, &mv, sizeof(mv));
+
+    float dt = 0.001f * (float)(now - m_lastTime);
+    m_lastTime = now;
+    float vbat = getAverage(mv);
     bool low = (vbat < VBAT_LOW);
     bool critical = (vbat < VBAT_CRITICAL);
     if (critical) {
@@ -134,19 +298,37 @@ void battery_loop(void) {
       printBatteryVoltage(vbat);
     }
 
-    /*
-     * Rough estimate of battery level as a percentage.
-     * Better method would take discharge curve into account.
-     */
-    float level = 100.0f * (vbat - VBAT_EMPTY) / (VBAT_FULL - VBAT_EMPTY);
-    if (level < 0.0f) {
-      level = 0.0f;
-    } else if (level > 100.0f) {
-      level = 100.0f;
-    }
-    
-    m_levelWrapper.writeValue(level);
+    soc_update(vbat, getLoadCurrent(), dt);
+    saveRetained();
+    m_levelWrapper.writeValue(soc_getLevel());
     m_criticalWrapper.writeValue(critical);
     m_voltageWrapper.writeValue(vbat);
+    m_runtimeWrapper.writeValue(soc_getRuntime());
+    datalog_write(datalog_type_battery, vbat, soc_getLevel(), soc_getRuntime());
   }
 }
+
+/*
+ * Trace replay: restarts the average from a first reading, as battery_init() does
+ */
+void battery_replayStart(uint32_t mv) {
+  m_avgBufPos = 0;
+  m_numDipRejects = 0;
+  initAverage(mv);
+}
+
+/*
+ * Trace replay: returns the averaged battery voltage after one more reading
+ */
+float battery_replaySample(uint32_t mv) {
+  return getAverage(mv);
+}
+
+static void benchAverage(uint32_t iteration) {
+  bench_keep(getAverage(1850 + (iteration & 0x1F))); //About 3.7V battery, in steps too small to look like load dips
+}
+
+void battery_bench(void) {
+  battery_replayStart(1850);
+  bench_run("battery getAverage", benchAverage);
+}
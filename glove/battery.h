@@ -9,10 +9,15 @@
 #ifndef __BATTERY_H
 #define __BATTERY_H
 
+#include <stdint.h>
 #include <BLEServer.h>
 
 bool battery_init(void);
 bool battery_addService(BLEServer *pServer);
 void battery_loop(void);
+void battery_setConnected(bool connected);
+void battery_replayStart(uint32_t mv);
+float battery_replaySample(uint32_t mv);
+void battery_bench(void);
 
 #endif /* __BATTERY_H */
@@ -0,0 +1,170 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module times the per-call cost of the firmware's hot paths, so that a change which slows them down is caught before it reaches
+ * a glove. It is only active in benchmark builds (BENCH_ENABLE).
+ *
+ * Each module registers its own cases by calling bench_run() from its xxx_bench() function, as the code under test is mostly static
+ * to the module. Cases take an iteration number, which they use to vary their inputs, and pass their result to bench_keep() so the
+ * compiler can't drop the work. Sensor I/O is never touched: cases start from raw values, as the sensor would have returned them.
+ *
+ * Every call is timed with the CPU cycle counter. The median is reported, as the BLE stack can interrupt any single call; the cost of
+ * an empty case is measured first and subtracted. Results are printed to Serial as one JSON object per line:
+ *
+ *    {"bench":"name","iterations":1000,"min":120,"median":124,"max":310,"cycles":"net","ns":517}
+ *
+ * The same cases also run on a PC (host/bench_main.cpp), where the stubbed cycle counter counts nanoseconds from std::chrono. Host
+ * numbers only show relative changes quickly, without flashing a glove; the ESP32 figures are the ones that matter.
+ */
+
+#define ERR_MODULE_NAME "Bench"
+
+#include <stdlib.h>
+#include <Arduino.h>
+#include <esp_cpu.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+
+#include "blewrapper.h"
+#include "bench.h"
+#include "adaf1080.h"
+#include "as7341.h"
+#include "lsm9ds1.h"
+#include "battery.h"
+#include "bme688.h"
+#include "err.h"
+
+#define NUM_ITERATIONS 1000
+#define NUM_WARMUP 16 //Calls before timing starts, so caches are warm
+#define NS_PER_US 1000
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS 1
+
+#define BLE_SERVICE_UUID BLEUUID("e7b3c9a1-4d2f-4a86-b5e1-9c3f7d2a8b64")
+#define VALUE_UUID BLEUUID("a2f8d4c6-1e9b-4c73-8d5a-6b1e3f9c7a25")
+#define VALUE_FORMAT BLE2904::FORMAT_SINT16
+#define VALUE_EXPONENT -2
+#define VALUE_UNIT BLEUnit::Unitless
+#define VALUE_NAME "Benchmark"
+
+static BLECharacteristic m_valueCharacteristic(VALUE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_valueWrapper(&m_valueCharacteristic, VALUE_NAME, VALUE_FORMAT, VALUE_EXPONENT, VALUE_UNIT);
+
+static uint32_t m_cycles[NUM_ITERATIONS];
+static uint32_t m_overhead = 0;
+static volatile float m_sink;
+
+void bench_keep(float value) {
+  m_sink = value;
+}
+
+static int compareCycles(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Returns median cycles per call, before overhead is subtracted
+ */
+static uint32_t measure(bench_func_t func) {
+  uint32_t i;
+  for (i = 0; i < NUM_WARMUP; i++) {
+    func(i);
+  }
+
+  for (i = 0; i < NUM_ITERATIONS; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    func(i);
+    m_cycles[i] = esp_cpu_get_cycle_count() - start;
+  }
+
+  qsort(m_cycles, NUM_ITERATIONS, sizeof(uint32_t), compareCycles);
+  return m_cycles[NUM_ITERATIONS / 2];
+}
+
+static uint32_t net(uint32_t cycles) {
+  return (cycles > m_overhead) ? (cycles - m_overhead) : 0;
+}
+
+void bench_run(const char *name, bench_func_t func) {
+  uint32_t median = net(measure(func));
+  Serial.print("{\"bench\":\"");
+  Serial.print(name);
+  Serial.print("\",\"iterations\":");
+  Serial.print(NUM_ITERATIONS);
+  Serial.print(",\"min\":");
+  Serial.print(net(m_cycles[0]));
+  Serial.print(",\"median\":");
+  Serial.print(median);
+  Serial.print(",\"max\":");
+  Serial.print(net(m_cycles[NUM_ITERATIONS - 1]));
+  Serial.print(",\"cycles\":\"net\",\"ns\":");
+  Serial.print(median * NS_PER_US / getCpuFrequencyMhz());
+  Serial.println("}");
+}
+
+static void benchEmpty(uint32_t iteration) {
+  bench_keep(0.0f);
+}
+
+static void benchWriteUnchanged(uint32_t iteration) {
+  m_valueWrapper.writeValue(1.0f); //Usual case: value is set, but no notification as it hasn't changed
+}
+
+static void benchWriteChanged(uint32_t iteration) {
+  m_valueWrapper.writeValue((float)(iteration & 0xFF) * 0.01f); //No client, so notification goes no further than the stack
+}
+
+static bool addService(BLEServer *pServer) {
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    ERROR("Cannot add BLE service");
+    return false;
+  }
+
+  pService->addCharacteristic(&m_valueCharacteristic);
+  pService->start();
+  return true;
+}
+
+/*
+ * Runs every case once. Host builds call this directly, as they are always benchmark builds
+ */
+void bench_runAll(BLEServer *pServer) {
+  Serial.print("{\"cpuMhz\":");
+  Serial.print(getCpuFrequencyMhz());
+  Serial.println("}");
+
+  m_overhead = 0;
+  m_overhead = measure(benchEmpty); //Cycle counter reads, call and bench_keep()
+  if (addService(pServer)) { //Characteristic must belong to a service before it can notify
+    bench_run("BLEWrapper::writeValue unchanged", benchWriteUnchanged);
+    bench_run("BLEWrapper::writeValue changed", benchWriteChanged);
+  }
+
+  adaf1080_bench();
+  as7341_bench();
+  lsm9ds1_bench();
+  battery_bench();
+  bme688_bench();
+
+  Serial.println("{\"done\":true}");
+}
+
+void bench_init(BLEServer *pServer) {
+  if (!BENCH_ENABLE) {
+    return;
+  }
+
+  bench_runAll(pServer);
+  while (true) {
+    delay(1000); //Benchmarks have left module state meaningless, so don't carry on
+  }
+}
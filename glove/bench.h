@@ -0,0 +1,29 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+#include <BLEServer.h>
+
+/*
+ * Build option, add -DBENCH_ENABLE=1 to build flags. Benchmark builds run the benchmarks at boot, then halt
+ */
+#ifndef BENCH_ENABLE
+#define BENCH_ENABLE 0
+#endif
+
+typedef void (*bench_func_t)(uint32_t iteration);
+
+void bench_init(BLEServer *pServer);
+void bench_runAll(BLEServer *pServer);
+void bench_run(const char *name, bench_func_t func);
+void bench_keep(float value);
+
+#endif /* __BENCH_H */
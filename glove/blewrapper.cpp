@@ -6,19 +6,39 @@
  * Author: Tom Coates <tom@soothsys.com>
  */
 
+#include <Arduino.h>
 #include <BLECharacteristic.h>
 #include <BLE2904.h>
 
 #include "blewrapper.h"
+#include "energy.h"
+#include "profile.h"
+
+#define UINT24_MAX 0xFFFFFFUL
 
 static const int NUM_SERVICE_HANDLES = 3; //Each service requires 3 handles
 static const int NUM_CHARACTERISTIC_HANDLES = 2; //Each characteristic requires 2 handles
 static const int NUM_DESCRIPTOR_HANDLES = 3; //Each characteristic has 3 descriptors, each of which requires 1 handle
 
+static unsigned long m_firstNotifyTime = 0; //millis() at first notification since boot, 0 if none yet
+static bool m_connected = false;
+
 int BLEWrapper::calcNumHandles(int numCharacteristics) {
   return NUM_SERVICE_HANDLES + numCharacteristics * (NUM_CHARACTERISTIC_HANDLES + NUM_DESCRIPTOR_HANDLES);
 }
 
+unsigned long BLEWrapper::getFirstNotifyTime(void) {
+  return m_firstNotifyTime;
+}
+
+/*
+ * Called from the server callbacks. CCCD values are kept after a client disconnects, so they don't show on their own whether
+ * anyone is listening
+ */
+void BLEWrapper::setConnected(bool connected) {
+  m_connected = connected;
+}
+
 BLEWrapper::BLEWrapper(BLECharacteristic *pCharacteristic, char *description, uint8_t format, int8_t exponent, BLEUnit unit) {
   m_pCharacteristic = pCharacteristic;
   m_format = format;
@@ -40,7 +60,33 @@ BLECharacteristic * BLEWrapper::getCharacteristic(void) {
   return m_pCharacteristic;
 }
 
-void BLEWrapper::writeValue(float unscaled) {
+/*
+ * Returns true if a client is connected and has enabled notifications
+ */
+bool BLEWrapper::isSubscribed(void) {
+  return m_connected && m_cccDescriptor.getNotifications();
+}
+
+/*
+ * Notifies the characteristic's current value. Energy is only charged if a client is subscribed, otherwise nothing is sent
+ */
+void BLEWrapper::notify(void) {
+  {
+    PROFILE_ZONE("BLE notify");
+    m_pCharacteristic->notify();
+  }
+
+  if (!isSubscribed()) {
+    return;
+  }
+
+  energy_addOp(energy_subsystem_ble, energy_op_notify, 1);
+  if (m_firstNotifyTime == 0) {
+    m_firstNotifyTime = millis();
+  }
+}
+
+void BLEWrapper::encodeValue(float unscaled) {
 	float scaleFactor = pow(10.0f, -m_exponent);
 	float scaled = round(unscaled * scaleFactor);
 	
@@ -63,6 +109,11 @@ void BLEWrapper::writeValue(float unscaled) {
 			uval = static_cast<uint32_t>(scaled);
 			rawPtr = static_cast<void *>(&uval);
 			break;
+
+    case BLE2904::FORMAT_UINT24:
+      uval = (scaled < (float)UINT24_MAX) ? static_cast<uint32_t>(scaled) : UINT24_MAX - 1; //All ones means "unknown"
+      rawPtr = static_cast<void *>(&uval);
+      break;
 		
 		case BLE2904::FORMAT_SINT8:
 		case BLE2904::FORMAT_SINT16:
@@ -85,6 +136,10 @@ void BLEWrapper::writeValue(float unscaled) {
 		case BLE2904::FORMAT_SINT16:
 			length = 2;
 			break;
+
+    case BLE2904::FORMAT_UINT24:
+      length = 3; //ESP32 is little endian, same as BLE, so the low 3 bytes
+      break;
 		
 		case BLE2904::FORMAT_UINT32:
 		case BLE2904::FORMAT_SINT32:
@@ -96,9 +151,20 @@ void BLEWrapper::writeValue(float unscaled) {
 	
 	uint8_t *bytes = static_cast<uint8_t *>(rawPtr);
 	m_pCharacteristic->setValue(bytes, length);
+}
 
+/*
+ * Updates the value for clients to read, without notifying
+ */
+void BLEWrapper::setValue(float unscaled) {
+  encodeValue(unscaled);
+  m_written = false; //Client hasn't been told, so notify on next writeValue()
+}
+
+void BLEWrapper::writeValue(float unscaled) {
+  encodeValue(unscaled);
   if (!m_written || (m_lastVal.f != unscaled)) {
-    m_pCharacteristic->notify();
+    notify();
   }
 
   m_written = true;
@@ -111,7 +177,7 @@ void BLEWrapper::writeValue(bool b) {
   m_pCharacteristic->setValue(bytes, 1);
 
   if (!m_written || (m_lastVal.b != b)) {
-    m_pCharacteristic->notify();
+    notify();
   }
 
   m_written = true;
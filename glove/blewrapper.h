@@ -21,13 +21,18 @@
  */
 enum class BLEUnit {
 	Unitless	             = 0x2700,
+  Kelvin                 = 0x2705,
   MetresPerSecondSquared = 0x2713,
   Radian                 = 0x2720,
+  Hertz                  = 0x2722,
 	Pascal		             = 0x2724,
+  Joule                  = 0x2725,
   Volt                   = 0x2728,
   uTesla                 = 0x272D,
 	DegC	  	             = 0x272F,
+  Lux                    = 0x2731,
   RadsPerSecond          = 0x2743,
+  Minute                 = 0x2760,
 	Percent		             = 0x27AD,
 	PPM			               = 0x27C4,
   PPB                    = 0x27C5
@@ -48,14 +53,21 @@ class BLEWrapper {
       float f;
       bool b;
     } m_lastVal;
+
+    void encodeValue(float unscaled);
 		
   public:
     BLEWrapper(BLECharacteristic *pCharacteristic, char *description, uint8_t format, int8_t exponent, BLEUnit unit);
     BLECharacteristic * getCharacteristic(void);
 		void writeValue(float unscaled);
     void writeValue(bool b);
+    void setValue(float unscaled);
+    void notify(void);
+    bool isSubscribed(void);
 
     static int calcNumHandles(int numCharacteristics);
+    static unsigned long getFirstNotifyTime(void);
+    static void setConnected(bool connected);
 };
 
 #endif /* __BLEWRAPPER_H */
@@ -12,16 +12,60 @@
 #include <bsec2.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
+#include <Preferences.h>
+#include <esp_sleep.h>
+#include <rom/crc.h>
 
 #include "blewrapper.h"
 #include "i2c_address.h"
+#include "powermgmt.h"
+#include "idle.h"
+#include "i2cbus.h"
+#include "datalog.h"
+#include "timebase.h"
+#include "config.h"
+#include "trace.h"
+#include "bench.h"
+#include "profile.h"
 #include "err.h"
 
-#define SAMPLE_RATE BSEC_SAMPLE_RATE_CONT
+/*
+ * Sensor runs all the time so BSEC baseline tracking is never interrupted. By default use continuous mode while a client is connected,
+ * and low power mode (3 second interval) otherwise. Rate for each case is a runtime parameter, indexing BSEC_RATE. Latest outputs
+ * remain in the characteristic values, so a newly connected client can read valid values straight away.
+ */
+#define NUM_BSEC_RATES 2
+static const float BSEC_RATE[NUM_BSEC_RATES] = { BSEC_SAMPLE_RATE_LP, BSEC_SAMPLE_RATE_CONT };
 #define TEMP_OFFSET TEMP_OFFSET_LP
 
+/*
+ * Gas scanning mode runs the sensor in parallel mode, stepping the heater through a profile of up to 10 temperatures. The heater
+ * profile and trained classifier both come from a BSEC config blob, exported from BME AI-Studio or taken from the library examples.
+ * IAQ outputs are not available while scanning, so the IAQ config is reloaded (and IAQ state restored) when scanning is turned off.
+ */
+#define SCAN_SAMPLE_RATE BSEC_SAMPLE_RATE_SCAN
+#define POLL_TIME 10 //milliseconds. BSEC schedules its own measurements, so poll often enough to keep its timing within tolerance
+#define SCAN_CONFIG_FILE "config/bme688/bme688_sel_33v_3s_4d/bsec_selectivity.txt"
+#define IAQ_CONFIG_FILE "config/bme688/bme688_iaq_33v_3s_4d/bsec_iaq.txt"
+#define MAX_HEATER_STEPS 10
+#define GAS_FRAME_HEADER_LEN 4 //Scan counter (uint8), number of steps (uint8), valid step mask (uint16)
+#define GAS_FRAME_LEN (GAS_FRAME_HEADER_LEN + MAX_HEATER_STEPS * sizeof(uint32_t)) //Followed by resistance of each step in ohms (uint32)
+#define NUM_GAS_ESTIMATES 4
+
+/*
+ * BSEC state (calibration and baseline tracking) is saved so that IAQ is valid soon after boot, instead of starting run-in from scratch.
+ *
+ *    - Deep sleep: state is copied to RTC memory, which survives deep sleep but not power loss. No flash wear
+ *    - Periodically and on sleep: state is written to NVS, which survives power loss. NVS is wear-levelled internally, and
+ *      we only write when IAQ is fully calibrated and the state has actually changed
+ */
+#define STATE_SAVE_PERIOD (6UL * 60UL * 60UL * 1000UL) //6 hours in ms, as recommended by Bosch
+#define STATE_MIN_ACCURACY 3 //Only save once IAQ is fully calibrated
+#define NVS_NAMESPACE "bme688"
+#define NVS_STATE_KEY "bsecState"
+
 #define BLE_INST_ID 0
-#define NUM_CHARACTERISTICS 9
+#define NUM_CHARACTERISTICS (9 + NUM_GAS_ESTIMATES + 3) //Add 3 for gas scanning mode, raw gas frame and environment frame characteristics
 
 #define BLE_SERVICE_UUID BLEUUID((uint16_t)0x181A)
 #define TEMP_UUID BLEUUID((uint16_t)0x2A6E)
@@ -33,6 +77,13 @@
 #define BVOC_UUID BLEUUID((uint16_t)0x2BE7)
 #define STAB_UUID "313fe0fb-3844-4ecb-a356-714248c9861f"
 #define RUNIN_UUID "8e9a5a91-be3f-445a-af3c-c6db247cb975"
+#define SCAN_UUID "5b0e3a6f-8f0a-4c1e-9d3e-2f6a41c7b8d2"
+#define GAS_FRAME_UUID "c4a1d7e2-6b93-4f58-a0e4-7d12c9f3b561"
+#define GAS_EST_1_UUID "2e7f4b18-93c5-4d6a-b1f0-8a5c3e9d2f74"
+#define GAS_EST_2_UUID "9a3c6e51-0d2b-47f8-8e6a-c5b14f7d93e0"
+#define GAS_EST_3_UUID "f15d8a2c-7e46-4b93-9c0f-3b8e6a1d5c27"
+#define GAS_EST_4_UUID "6c2b9f07-a4e1-4d85-b37a-e0f5c8d2916b"
+#define ENV_FRAME_UUID "d9a4c7e2-5f18-4b3d-8c6e-2b7f1a9d4e63"
 
 #define TEMP_FORMAT BLE2904::FORMAT_SINT16
 #define HUM_FORMAT BLE2904::FORMAT_UINT16
@@ -43,6 +94,10 @@
 #define BVOC_FORMAT BLE2904::FORMAT_UINT16
 #define STAB_FORMAT BLE2904::FORMAT_BOOLEAN
 #define RUNIN_FORMAT BLE2904::FORMAT_BOOLEAN
+#define SCAN_FORMAT BLE2904::FORMAT_BOOLEAN
+#define GAS_FRAME_FORMAT BLE2904::FORMAT_OPAQUE
+#define GAS_EST_FORMAT BLE2904::FORMAT_UINT8
+#define ENV_FRAME_FORMAT BLE2904::FORMAT_OPAQUE
 
 #define TEMP_EXPONENT -2
 #define HUM_EXPONENT -2
@@ -53,6 +108,10 @@
 #define BVOC_EXPONENT 0
 #define STAB_EXPONENT 0
 #define RUNIN_EXPONENT 0
+#define SCAN_EXPONENT 0
+#define GAS_FRAME_EXPONENT 0
+#define GAS_EST_EXPONENT 0
+#define ENV_FRAME_EXPONENT 0
 
 #define TEMP_UNIT BLEUnit::DegC
 #define HUM_UNIT BLEUnit::Percent
@@ -63,6 +122,10 @@
 #define BVOC_UNIT BLEUnit::PPM
 #define STAB_UNIT BLEUnit::Unitless
 #define RUNIN_UNIT BLEUnit::Unitless
+#define SCAN_UNIT BLEUnit::Unitless
+#define GAS_FRAME_UNIT BLEUnit::Unitless
+#define GAS_EST_UNIT BLEUnit::Percent
+#define ENV_FRAME_UNIT BLEUnit::Unitless
 
 #define TEMP_NAME "Temperature"
 #define HUM_NAME "Humidity"
@@ -73,6 +136,15 @@
 #define BVOC_NAME "Breath VOC concentration"
 #define STAB_NAME "Stabilised"
 #define RUNIN_NAME "Run in"
+#define SCAN_NAME "Gas scanning mode"
+#define GAS_FRAME_NAME "Gas scan resistances"
+#define GAS_EST_1_NAME "Gas class 1 probability"
+#define GAS_EST_2_NAME "Gas class 2 probability"
+#define GAS_EST_3_NAME "Gas class 3 probability"
+#define GAS_EST_4_NAME "Gas class 4 probability"
+#define ENV_FRAME_NAME "Environment frame"
+
+#define ENV_FRAME_NUM_VALUES 3 //Temperature (C), humidity (%), pressure (Pa)
 
 #define TEMP_SCALE 1.0f
 #define HUM_SCALE 1.0f
@@ -81,6 +153,7 @@
 #define SIAQ_SCALE 1.0f
 #define CO2_SCALE 1.0f
 #define BVOC_SCALE 1.0f
+#define GAS_EST_SCALE 100.0f //BSEC reports class probability as 0-1
 
 static BLECharacteristic m_tempCharacteristic(TEMP_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_humCharacteristic(HUM_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
@@ -102,13 +175,140 @@ static BLEWrapper m_bvocWrapper(&m_bvocCharacteristic, BVOC_NAME, BVOC_FORMAT, B
 static BLEWrapper m_stabWrapper(&m_stabCharacteristic, STAB_NAME, STAB_FORMAT, STAB_EXPONENT, STAB_UNIT);
 static BLEWrapper m_runinWrapper(&m_runinCharacteristic, RUNIN_NAME, RUNIN_FORMAT, RUNIN_EXPONENT, RUNIN_UNIT);
 
+static BLECharacteristic m_scanCharacteristic(SCAN_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_gasFrameCharacteristic(GAS_FRAME_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_envFrameCharacteristic(ENV_FRAME_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_gasEstCharacteristics[NUM_GAS_ESTIMATES] = {
+  BLECharacteristic(GAS_EST_1_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(GAS_EST_2_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(GAS_EST_3_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(GAS_EST_4_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY)
+};
+
+static BLEWrapper m_scanWrapper(&m_scanCharacteristic, SCAN_NAME, SCAN_FORMAT, SCAN_EXPONENT, SCAN_UNIT);
+static BLEWrapper m_gasFrameWrapper(&m_gasFrameCharacteristic, GAS_FRAME_NAME, GAS_FRAME_FORMAT, GAS_FRAME_EXPONENT, GAS_FRAME_UNIT);
+static BLEWrapper m_envFrameWrapper(&m_envFrameCharacteristic, ENV_FRAME_NAME, ENV_FRAME_FORMAT, ENV_FRAME_EXPONENT, ENV_FRAME_UNIT);
+static BLEWrapper m_gasEstWrappers[NUM_GAS_ESTIMATES] = {
+  BLEWrapper(&(m_gasEstCharacteristics[0]), GAS_EST_1_NAME, GAS_EST_FORMAT, GAS_EST_EXPONENT, GAS_EST_UNIT),
+  BLEWrapper(&(m_gasEstCharacteristics[1]), GAS_EST_2_NAME, GAS_EST_FORMAT, GAS_EST_EXPONENT, GAS_EST_UNIT),
+  BLEWrapper(&(m_gasEstCharacteristics[2]), GAS_EST_3_NAME, GAS_EST_FORMAT, GAS_EST_EXPONENT, GAS_EST_UNIT),
+  BLEWrapper(&(m_gasEstCharacteristics[3]), GAS_EST_4_NAME, GAS_EST_FORMAT, GAS_EST_EXPONENT, GAS_EST_UNIT)
+};
+
+static const uint8_t SCAN_CONFIG[] = {
+  #include SCAN_CONFIG_FILE
+};
+
+static const uint8_t IAQ_CONFIG[] = {
+  #include IAQ_CONFIG_FILE
+};
+
+static bsecSensor m_sensorList[] = {
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,
+  BSEC_OUTPUT_RAW_PRESSURE,  //No compensated pressure option exists
+  BSEC_OUTPUT_IAQ,           //Raw IAQ measurement
+  BSEC_OUTPUT_STATIC_IAQ,    //"Delta" IAQ measurement relative to running average, intended to show changes in air quality against "normal" value for location
+  BSEC_OUTPUT_CO2_EQUIVALENT,
+  BSEC_OUTPUT_BREATH_VOC_EQUIVALENT,
+  BSEC_OUTPUT_STABILIZATION_STATUS,  //0 = stabilisation in progress, 1 = stabilisation finished
+  BSEC_OUTPUT_RUN_IN_STATUS          //0 = run-in in progress, 1 = run-in finished
+};
+
+static bsecSensor m_scanSensorList[] = {
+  BSEC_OUTPUT_RAW_TEMPERATURE,  //Heat compensated outputs are not available in scanning mode
+  BSEC_OUTPUT_RAW_HUMIDITY,
+  BSEC_OUTPUT_RAW_PRESSURE,
+  BSEC_OUTPUT_RAW_GAS,
+  BSEC_OUTPUT_RAW_GAS_INDEX,
+  BSEC_OUTPUT_GAS_ESTIMATE_1,
+  BSEC_OUTPUT_GAS_ESTIMATE_2,
+  BSEC_OUTPUT_GAS_ESTIMATE_3,
+  BSEC_OUTPUT_GAS_ESTIMATE_4
+};
+
 static Bsec2 m_envSensor;
-static bool m_stabilised = false;
-static bool m_runIn = false;
+static bool m_lowPower = false;
+static bool m_scanMode = false;
+static volatile bool m_requestedScanMode = false;
+static bool m_iaqStateValid = false;
 static bool m_ready = false;
+static bool m_sleepCallbackAdded = false;
+static uint32_t m_configGeneration;
+
+static uint8_t m_iaqAccuracy = 0;
+static bool m_stateSaved = false;
+static bool m_saveAttempted = false;
+static unsigned long m_lastSaveTime;
+static uint8_t m_stateBuf[BSEC_MAX_STATE_BLOB_SIZE];
+static uint8_t m_savedState[BSEC_MAX_STATE_BLOB_SIZE];
+
+RTC_DATA_ATTR static uint8_t m_rtcState[BSEC_MAX_STATE_BLOB_SIZE];
+RTC_DATA_ATTR static uint32_t m_rtcStateCrc = 0;
+
+static uint8_t m_gasFrame[GAS_FRAME_LEN];
+static uint32_t m_gasResistance[MAX_HEATER_STEPS];
+static uint16_t m_gasValidMask = 0;
+static int m_lastGasIndex = -1;
+static uint8_t m_scanCount = 0;
+static uint8_t m_i2cAddress;
+
+class ScanCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    if (pCharacteristic == NULL) {
+      return;
+    }
+
+    size_t dataLen = pCharacteristic->getLength();
+    if (dataLen < 1) {
+      return;
+    }
+
+    uint8_t *pData = pCharacteristic->getData();
+    m_requestedScanMode = (pData[0] != 0); //Callback runs in different thread. Main thread reconfigures sensor
+  }
+};
 
 static void newDataCallback(const bme68xData data, const bsecOutputs outputs, Bsec2 bsec);  //Hack gets around a type definition error in the library
 
+/*
+ * Sensor bus access for BSEC, in place of the library's Wire interface, so each transaction is bracketed for the bus arbiter
+ */
+static int8_t busRead(uint8_t reg, uint8_t *pData, uint32_t len, void *pIntf) {
+  PROFILE_ZONE("bme688 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_bme688);
+  uint8_t addr = *(uint8_t *)pIntf;
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  if (Wire.endTransmission(false) != 0) { //Repeated start
+    return BME68X_E_COM_FAIL;
+  }
+
+  if (Wire.requestFrom(addr, (size_t)len) != len) {
+    return BME68X_E_COM_FAIL;
+  }
+
+  uint32_t i;
+  for (i = 0; i < len; i++) {
+    pData[i] = (uint8_t)Wire.read();
+  }
+
+  return BME68X_INTF_RET_SUCCESS;
+}
+
+static int8_t busWrite(uint8_t reg, const uint8_t *pData, uint32_t len, void *pIntf) {
+  PROFILE_ZONE("bme688 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_bme688);
+  Wire.beginTransmission(*(uint8_t *)pIntf);
+  Wire.write(reg);
+  Wire.write(pData, len); //Library interleaves register addresses for multi-register writes
+  return (Wire.endTransmission() == 0) ? BME68X_INTF_RET_SUCCESS : BME68X_E_COM_FAIL;
+}
+
+static void busDelay(uint32_t period, void *pIntf) {
+  delayMicroseconds(period);
+}
+
 static bool handleError(const char *message) {
   int libStatus = m_envSensor.status;
   int sensorStatus = m_envSensor.sensor.status;
@@ -129,111 +329,299 @@ static bool handleError(const char *message) {
   return !isError;
 }
 
-static void newDataCallback(const bme68xData data, const bsecOutputs outputs, Bsec2 bsec) {
+static void publishGasFrame(void) {
+  int numSteps = m_lastGasIndex + 1;
+  m_gasFrame[0] = m_scanCount++;
+  m_gasFrame[1] = (uint8_t)numSteps;
+  memcpy(&(m_gasFrame[2]), &m_gasValidMask, sizeof(m_gasValidMask)); //ESP32 is little endian, same as BLE
+  memcpy(&(m_gasFrame[GAS_FRAME_HEADER_LEN]), m_gasResistance, numSteps * sizeof(uint32_t));
+
+  m_gasFrameCharacteristic.setValue(m_gasFrame, GAS_FRAME_HEADER_LEN + numSteps * sizeof(uint32_t));
+  m_gasFrameWrapper.notify();
+}
+
+static void handleGasStep(const bme68xData *pData) {
+  int index = pData->gas_index;
+  if ((index < 0) || (index >= MAX_HEATER_STEPS)) {
+    return;
+  }
+
+  /*
+   * Profile length is set by the config blob, so detect the end of each scan by the step index wrapping round
+   */
+  if ((index <= m_lastGasIndex) && (m_gasValidMask != 0)) {
+    publishGasFrame();
+    m_gasValidMask = 0;
+  }
+
+  bool valid = ((pData->status & BME68X_GASM_VALID_MSK) != 0) && ((pData->status & BME68X_HEAT_STAB_MSK) != 0);
+  m_gasResistance[index] = valid ? (uint32_t)pData->gas_resistance : 0;
+  if (valid) {
+    m_gasValidMask |= (1 << index);
+  }
+
+  m_lastGasIndex = index;
+}
+
+/*
+ * Output dispatch table, indexed by BSEC sensor ID. Built at compile time so that each output is a single lookup rather than a switch.
+ * Outputs with no characteristic (e.g. raw gas index, handled separately) have a NULL wrapper. Outputs that are recorded to the data log
+ * while disconnected have a log slot.
+ */
+#define DISPATCH_TABLE_SIZE 32 //Larger than highest BSEC output ID
+
+#define LOG_SLOT_NONE 0
+#define LOG_SLOT_TEMP 1
+#define LOG_SLOT_HUM 2
+#define LOG_SLOT_PRES 3
+#define LOG_SLOT_IAQ 4
+#define LOG_SLOT_CO2 5
+#define LOG_SLOT_BVOC 6
+#define NUM_LOG_SLOTS 7
+#define LOG_ENV_MASK ((1 << LOG_SLOT_TEMP) | (1 << LOG_SLOT_HUM) | (1 << LOG_SLOT_PRES))
+#define LOG_AIR_MASK ((1 << LOG_SLOT_IAQ) | (1 << LOG_SLOT_CO2) | (1 << LOG_SLOT_BVOC))
+
+typedef struct {
+  BLEWrapper *pWrapper;
+  float scale;
+  uint8_t logSlot;
+} output_dispatch_t;
+
+typedef struct {
+  output_dispatch_t entries[DISPATCH_TABLE_SIZE];
+} dispatch_table_t;
+
+static constexpr dispatch_table_t buildDispatchTable(void) {
+  dispatch_table_t table = {};
+  table.entries[BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE] = { &m_tempWrapper, TEMP_SCALE, LOG_SLOT_TEMP };
+  table.entries[BSEC_OUTPUT_RAW_TEMPERATURE] = { &m_tempWrapper, TEMP_SCALE, LOG_SLOT_TEMP };
+  table.entries[BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY] = { &m_humWrapper, HUM_SCALE, LOG_SLOT_HUM };
+  table.entries[BSEC_OUTPUT_RAW_HUMIDITY] = { &m_humWrapper, HUM_SCALE, LOG_SLOT_HUM };
+  table.entries[BSEC_OUTPUT_RAW_PRESSURE] = { &m_presWrapper, PRES_SCALE, LOG_SLOT_PRES };
+  table.entries[BSEC_OUTPUT_IAQ] = { &m_iaqWrapper, IAQ_SCALE, LOG_SLOT_IAQ };
+  table.entries[BSEC_OUTPUT_STATIC_IAQ] = { &m_siaqWrapper, SIAQ_SCALE, LOG_SLOT_NONE };
+  table.entries[BSEC_OUTPUT_CO2_EQUIVALENT] = { &m_co2Wrapper, CO2_SCALE, LOG_SLOT_CO2 };
+  table.entries[BSEC_OUTPUT_BREATH_VOC_EQUIVALENT] = { &m_bvocWrapper, BVOC_SCALE, LOG_SLOT_BVOC };
+  table.entries[BSEC_OUTPUT_STABILIZATION_STATUS] = { &m_stabWrapper, 1.0f, LOG_SLOT_NONE };
+  table.entries[BSEC_OUTPUT_RUN_IN_STATUS] = { &m_runinWrapper, 1.0f, LOG_SLOT_NONE };
+  table.entries[BSEC_OUTPUT_GAS_ESTIMATE_1] = { &(m_gasEstWrappers[0]), GAS_EST_SCALE, LOG_SLOT_NONE };
+  table.entries[BSEC_OUTPUT_GAS_ESTIMATE_2] = { &(m_gasEstWrappers[1]), GAS_EST_SCALE, LOG_SLOT_NONE };
+  table.entries[BSEC_OUTPUT_GAS_ESTIMATE_3] = { &(m_gasEstWrappers[2]), GAS_EST_SCALE, LOG_SLOT_NONE };
+  table.entries[BSEC_OUTPUT_GAS_ESTIMATE_4] = { &(m_gasEstWrappers[3]), GAS_EST_SCALE, LOG_SLOT_NONE }; //Out of range index fails at compile time
+  return table;
+}
+
+static constexpr dispatch_table_t DISPATCH_TABLE = buildDispatchTable();
+
+static void publishEnvFrame(uint64_t timestamp, float temp, float hum, float pres) {
+  float values[ENV_FRAME_NUM_VALUES] = { temp, hum, pres };
+  uint8_t frame[TIMEBASE_FRAME_LEN(ENV_FRAME_NUM_VALUES)];
+  int frameLen = timebase_packFrame(frame, timestamp, values, ENV_FRAME_NUM_VALUES);
+  m_envFrameCharacteristic.setValue(frame, frameLen);
+  m_envFrameWrapper.notify();
+}
+
+/*
+ * Looks up each output in the dispatch table, writes its scaled value to its characteristic and collects the values to be logged.
+ * Returns a mask of the log slots filled
+ */
+static uint8_t dispatchOutputs(const bsecOutputs &outputs, float *logValues) {
+  uint8_t logMask = 0;
   int i;
   for (i = 0; i < outputs.nOutputs; i++) {
-    const bsecData output = outputs.output[i];
-    BLEWrapper *pWrapper = NULL;
-    float scaleFactor = 1.0f;
-
-    switch (output.sensor_id) {
-      case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE:
-        pWrapper = &m_tempWrapper;
-        scaleFactor = TEMP_SCALE;
-        break;
-
-      case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY:
-        pWrapper = &m_humWrapper;
-        scaleFactor = HUM_SCALE;
-        break;
-
-      case BSEC_OUTPUT_RAW_PRESSURE:
-        pWrapper = &m_presWrapper;
-        scaleFactor = PRES_SCALE;
-        break;
-
-      case BSEC_OUTPUT_IAQ:
-        pWrapper = &m_iaqWrapper;
-        scaleFactor = IAQ_SCALE;
-        break;
-
-      case BSEC_OUTPUT_STATIC_IAQ:
-        pWrapper = &m_siaqWrapper;
-        scaleFactor = SIAQ_SCALE;
-        break;
-
-      case BSEC_OUTPUT_CO2_EQUIVALENT:
-        pWrapper = &m_co2Wrapper;
-        scaleFactor = CO2_SCALE;
-        break;
-
-      case BSEC_OUTPUT_BREATH_VOC_EQUIVALENT:
-        pWrapper = &m_bvocWrapper;
-        scaleFactor = BVOC_SCALE;
-        break;
-      
-      case BSEC_OUTPUT_STABILIZATION_STATUS:
-        pWrapper = &m_stabWrapper;
-        break;
-      
-      case BSEC_OUTPUT_RUN_IN_STATUS:
-        pWrapper = &m_runinWrapper;
-        break;
-
-      default:
-        break;
+    const bsecData &output = outputs.output[i];
+    if (output.sensor_id >= DISPATCH_TABLE_SIZE) {
+      continue;
+    }
+
+    if (output.sensor_id == BSEC_OUTPUT_IAQ) {
+      m_iaqAccuracy = output.accuracy; //0 = unreliable ... 3 = fully calibrated
+    }
+
+    const output_dispatch_t &dispatch = DISPATCH_TABLE.entries[output.sensor_id];
+    if (dispatch.pWrapper != NULL) {
+      dispatch.pWrapper->writeValue(dispatch.scale * output.signal);
+    }
+
+    if (dispatch.logSlot != LOG_SLOT_NONE) {
+      logValues[dispatch.logSlot] = dispatch.scale * output.signal;
+      logMask |= (1 << dispatch.logSlot);
+    }
+  }
+
+  return logMask;
+}
+
+static void handleOutputs(const bme68xData &data, const bsecOutputs &outputs) {
+  uint64_t timestamp = timebase_now(); //Library calls back as soon as the field is read, just after the measurement completes
+  trace_bme688_t trace = { data.temperature, data.pressure, data.humidity, data.gas_resistance, data.status, data.gas_index };
+  trace_record(trace_source_bme688, &trace, sizeof(trace));
+  if (m_scanMode) {
+    handleGasStep(&data);
+  }
+
+  float logValues[NUM_LOG_SLOTS];
+  uint8_t logMask = dispatchOutputs(outputs, logValues);
+  if ((logMask & LOG_ENV_MASK) == LOG_ENV_MASK) {
+    datalog_write(datalog_type_environment, logValues[LOG_SLOT_TEMP], logValues[LOG_SLOT_HUM], logValues[LOG_SLOT_PRES]);
+    publishEnvFrame(timestamp, logValues[LOG_SLOT_TEMP], logValues[LOG_SLOT_HUM], logValues[LOG_SLOT_PRES]);
+  }
+
+  if ((logMask & LOG_AIR_MASK) == LOG_AIR_MASK) {
+    datalog_write(datalog_type_air, logValues[LOG_SLOT_IAQ], logValues[LOG_SLOT_CO2], logValues[LOG_SLOT_BVOC]);
+  }
+}
+
+static void newDataCallback(const bme68xData data, const bsecOutputs outputs, Bsec2 bsec) {
+  handleOutputs(data, outputs); //Library callback type passes arguments by value. Pass on by reference so nothing further is copied
+}
+
+static bool loadState(void) {
+  /*
+   * Prefer RTC copy when waking from deep sleep, as it is the most recent. Otherwise fall back to NVS
+   */
+  if ((esp_reset_reason() == ESP_RST_DEEPSLEEP) && (m_rtcStateCrc != 0) &&
+      (crc32_le(0, m_rtcState, BSEC_MAX_STATE_BLOB_SIZE) == m_rtcStateCrc)) {
+    memcpy(m_stateBuf, m_rtcState, BSEC_MAX_STATE_BLOB_SIZE);
+  } else {
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, true)) {
+      return false;
+    }
+
+    size_t len = prefs.getBytes(NVS_STATE_KEY, m_stateBuf, BSEC_MAX_STATE_BLOB_SIZE);
+    prefs.end();
+    if (len != BSEC_MAX_STATE_BLOB_SIZE) {
+      return false; //No state saved yet
+    }
+  }
+
+  if (!m_envSensor.setState(m_stateBuf)) {
+    return handleError("restoring state");
+  }
+
+  return true;
+}
+
+static void saveState(bool toRtc) {
+  if (!m_envSensor.getState(m_stateBuf)) {
+    handleError("reading state");
+    return;
+  }
+
+  if (toRtc) {
+    memcpy(m_rtcState, m_stateBuf, BSEC_MAX_STATE_BLOB_SIZE);
+    m_rtcStateCrc = crc32_le(0, m_rtcState, BSEC_MAX_STATE_BLOB_SIZE);
+  }
+
+  if (m_iaqAccuracy < STATE_MIN_ACCURACY) {
+    return; //Don't overwrite a good saved state with an uncalibrated one
+  }
+
+  if (m_stateSaved && (memcmp(m_stateBuf, m_savedState, BSEC_MAX_STATE_BLOB_SIZE) == 0)) {
+    return; //Nothing has changed, save a flash write
+  }
+
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) {
+    ERROR("Could not open NVS to save state");
+    return;
+  }
+
+  if (prefs.putBytes(NVS_STATE_KEY, m_stateBuf, BSEC_MAX_STATE_BLOB_SIZE) == BSEC_MAX_STATE_BLOB_SIZE) {
+    memcpy(m_savedState, m_stateBuf, BSEC_MAX_STATE_BLOB_SIZE);
+    m_stateSaved = true;
+  } else {
+    ERROR("Could not save state to NVS");
+  }
+
+  prefs.end();
+}
+
+static void onSleep(void) {
+  if (m_ready && !m_scanMode) { //State is only kept for IAQ mode
+    saveState(true);
+  }
+}
+
+static bool subscribe(void) {
+  if (m_scanMode) {
+    return m_envSensor.updateSubscription(m_scanSensorList, ARRAY_LEN(m_scanSensorList), SCAN_SAMPLE_RATE);
+  } else {
+    uint32_t rate = config_getUint(m_lowPower ? config_param_bme688LowPowerRate : config_param_bme688Rate);
+    float sampleRate = BSEC_RATE[rate];
+    return m_envSensor.updateSubscription(m_sensorList, ARRAY_LEN(m_sensorList), sampleRate);
+  }
+}
+
+static void setScanMode(bool scanMode) {
+  m_scanMode = scanMode;
+  m_scanWrapper.writeValue(m_scanMode);
+
+  if (m_scanMode) {
+    /*
+     * Keep a copy of IAQ state in m_stateBuf, which is not touched again until scanning is turned off
+     */
+    saveState(true);
+    m_iaqStateValid = true;
+    m_gasValidMask = 0;
+    m_lastGasIndex = -1;
+    if (!m_envSensor.setConfig(SCAN_CONFIG)) {
+      handleError("loading gas scanning config");
+    }
+  } else {
+    if (!m_envSensor.setConfig(IAQ_CONFIG)) {
+      handleError("loading IAQ config");
     }
 
-    if (pWrapper != NULL) {
-      BLECharacteristic *pCharacteristic = pWrapper->getCharacteristic();
-      if (pCharacteristic != NULL) {
-        pWrapper->writeValue(scaleFactor * output.signal);
-      }
+    if (m_iaqStateValid && !m_envSensor.setState(m_stateBuf)) {
+      handleError("restoring state");
     }
   }
+
+  if (!subscribe()) {
+    handleError("subscribing to data outputs");
+  }
 }
 
 bool bme688_init(i2c_address_t addr) {
-  bsecSensor sensorList[] = {
-    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
-    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,
-    BSEC_OUTPUT_RAW_PRESSURE,  //No compensated pressure option exists
-    BSEC_OUTPUT_IAQ,           //Raw IAQ measurement
-    BSEC_OUTPUT_STATIC_IAQ,    //"Delta" IAQ measurement relative to running average, intended to show changes in air quality against "normal" value for location
-    BSEC_OUTPUT_CO2_EQUIVALENT,
-    BSEC_OUTPUT_BREATH_VOC_EQUIVALENT,
-    BSEC_OUTPUT_STABILIZATION_STATUS,  //0 = stabilisation in progress, 1 = stabilisation finished
-    BSEC_OUTPUT_RUN_IN_STATUS          //0 = run-in in progress, 1 = run-in finished
-  };
-
-  if (!m_envSensor.begin(addr, Wire)) {
+  m_ready = false; //May be called again to recover from failure
+  m_i2cAddress = (uint8_t)addr;
+  if (!m_envSensor.begin(BME68X_I2C_INTF, busRead, busWrite, busDelay, &m_i2cAddress)) {
     if (!handleError("initialising sensor")) {
       return false;
     }
   }
 
   m_envSensor.setTemperatureOffset(TEMP_OFFSET);
-  if (!m_envSensor.updateSubscription(sensorList, ARRAY_LEN(sensorList), SAMPLE_RATE)) {
+  if (loadState()) {
+    Serial.println("BME688: restored BSEC state");
+  }
+
+  m_lowPower = true; //No client is connected yet
+  m_scanMode = false; //Sensor starts with IAQ config. Scanning is restarted from loop if it was on before a re-init
+  m_configGeneration = config_getGeneration();
+  if (!subscribe()) {
     if (!handleError("subscribing to data outputs")) {
       return false;
     }
   }
 
   m_envSensor.attachCallback(newDataCallback);
+  if (!m_sleepCallbackAdded) {
+    m_sleepCallbackAdded = powermgmt_addSleepCallback(onSleep);
+  }
+
+  m_lastSaveTime = millis();
   m_ready = true;
   return true;
 }
 
 bool bme688_addService(BLEServer *pServer) {
-  if (!m_ready) {
-    return false;
-  }
-
   int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
   BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
   if (pService == NULL) {
     ERROR("Cannot add BLE service");
-    m_ready = false;
     return false;
   }
 
@@ -247,12 +635,119 @@ bool bme688_addService(BLEServer *pServer) {
   pService->addCharacteristic(&m_stabCharacteristic);
   pService->addCharacteristic(&m_runinCharacteristic);
 
+  int i;
+  for (i = 0; i < NUM_GAS_ESTIMATES; i++) {
+    pService->addCharacteristic(&(m_gasEstCharacteristics[i]));
+  }
+
+  pService->addCharacteristic(&m_gasFrameCharacteristic);
+  pService->addCharacteristic(&m_envFrameCharacteristic);
+  pService->addCharacteristic(&m_scanCharacteristic);
+  m_scanCharacteristic.setCallbacks(new ScanCallbacks());
   pService->start();
+  m_scanWrapper.writeValue(m_scanMode);
   return true;
 }
 
+void bme688_setLowPower(bool lowPower) {
+  if (!m_ready || (lowPower == m_lowPower)) {
+    return;
+  }
+
+  m_lowPower = lowPower;
+  if (m_scanMode) {
+    return; //Scanning mode has a single sample rate, applied when scanning is turned off
+  }
+
+  if (!subscribe()) {
+    m_lowPower = !lowPower;
+    handleError("changing sample rate");
+  }
+}
+
 void bme688_loop(void) {
-  if (m_ready && !m_envSensor.run()) {
+  PROFILE_ZONE("bme688_loop");
+  if (!m_ready) {
+    return;
+  }
+
+  idle_wakeAfter(1000UL * POLL_TIME);
+
+  if (!i2cbus_acquire(i2cbus_device_bme688)) {
+    return; //Bus would delay next ADAF1080 sample, try again after it
+  }
+
+  /*
+   * Reconfiguration and BSEC run are separate bus slices. The run itself can't be split, as the library does its reads and output
+   * processing in one call
+   */
+  if (m_requestedScanMode != m_scanMode) {
+    setScanMode(m_requestedScanMode);
+    i2cbus_release(i2cbus_device_bme688);
+    idle_wakeAfter(0);
+    return;
+  }
+
+  if (config_getGeneration() != m_configGeneration) {
+    m_configGeneration = config_getGeneration();
+    if (!m_scanMode && !subscribe()) { //Scanning mode has a single sample rate, new rate is applied when scanning is turned off
+      handleError("changing sample rate");
+    }
+
+    i2cbus_release(i2cbus_device_bme688);
+    idle_wakeAfter(0);
+    return;
+  }
+
+  bool ok;
+  {
+    PROFILE_ZONE("BSEC run"); //Includes the sensor I2C reads and output callbacks
+    ok = m_envSensor.run();
+  }
+
+  if (!ok) {
     handleError("reading sensor data");
   }
+
+  i2cbus_reportResult(i2cbus_device_bme688, ok);
+  i2cbus_release(i2cbus_device_bme688);
+
+  /*
+   * Save as soon as IAQ first becomes fully calibrated, then periodically
+   */
+  unsigned long now = millis();
+  if (!m_scanMode && (m_iaqAccuracy >= STATE_MIN_ACCURACY) && (!m_saveAttempted || (now - m_lastSaveTime >= STATE_SAVE_PERIOD))) {
+    m_saveAttempted = true;
+    m_lastSaveTime = now;
+    saveState(false);
+  }
+}
+
+/*
+ * Benchmark: one IAQ mode callback through the dispatch table, as BSEC would deliver it. Times the table lookup, scaling and
+ * characteristic writes only, not the data log, environment frame or trace that follow. Two sets of outputs alternate so every value
+ * changes, as it would between real callbacks
+ */
+static bsecOutputs m_benchOutputs[2];
+
+static void benchDispatch(uint32_t iteration) {
+  float logValues[NUM_LOG_SLOTS];
+  uint8_t logMask = dispatchOutputs(m_benchOutputs[iteration & 1], logValues);
+  bench_keep(logValues[LOG_SLOT_TEMP] + (float)logMask);
+}
+
+void bme688_bench(void) {
+  int set;
+  for (set = 0; set < 2; set++) {
+    bsecOutputs &outputs = m_benchOutputs[set];
+    outputs.nOutputs = ARRAY_LEN(m_sensorList);
+    int i;
+    for (i = 0; i < outputs.nOutputs; i++) {
+      outputs.output[i].sensor_id = m_sensorList[i];
+      outputs.output[i].signal = 20.0f + (float)i + 0.5f * (float)set;
+      outputs.output[i].accuracy = 3;
+    }
+  }
+
+  bench_run("bme688 output dispatch", benchDispatch);
 }
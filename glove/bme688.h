@@ -16,5 +16,7 @@
 bool bme688_init(i2c_address_t addr);
 bool bme688_addService(BLEServer *pServer);
 void bme688_loop(void);
+void bme688_setLowPower(bool lowPower);
+void bme688_bench(void);
 
 #endif /* __BME688_H */
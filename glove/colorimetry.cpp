@@ -0,0 +1,77 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module converts AS7341 basic counts into CIE 1931 XYZ tristimulus values, illuminance and correlated colour temperature.
+ *
+ * XYZ is calculated by multiplying the vector of basic counts by a 3x10 calibration matrix. The default matrix below is the CIE 1931 2 degree
+ * colour matching functions sampled at the centre wavelength of each channel, with no weighting for Clear or NIR. This gives plausible chromaticity,
+ * but for absolute accuracy it should be replaced with a matrix calibrated against a reference spectrometer (see ams application note
+ * "AS7341 Spectral Sensor Calibration Methods").
+ *
+ * Y is relative illuminance. It is converted to lux with a single scale factor, config_param_as7341LuxScale, found by reading Y under a
+ * lamp measured with a reference lux meter and setting the scale to lux / Y. This can be done on site, over BLE. The scale is only exact
+ * for light of a similar spectrum to the lamp used, as the default matrix doesn't follow the photopic curve closely between channels.
+ *
+ * The matrix itself is fixed at build time. Calibrating it needs a reference spectrometer and a set of light sources, which is a bench
+ * procedure done once per sensor design rather than per glove, so a new matrix comes with a firmware update. Chromaticity and CCT
+ * depend only on the ratios within the matrix, so a site lux calibration does not disturb them.
+ */
+
+#include <math.h>
+
+#include "colorimetry.h"
+#include "config.h"
+
+/*
+ * McCamy's approximation for CCT from chromaticity. Valid from roughly 2000K to 12500K
+ */
+#define MCCAMY_XE 0.3320f
+#define MCCAMY_YE 0.1858f
+#define MCCAMY_A3 449.0f
+#define MCCAMY_A2 3525.0f
+#define MCCAMY_A1 6823.3f
+#define MCCAMY_A0 5520.33f
+
+/*
+ * Calibration matrix, indexed by [X/Y/Z][channel]. Declared const so that it is stored in flash rather than RAM.
+ * Channel order: 415nm, 445nm, 480nm, 515nm, 555nm, 590nm, 630nm, 680nm, Clear, NIR
+ */
+static const float CAL_MATRIX[3][COLORIMETRY_NUM_CHANNELS] = {
+  { 0.0889f, 0.3423f, 0.0956f, 0.0363f, 0.5121f, 1.0263f, 0.6424f, 0.0468f, 0.0f, 0.0f },
+  { 0.0022f, 0.0305f, 0.1390f, 0.6065f, 1.0000f, 0.7570f, 0.2650f, 0.0170f, 0.0f, 0.0f },
+  { 0.4265f, 1.7596f, 0.8130f, 0.1182f, 0.0058f, 0.0011f, 0.0000f, 0.0000f, 0.0f, 0.0f }
+};
+
+void colorimetry_calculate(const float *basicCounts, colorimetry_t *pResult) {
+  float xyz[3];
+  int i, j;
+  for (i = 0; i < 3; i++) {
+    float accum = 0.0f;
+    for (j = 0; j < COLORIMETRY_NUM_CHANNELS; j++) {
+      accum += CAL_MATRIX[i][j] * basicCounts[j];
+    }
+
+    xyz[i] = accum;
+  }
+
+  pResult->X = xyz[0];
+  pResult->Y = xyz[1];
+  pResult->Z = xyz[2];
+  pResult->lux = config_get(config_param_as7341LuxScale) * xyz[1];
+
+  float sum = xyz[0] + xyz[1] + xyz[2];
+  if (sum <= 0.0f) {
+    pResult->cct = 0.0f; //No light, colour temperature is undefined
+    return;
+  }
+
+  float x = xyz[0] / sum; //Chromaticity coordinates
+  float y = xyz[1] / sum;
+  float n = (x - MCCAMY_XE) / (MCCAMY_YE - y);
+  float cct = MCCAMY_A3 * n * n * n + MCCAMY_A2 * n * n + MCCAMY_A1 * n + MCCAMY_A0;
+  pResult->cct = (cct > 0.0f) ? cct : 0.0f;
+}
@@ -0,0 +1,24 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __COLORIMETRY_H
+#define __COLORIMETRY_H
+
+#define COLORIMETRY_NUM_CHANNELS 10 //F1-F8, Clear, NIR
+
+typedef struct {
+  float X;
+  float Y;
+  float Z;
+  float lux;
+  float cct;
+} colorimetry_t;
+
+void colorimetry_calculate(const float *basicCounts, colorimetry_t *pResult);
+
+#endif /* __COLORIMETRY_H */
@@ -0,0 +1,340 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module holds the sample rates and thresholds that can be tuned per deployment without reflashing. Each parameter has a range and
+ * default in the schema below. Values are kept in NVS, so they survive power loss.
+ *
+ * The configuration characteristic reads as:
+ *
+ *    Schema version (uint8)
+ *    Number of parameters (uint8)
+ *    Result of last write (uint8, config_result_t)
+ *    Generation (uint8): incremented each time new values are applied
+ *    Value of each parameter (float32), indexed by config_param_t
+ *
+ * To change parameters, the client writes the schema version (uint8) followed by one or more pairs of parameter index (uint8) and new
+ * value (float32). The write is rejected as a whole if the version doesn't match or any value is invalid, so several related parameters
+ * (e.g. both diag limits) can be changed together without ever applying an inconsistent set.
+ *
+ * Modules read parameters whenever they need them, so most changes take effect on the next loop. Modules that have to reconfigure their
+ * sensor compare config_getGeneration() against the generation they last applied.
+ *
+ * Bump CONFIG_VERSION if the meaning of an existing parameter changes. Saved values from a different version are discarded.
+ */
+
+#define ERR_MODULE_NAME "Config"
+
+#include <string.h>
+#include <math.h>
+#include <Arduino.h>
+#include <Preferences.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+
+#include "blewrapper.h"
+#include "config.h"
+#include "profile.h"
+#include "err.h"
+
+#define CONFIG_VERSION 1
+
+#define NVS_NAMESPACE "config"
+#define NVS_VERSION_KEY "version"
+#define NVS_VALUES_KEY "values"
+
+#define HEADER_LEN 4 //Version, number of parameters, result, generation
+#define VALUE_LEN sizeof(float)
+#define CONFIG_LEN (HEADER_LEN + NUM_CONFIG_PARAMS * VALUE_LEN)
+#define ENTRY_LEN (1 + VALUE_LEN) //Parameter index (uint8), value (float32)
+#define MAX_WRITE_LEN (1 + NUM_CONFIG_PARAMS * ENTRY_LEN)
+
+#define AS7341_MAX_COUNTS 65535 //ADC full scale is (ATIME + 1) * (ASTEP + 1), which must fit in 16 bits
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS 1
+
+#define BLE_SERVICE_UUID BLEUUID("4a8f2d6b-e3c1-4b97-a5d8-7f1e9c3b6a42")
+#define CONFIG_UUID BLEUUID("b7e1c5a9-2f4d-4e83-9c6b-1d8a3f7e5b20")
+#define CONFIG_FORMAT BLE2904::FORMAT_OPAQUE
+#define CONFIG_EXPONENT 0
+#define CONFIG_UNIT BLEUnit::Unitless
+#define CONFIG_NAME "Configuration"
+
+typedef enum {
+  config_result_ok = 0,
+  config_result_badVersion,
+  config_result_badLength,
+  config_result_badParam,
+  config_result_outOfRange,
+  config_result_inconsistent,
+  config_result_saveFailed //Values were applied, but will be lost on power off
+} config_result_t;
+
+typedef struct {
+  float min;
+  float max;
+  float defaultValue;
+  bool integer;
+} config_schema_t;
+
+/*
+ * Indexed by config_param_t
+ */
+static const config_schema_t SCHEMA[NUM_CONFIG_PARAMS] = {
+  { 1000.0f, 20000.0f, 4000.0f, true },   //config_param_adaf1080SampleTime: 250Hz
+  { 10.0f, 2500.0f, 250.0f, true },       //config_param_adaf1080NumSamples: statistics every second at 250Hz
+
+  /*
+   * Diag coil produces approx. -18uT field strength based on empirical measurments. This is less than datasheet value of 22.8uT (for 100mA drive).
+   * Default limits allow for noise, as 18uT is close to noise floor even with averaging.
+   */
+  { -40.0f, 0.0f, -20.0f, false },        //config_param_adaf1080DiagMin
+  { -40.0f, 0.0f, -16.0f, false },        //config_param_adaf1080DiagMax
+
+  { 100.0f, 60000.0f, 1000.0f, true },    //config_param_as7341SampleTime
+  { 100.0f, 300000.0f, 5000.0f, true },   //config_param_as7341StillSampleTime
+  { 0.0f, 255.0f, 29.0f, true },          //config_param_as7341Atime: (29 + 1) * (599 + 1) * 2.78us = 50ms
+  { 0.0f, 65534.0f, 599.0f, true },       //config_param_as7341Astep
+  { 5.0f, 6.0f, 6.0f, true },             //config_param_lsm9ds1Odr: 952Hz. Vibration measurement needs at least 476Hz
+  { 1.0f, 6.0f, 2.0f, true },             //config_param_lsm9ds1StillOdr: 59.5Hz
+  { 5.0f, 1000.0f, 20.0f, true },         //config_param_lsm9ds1FusionTime
+  { 5.0f, 1000.0f, 200.0f, true },        //config_param_lsm9ds1StillFusionTime
+  { 100.0f, 60000.0f, 1000.0f, true },    //config_param_lsm9ds1SampleTime
+  { 100.0f, 300000.0f, 5000.0f, true },   //config_param_lsm9ds1StillSampleTime
+  { 0.0f, 1.0f, 1.0f, true },             //config_param_bme688Rate: continuous
+  { 0.0f, 1.0f, 0.0f, true },             //config_param_bme688LowPowerRate: low power
+  { 100.0f, 60000.0f, 1000.0f, true },   //config_param_batterySampleTime
+  { 0.0f, 600000.0f, 5000.0f, true },     //config_param_activityDwellTime: rides out short pauses in work
+  { 0.0f, 60000.0f, 0.0f, true },         //config_param_activityStillDwellTime: wake on first motion
+
+  /*
+   * Default of 1 is uncalibrated: lux reads the same as Y, which is only proportional to illuminance. Set to reference lux / CIE Y
+   * under a lamp of known illuminance (see colorimetry.cpp)
+   */
+  { 0.0001f, 10000.0f, 1.0f, false }      //config_param_as7341LuxScale
+};
+
+static BLECharacteristic m_configCharacteristic(CONFIG_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_configWrapper(&m_configCharacteristic, CONFIG_NAME, CONFIG_FORMAT, CONFIG_EXPONENT, CONFIG_UNIT);
+
+static float m_values[NUM_CONFIG_PARAMS];
+static uint32_t m_generation = 0;
+static config_result_t m_lastResult = config_result_ok;
+static bool m_serviceAdded = false;
+
+static volatile bool m_writePending = false;
+static uint8_t m_writeBuf[MAX_WRITE_LEN];
+static size_t m_writeLen;
+
+class ConfigCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    if ((pCharacteristic == NULL) || m_writePending) {
+      return; //Previous write not applied yet
+    }
+
+    /*
+     * Callback runs in different thread. Modules read parameters from the main thread, so take a copy and apply it there.
+     * Oversized writes are still flagged, so that the client gets a result
+     */
+    m_writeLen = pCharacteristic->getLength();
+    if (m_writeLen <= MAX_WRITE_LEN) {
+      memcpy(m_writeBuf, pCharacteristic->getData(), m_writeLen);
+    }
+
+    m_writePending = true;
+  }
+};
+
+static bool isValid(config_param_t param, float value) {
+  const config_schema_t &schema = SCHEMA[param];
+  if (!((value >= schema.min) && (value <= schema.max))) { //Also rejects NaN
+    return false;
+  }
+
+  return !schema.integer || (value == floorf(value));
+}
+
+/*
+ * Checks between parameters, for values that are only valid in combination
+ */
+static bool isConsistent(const float *values) {
+  if (values[config_param_adaf1080DiagMin] >= values[config_param_adaf1080DiagMax]) {
+    return false;
+  }
+
+  uint32_t as7341Counts = (uint32_t)(values[config_param_as7341Atime] + 1.0f) * (uint32_t)(values[config_param_as7341Astep] + 1.0f);
+  return (as7341Counts <= AS7341_MAX_COUNTS);
+}
+
+static void setDefaults(float *values) {
+  int i;
+  for (i = 0; i < NUM_CONFIG_PARAMS; i++) {
+    values[i] = SCHEMA[i].defaultValue;
+  }
+}
+
+static bool load(void) {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true)) {
+    return false; //Namespace doesn't exist until values have been saved
+  }
+
+  float saved[NUM_CONFIG_PARAMS];
+  size_t len = 0;
+  if (prefs.getUChar(NVS_VERSION_KEY, 0) == CONFIG_VERSION) {
+    len = prefs.getBytes(NVS_VALUES_KEY, saved, sizeof(saved));
+  }
+
+  prefs.end();
+
+  /*
+   * Older firmware may have saved fewer parameters. Those after the end keep their defaults
+   */
+  int numSaved = len / VALUE_LEN;
+  if (numSaved == 0) {
+    return false;
+  }
+
+  float values[NUM_CONFIG_PARAMS];
+  setDefaults(values);
+  int i;
+  for (i = 0; i < numSaved; i++) {
+    if (isValid((config_param_t)i, saved[i])) {
+      values[i] = saved[i];
+    }
+  }
+
+  if (!isConsistent(values)) {
+    return false;
+  }
+
+  memcpy(m_values, values, sizeof(m_values));
+  return true;
+}
+
+static bool save(void) {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) {
+    ERROR("Could not open NVS to save configuration");
+    return false;
+  }
+
+  bool ok = (prefs.putUChar(NVS_VERSION_KEY, CONFIG_VERSION) == 1) && (prefs.putBytes(NVS_VALUES_KEY, m_values, sizeof(m_values)) == sizeof(m_values));
+  prefs.end();
+  if (!ok) {
+    ERROR("Could not save configuration to NVS");
+  }
+
+  return ok;
+}
+
+static void publish(void) {
+  uint8_t value[CONFIG_LEN];
+  value[0] = CONFIG_VERSION;
+  value[1] = NUM_CONFIG_PARAMS;
+  value[2] = (uint8_t)m_lastResult;
+  value[3] = (uint8_t)m_generation;
+  memcpy(&(value[HEADER_LEN]), m_values, sizeof(m_values)); //ESP32 is little endian, same as BLE
+
+  m_configCharacteristic.setValue(value, CONFIG_LEN);
+  if (m_serviceAdded) {
+    m_configWrapper.notify();
+  }
+}
+
+static config_result_t apply(const uint8_t *data, size_t len) {
+  if ((len < 1) || (data[0] != CONFIG_VERSION)) {
+    return config_result_badVersion;
+  }
+
+  if ((len == 1) || (len > MAX_WRITE_LEN) || ((len - 1) % ENTRY_LEN != 0)) {
+    return config_result_badLength;
+  }
+
+  /*
+   * Build the new set of values on the side, so nothing changes unless every entry is valid
+   */
+  float values[NUM_CONFIG_PARAMS];
+  memcpy(values, m_values, sizeof(values));
+
+  size_t pos;
+  for (pos = 1; pos < len; pos += ENTRY_LEN) {
+    uint8_t param = data[pos];
+    if (param >= NUM_CONFIG_PARAMS) {
+      return config_result_badParam;
+    }
+
+    float value;
+    memcpy(&value, &(data[pos + 1]), VALUE_LEN);
+    if (!isValid((config_param_t)param, value)) {
+      return config_result_outOfRange;
+    }
+
+    values[param] = value;
+  }
+
+  if (!isConsistent(values)) {
+    return config_result_inconsistent;
+  }
+
+  memcpy(m_values, values, sizeof(m_values));
+  m_generation++;
+  return save() ? config_result_ok : config_result_saveFailed;
+}
+
+void config_init(void) {
+  setDefaults(m_values);
+  if (load()) {
+    Serial.println("Config: restored saved configuration");
+  }
+}
+
+bool config_addService(BLEServer *pServer) {
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    ERROR("Cannot add BLE service");
+    return false;
+  }
+
+  pService->addCharacteristic(&m_configCharacteristic);
+  m_configCharacteristic.setCallbacks(new ConfigCallbacks());
+  pService->start();
+  publish();
+  m_serviceAdded = true;
+  return true;
+}
+
+void config_loop(void) {
+  PROFILE_ZONE("config_loop");
+  if (!m_writePending) {
+    return;
+  }
+
+  m_lastResult = apply(m_writeBuf, m_writeLen);
+  m_writePending = false; //Buffer can be reused once it has been applied
+  if (m_lastResult != config_result_ok) {
+    ERROR("Configuration write failed, result code %d", (int)m_lastResult);
+  }
+
+  publish(); //Client sees the result, and the values now in use
+}
+
+float config_get(config_param_t param) {
+  return m_values[param];
+}
+
+uint32_t config_getUint(config_param_t param) {
+  return (uint32_t)m_values[param]; //Integer parameters are validated as whole numbers
+}
+
+/*
+ * Changes each time new values are applied
+ */
+uint32_t config_getGeneration(void) {
+  return m_generation;
+}
@@ -0,0 +1,51 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#include <stdint.h>
+#include <BLEServer.h>
+
+/*
+ * Runtime parameters. New parameters must only be added at the end, so that values saved by older firmware still line up.
+ * Parameters that depend on activity profile come in pairs (moving, then still) so they can be indexed by activity_profile_t
+ */
+typedef enum {
+  config_param_adaf1080SampleTime = 0,  //us between samples at full rate
+  config_param_adaf1080NumSamples,      //Samples per statistics window at full rate
+  config_param_adaf1080DiagMin,         //uT, diag coil field change must be between min and max, otherwise sensor is saturated
+  config_param_adaf1080DiagMax,         //uT
+  config_param_as7341SampleTime,        //ms between reports while moving
+  config_param_as7341StillSampleTime,   //ms between reports while still
+  config_param_as7341Atime,             //Integration time = (ATIME + 1) * (ASTEP + 1) * 2.78us
+  config_param_as7341Astep,             //Default ASTEP, auto-exposure extends this in dim light
+  config_param_lsm9ds1Odr,              //Gyro/accel ODR code while moving: 1 = 14.9Hz, 2 = 59.5Hz, 3 = 119Hz, 4 = 238Hz, 5 = 476Hz, 6 = 952Hz
+  config_param_lsm9ds1StillOdr,         //ODR code while still
+  config_param_lsm9ds1FusionTime,       //ms between fusion updates while moving
+  config_param_lsm9ds1StillFusionTime,  //ms between fusion updates while still
+  config_param_lsm9ds1SampleTime,       //ms between reports while moving
+  config_param_lsm9ds1StillSampleTime,  //ms between reports while still
+  config_param_bme688Rate,              //BSEC rate while connected: 0 = low power (3s), 1 = continuous (1s)
+  config_param_bme688LowPowerRate,      //BSEC rate while disconnected
+  config_param_batterySampleTime,       //ms between battery readings
+  config_param_activityDwellTime,       //ms to stay in moving profile (and be quiet for) before going still
+  config_param_activityStillDwellTime,  //ms to stay in still profile before motion can switch back to moving
+  config_param_as7341LuxScale           //Lux per unit of CIE Y, from calibration against a reference lux meter
+} config_param_t;
+
+#define NUM_CONFIG_PARAMS 20
+
+void config_init(void);
+bool config_addService(BLEServer *pServer);
+void config_loop(void);
+float config_get(config_param_t param);
+uint32_t config_getUint(config_param_t param);
+uint32_t config_getGeneration(void);
+
+#endif /* __CONFIG_H */
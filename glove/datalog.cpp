@@ -0,0 +1,572 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module records sensor readings to flash while no client is connected, and sends the backlog when a client reconnects.
+ *
+ * Each reading is a fixed size 16 byte record holding a type, the time since the previous record and three values. An absolute time
+ * record is written when recording starts, when the delta would overflow, and every TIME_INTERVAL records, so that the log can still be
+ * decoded after the oldest segments have been dropped.
+ *
+ * Records are buffered in RAM and appended to the filesystem a page or so at a time. The log is split into segment files named by
+ * sequence number. When the newest segment is full a new one is started, and once there are MAX_SEGMENTS the oldest is deleted. LittleFS
+ * spreads erases across the partition, and deleting whole segments frees whole blocks, so flash wear is evenly levelled.
+ *
+ * Transfer of the backlog is driven by the client, which must first enable notifications on the log records characteristic:
+ *
+ *    - Client writes START (0x01) to the log control characteristic. Frames are streamed oldest first, numbered from 0
+ *    - Each notification carries a frame counter (uint32) followed by as many whole records as fit in the MTU
+ *    - Client writes ACK (0x02) with the uint32 number of the last frame it received in order. Acks are cumulative
+ *    - Frames not acknowledged within ACK_TIMEOUT are sent again, starting from the oldest unacknowledged frame and reusing its number.
+ *      The client should ignore any frame that isn't the next one it expects
+ *    - Once everything has been acknowledged, a frame with no records marks the end of the log. Transfer stops when it is acknowledged
+ *    - Client may write STOP (0x00) at any time. Disconnecting also stops the transfer
+ *
+ * Segments are only deleted once all of their records have been acknowledged, so nothing is lost if the client goes away mid-transfer.
+ * The acknowledged position is not saved, so records may be sent again after a reset.
+ */
+
+#define ERR_MODULE_NAME "DataLog"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+
+#include "blewrapper.h"
+#include "datalog.h"
+#include "idle.h"
+#include "powermgmt.h"
+#include "profile.h"
+#include "err.h"
+
+#define LOG_DIR "/log"
+#define MAX_PATH_LEN 24
+
+#define RECORD_LEN sizeof(datalog_record_t)
+#define SEGMENT_SIZE 65536 //bytes, multiple of RECORD_LEN
+#define MAX_SEGMENTS 16 //1MB in total, filesystem partition must be larger than this
+
+#define BUFFER_RECORDS 64 //Records held in RAM between writes to flash
+#define FLUSH_TIME 30000 //milliseconds, maximum time records are held in RAM
+#define MAX_DELTA 65535 //milliseconds, largest delta that fits in a record
+#define TIME_INTERVAL 256 //Records between absolute time records
+
+#define ATT_HEADER_LEN 3 //Opcode and handle in each notification
+#define ATT_MAX_VALUE_LEN 512
+#define FRAME_HEADER_LEN 4 //Frame counter (uint32)
+#define MAX_FRAME_RECORDS ((ATT_MAX_VALUE_LEN - FRAME_HEADER_LEN) / RECORD_LEN)
+#define MAX_FRAME_LEN (FRAME_HEADER_LEN + MAX_FRAME_RECORDS * RECORD_LEN)
+
+#define STREAM_INTERVAL 10 //milliseconds between bursts of notifications, so the BLE stack's queue doesn't overflow
+#define FRAMES_PER_BURST 4
+#define MAX_UNACKED_FRAMES 16 //Frames in flight before waiting for the client
+#define ACK_TIMEOUT 2000 //milliseconds, resend unacknowledged frames after this long
+#define REPORT_TIME 1000 //milliseconds
+
+#define CONTROL_STOP 0x00
+#define CONTROL_START 0x01
+#define CONTROL_ACK 0x02
+#define CONTROL_ACK_LEN 5 //Opcode, frame counter (uint32)
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS 3
+
+#define BLE_SERVICE_UUID BLEUUID("2d7e9b41-8c3f-4a6d-b5e2-9f1c4a7d3e58")
+#define RECORDS_UUID BLEUUID("6f3a1c8e-4d2b-4e97-a6c5-1b8d3f9e7a24")
+#define BACKLOG_UUID BLEUUID("9c4e2a7f-1b6d-4f38-8e5a-3d7b1c9f2e46")
+#define CONTROL_UUID BLEUUID("a3d8f1c6-5e2b-4c79-9f14-8b6e2d7a3c51")
+
+#define RECORDS_FORMAT BLE2904::FORMAT_OPAQUE
+#define BACKLOG_FORMAT BLE2904::FORMAT_UINT32
+#define CONTROL_FORMAT BLE2904::FORMAT_OPAQUE
+
+#define RECORDS_EXPONENT 0
+#define BACKLOG_EXPONENT 0
+#define CONTROL_EXPONENT 0
+
+#define RECORDS_UNIT BLEUnit::Unitless
+#define BACKLOG_UNIT BLEUnit::Unitless
+#define CONTROL_UNIT BLEUnit::Unitless
+
+#define RECORDS_NAME "Log records"
+#define BACKLOG_NAME "Log records waiting"
+#define CONTROL_NAME "Log control"
+
+static BLECharacteristic m_recordsCharacteristic(RECORDS_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_backlogCharacteristic(BACKLOG_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_controlCharacteristic(CONTROL_UUID, BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR);
+
+static BLEWrapper m_recordsWrapper(&m_recordsCharacteristic, RECORDS_NAME, RECORDS_FORMAT, RECORDS_EXPONENT, RECORDS_UNIT);
+static BLEWrapper m_backlogWrapper(&m_backlogCharacteristic, BACKLOG_NAME, BACKLOG_FORMAT, BACKLOG_EXPONENT, BACKLOG_UNIT);
+static BLEWrapper m_controlWrapper(&m_controlCharacteristic, CONTROL_NAME, CONTROL_FORMAT, CONTROL_EXPONENT, CONTROL_UNIT);
+
+static BLEServer *m_pServer = NULL;
+
+static datalog_record_t m_buffer[BUFFER_RECORDS];
+static int m_bufferCount = 0;
+static uint8_t m_frame[MAX_FRAME_LEN];
+
+/*
+ * Log positions are segment * SEGMENT_SIZE + offset within segment, so they keep increasing as segments are added
+ */
+static uint32_t m_firstSegment = 0; //Oldest segment still stored
+static uint32_t m_lastSegment = 0; //Segment being written. May not exist yet if nothing has been written to it
+static size_t m_lastSegmentSize = 0;
+static uint64_t m_sendPos = 0; //Next record to send
+static uint64_t m_ackPos = 0; //Everything before this has been acknowledged
+
+static bool m_transferring = false;
+static bool m_endSent = false; //End of log frame is in flight
+static uint32_t m_frameCount = 0; //Next frame number to send
+static uint32_t m_ackedFrames = 0; //Frames acknowledged so far
+static uint64_t m_frameEnd[MAX_UNACKED_FRAMES]; //Log position after each frame in flight, indexed by frame number
+static unsigned long m_lastAckTime;
+
+static volatile bool m_requestStart = false; //Written from BLE thread, handled in datalog_loop()
+static volatile bool m_requestStop = false;
+static volatile bool m_ackPending = false;
+static volatile uint32_t m_ackFrame;
+
+static unsigned long m_lastRecordTime;
+static unsigned long m_lastFlushTime;
+static unsigned long m_lastStreamTime;
+static unsigned long m_lastReportTime;
+static int m_recordsSinceTime = 0;
+
+static bool m_recording = false;
+static bool m_connected = false;
+static bool m_ready = false;
+
+class ControlCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    if (pCharacteristic == NULL) {
+      return;
+    }
+
+    size_t dataLen = pCharacteristic->getLength();
+    if (dataLen < 1) {
+      return;
+    }
+
+    uint8_t *pData = pCharacteristic->getData();
+    switch (pData[0]) {
+      case CONTROL_STOP:
+        m_requestStop = true;
+        break;
+
+      case CONTROL_START:
+        m_requestStart = true;
+        break;
+
+      case CONTROL_ACK:
+        if (dataLen >= CONTROL_ACK_LEN) {
+          uint32_t frame;
+          memcpy(&frame, &(pData[1]), sizeof(frame)); //ESP32 is little endian, same as BLE
+          m_ackFrame = frame;
+          m_ackPending = true;
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+};
+
+static void segmentPath(char *path, uint32_t segment) {
+  snprintf(path, MAX_PATH_LEN, LOG_DIR "/%lu", (unsigned long)segment);
+}
+
+/*
+ * Find oldest and newest segments left from before reset
+ */
+static void findSegments(void) {
+  bool found = false;
+  File dir = LittleFS.open(LOG_DIR);
+  File file = dir.openNextFile();
+  while (file) {
+    uint32_t segment = strtoul(file.name(), NULL, 10);
+    if (!found || (segment < m_firstSegment)) {
+      m_firstSegment = segment;
+    }
+
+    if (!found || (segment > m_lastSegment)) {
+      m_lastSegment = segment;
+      m_lastSegmentSize = file.size();
+    }
+
+    found = true;
+    file.close();
+    file = dir.openNextFile();
+  }
+
+  dir.close();
+}
+
+static void startSegment(void) {
+  m_lastSegment++;
+  m_lastSegmentSize = 0;
+  if (m_lastSegment - m_firstSegment < MAX_SEGMENTS) {
+    return;
+  }
+
+  /*
+   * Log is full, drop the oldest segment even if it hasn't been sent
+   */
+  char path[MAX_PATH_LEN];
+  segmentPath(path, m_firstSegment);
+  LittleFS.remove(path);
+  m_firstSegment++;
+
+  uint64_t firstPos = (uint64_t)m_firstSegment * SEGMENT_SIZE;
+  if (m_ackPos < firstPos) {
+    m_ackPos = firstPos;
+  }
+
+  if (m_sendPos < m_ackPos) {
+    m_sendPos = m_ackPos; //Frames in flight from the dropped segment are acked by position, so can be left to finish
+  }
+}
+
+static void flush(void) {
+  int done = 0;
+  while (done < m_bufferCount) {
+    if (m_lastSegmentSize + RECORD_LEN > SEGMENT_SIZE) {
+      startSegment();
+    }
+
+    int space = (SEGMENT_SIZE - m_lastSegmentSize) / RECORD_LEN;
+    int count = m_bufferCount - done;
+    if (count > space) {
+      count = space;
+    }
+
+    char path[MAX_PATH_LEN];
+    segmentPath(path, m_lastSegment);
+    File file = LittleFS.open(path, FILE_APPEND);
+    if (!file) {
+      ERROR("Cannot open %s", path);
+      break;
+    }
+
+    size_t len = count * RECORD_LEN;
+    size_t written = file.write((const uint8_t *)&(m_buffer[done]), len);
+    file.close();
+    m_lastSegmentSize += written;
+    if (written != len) {
+      ERROR("Failed to write %s", path);
+      break;
+    }
+
+    done += count;
+  }
+
+  m_bufferCount = 0; //Records that could not be written are lost
+  m_lastFlushTime = millis();
+}
+
+static datalog_record_t * addRecord(datalog_type_t type, unsigned long now) {
+  if (m_bufferCount >= BUFFER_RECORDS) {
+    flush();
+  }
+
+  datalog_record_t *pRecord = &(m_buffer[m_bufferCount++]);
+  pRecord->type = (uint8_t)type;
+  pRecord->flags = 0;
+  pRecord->delta = (uint16_t)(now - m_lastRecordTime);
+  m_lastRecordTime = now;
+  m_recordsSinceTime++;
+  return pRecord;
+}
+
+static void writeTime(unsigned long now, uint8_t flags) {
+  m_lastRecordTime = now; //Time record has zero delta
+  datalog_record_t *pRecord = addRecord(datalog_type_time, now);
+  pRecord->flags = flags;
+  pRecord->values[1] = pRecord->values[2] = 0.0f;
+  pRecord->time = (uint32_t)now;
+  m_recordsSinceTime = 0;
+}
+
+bool datalog_init(void) {
+  if (!LittleFS.begin(true)) { //Format on first use
+    ERROR("Cannot mount filesystem");
+    return false;
+  }
+
+  if (!LittleFS.exists(LOG_DIR) && !LittleFS.mkdir(LOG_DIR)) {
+    ERROR("Cannot create log directory");
+    return false;
+  }
+
+  findSegments();
+  m_ackPos = m_sendPos = (uint64_t)m_firstSegment * SEGMENT_SIZE;
+  m_bufferCount = 0;
+  m_lastFlushTime = m_lastStreamTime = m_lastReportTime = millis();
+
+  powermgmt_addSleepCallback(flush); //Keep buffered records when we go to sleep
+  m_recording = !m_connected;
+  writeTime(millis(), DATALOG_FLAG_BOOT);
+  m_ready = true;
+  return true;
+}
+
+bool datalog_addService(BLEServer *pServer) {
+  if (!m_ready) {
+    return false;
+  }
+
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    ERROR("Cannot add BLE service");
+    return false;
+  }
+
+  pService->addCharacteristic(&m_recordsCharacteristic);
+  pService->addCharacteristic(&m_backlogCharacteristic);
+  pService->addCharacteristic(&m_controlCharacteristic);
+  m_controlCharacteristic.setCallbacks(new ControlCallbacks());
+  pService->start();
+  m_pServer = pServer;
+  return true;
+}
+
+static uint64_t getEndPos(void) {
+  return (uint64_t)m_lastSegment * SEGMENT_SIZE + m_lastSegmentSize;
+}
+
+static uint32_t getBacklog(void) {
+  return (uint32_t)((getEndPos() - m_ackPos) / RECORD_LEN);
+}
+
+/*
+ * Fill notifications up to the negotiated MTU
+ */
+static int getFrameRecords(void) {
+  int mtu = m_pServer->getPeerMTU(m_pServer->getConnId());
+  int records = (mtu - ATT_HEADER_LEN - FRAME_HEADER_LEN) / (int)RECORD_LEN;
+  if (records < 1) {
+    return 1;
+  }
+
+  return (records > (int)MAX_FRAME_RECORDS) ? (int)MAX_FRAME_RECORDS : records;
+}
+
+static void notifyFrame(size_t len) {
+  memcpy(m_frame, &m_frameCount, sizeof(m_frameCount)); //ESP32 is little endian, same as BLE
+  m_recordsCharacteristic.setValue(m_frame, FRAME_HEADER_LEN + len);
+  m_recordsWrapper.notify();
+
+  if (m_frameCount == m_ackedFrames) {
+    m_lastAckTime = millis(); //Ack timeout runs from first frame in flight
+  }
+
+  m_frameEnd[m_frameCount % MAX_UNACKED_FRAMES] = m_sendPos;
+  m_frameCount++;
+}
+
+/*
+ * Send next frame of backlog. Returns false when there is nothing left to send
+ */
+static bool sendFrame(void) {
+  char path[MAX_PATH_LEN];
+  while (true) {
+    uint32_t segment = (uint32_t)(m_sendPos / SEGMENT_SIZE);
+    size_t offset = (size_t)(m_sendPos % SEGMENT_SIZE);
+    segmentPath(path, segment);
+    File file = LittleFS.open(path, FILE_READ);
+    size_t size = file ? file.size() : 0;
+    if (offset + RECORD_LEN <= size) {
+      size_t len = (size - offset) / RECORD_LEN;
+      size_t maxRecords = getFrameRecords();
+      len = ((len < maxRecords) ? len : maxRecords) * RECORD_LEN;
+
+      file.seek(offset);
+      size_t read = file.read(&(m_frame[FRAME_HEADER_LEN]), len);
+      file.close();
+      if (read != len) {
+        ERROR("Failed to read %s", path);
+        return false;
+      }
+
+      m_sendPos += len;
+      notifyFrame(len);
+      return true;
+    }
+
+    if (file) {
+      file.close();
+    }
+
+    if (segment >= m_lastSegment) {
+      return false; //Caught up with newest records
+    }
+
+    m_sendPos = (uint64_t)(segment + 1) * SEGMENT_SIZE; //Rest of segment was never written
+  }
+}
+
+/*
+ * Delete segments once every record in them has been acknowledged. Newest segment is kept as it is still being written
+ */
+static void deleteAcked(void) {
+  while ((m_firstSegment < m_lastSegment) && ((uint64_t)(m_firstSegment + 1) * SEGMENT_SIZE <= m_ackPos)) {
+    char path[MAX_PATH_LEN];
+    segmentPath(path, m_firstSegment);
+    LittleFS.remove(path);
+    m_firstSegment++;
+  }
+}
+
+static void startTransfer(void) {
+  m_transferring = true;
+  m_endSent = false;
+  m_sendPos = m_ackPos;
+  m_frameCount = m_ackedFrames = 0;
+  m_lastAckTime = millis();
+}
+
+static void stopTransfer(void) {
+  m_transferring = false;
+  m_sendPos = m_ackPos; //Anything unacknowledged is sent again next time
+}
+
+static void handleAck(uint32_t frame) {
+  uint32_t inFlight = m_frameCount - m_ackedFrames;
+  if (frame - m_ackedFrames >= inFlight) {
+    return; //Not in flight: duplicate, or from an earlier transfer
+  }
+
+  m_ackPos = m_frameEnd[frame % MAX_UNACKED_FRAMES];
+  m_ackedFrames = frame + 1;
+  m_lastAckTime = millis();
+  deleteAcked();
+
+  if (m_endSent && (m_ackedFrames == m_frameCount)) {
+    m_transferring = false; //Client has the whole log
+  }
+}
+
+/*
+ * Go back to the oldest unacknowledged frame if the client has stopped acknowledging
+ */
+static void checkAckTimeout(unsigned long now) {
+  if ((m_frameCount != m_ackedFrames) && (now - m_lastAckTime >= ACK_TIMEOUT)) {
+    m_sendPos = m_ackPos;
+    m_frameCount = m_ackedFrames;
+    m_endSent = false;
+    m_lastAckTime = now;
+  }
+}
+
+static void streamFrames(void) {
+  int i;
+  for (i = 0; i < FRAMES_PER_BURST; i++) {
+    if (m_endSent || (m_frameCount - m_ackedFrames >= MAX_UNACKED_FRAMES)) {
+      return; //Wait for client to catch up
+    }
+
+    if (!sendFrame()) {
+      break;
+    }
+  }
+
+  if ((i < FRAMES_PER_BURST) && (m_frameCount == m_ackedFrames)) {
+    notifyFrame(0); //Everything acknowledged, send end of log
+    m_endSent = true;
+  }
+}
+
+void datalog_loop(void) {
+  PROFILE_ZONE("datalog_loop");
+  if (!m_ready) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if ((m_bufferCount > 0) && (now - m_lastFlushTime >= FLUSH_TIME)) {
+    flush();
+  }
+
+  if (!m_connected || (m_pServer == NULL)) {
+    return;
+  }
+
+  if (m_requestStop) { //Requests from BTC_TASK thread
+    m_requestStop = false;
+    stopTransfer();
+  }
+
+  if (m_requestStart) {
+    m_requestStart = false;
+    m_ackPending = false;
+    startTransfer();
+  }
+
+  if (m_ackPending) {
+    m_ackPending = false;
+    handleAck(m_ackFrame);
+  }
+
+  if (m_transferring && !m_recordsWrapper.isSubscribed()) {
+    stopTransfer(); //Client has gone away without stopping
+  }
+
+  if (m_transferring) {
+    checkAckTimeout(now);
+    if (now - m_lastStreamTime >= STREAM_INTERVAL) {
+      m_lastStreamTime = now;
+      streamFrames();
+    }
+
+    idle_wakeAfter(1000UL * STREAM_INTERVAL); //More to send, or acks to wait for
+  }
+
+  if (now - m_lastReportTime >= REPORT_TIME) {
+    m_lastReportTime = now;
+    m_backlogWrapper.writeValue((float)getBacklog());
+  }
+}
+
+/*
+ * Only record while disconnected. While connected the client gets readings live
+ */
+void datalog_setConnected(bool connected) {
+  m_connected = connected;
+  if (!m_ready) {
+    return;
+  }
+
+  if (connected) {
+    m_recording = false;
+    flush(); //Make everything recorded so far available to send
+  } else {
+    stopTransfer();
+    m_recording = true;
+    writeTime(millis(), 0);
+  }
+}
+
+void datalog_write(datalog_type_t type, float a, float b, float c) {
+  if (!m_ready || !m_recording) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if ((now - m_lastRecordTime > MAX_DELTA) || (m_recordsSinceTime >= TIME_INTERVAL)) {
+    writeTime(now, 0);
+  }
+
+  datalog_record_t *pRecord = addRecord(type, now);
+  pRecord->values[0] = a;
+  pRecord->values[1] = b;
+  pRecord->values[2] = c;
+}
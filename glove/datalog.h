@@ -0,0 +1,49 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __DATALOG_H
+#define __DATALOG_H
+
+#include <stdint.h>
+#include <BLEServer.h>
+
+typedef enum {
+  datalog_type_time = 0,    //Absolute time: millis() at this record, written at start of recording and when delta overflows
+  datalog_type_environment, //Temperature (degC), humidity (%), pressure (Pa)
+  datalog_type_air,         //IAQ, CO2 equivalent (ppm), breath VOC equivalent (ppm)
+  datalog_type_light,       //Illuminance (lux), CCT (K), AS7341 gain
+  datalog_type_orientation, //Pitch, roll, yaw (rad)
+  datalog_type_vibration,   //ahv (m/s^2), A(8) (m/s^2), moving (0 or 1)
+  datalog_type_magnetic,    //Average (uT), AC RMS (uT), peak (uT)
+  datalog_type_battery      //Voltage (V), state of charge (%), remaining runtime (min)
+} datalog_type_t;
+
+#define DATALOG_NUM_VALUES 3
+
+/*
+ * Fixed size record, 16 bytes. Stored and sent in ESP32 (little endian) byte order
+ */
+typedef struct __attribute__((packed)) {
+  uint8_t type;     //datalog_type_t
+  uint8_t flags;    //DATALOG_FLAG_xxx
+  uint16_t delta;   //Milliseconds since previous record
+  union {
+    float values[DATALOG_NUM_VALUES];
+    uint32_t time;  //datalog_type_time only
+  };
+} datalog_record_t;
+
+#define DATALOG_FLAG_BOOT 0x01 //Time record: first record since power on
+
+bool datalog_init(void);
+bool datalog_addService(BLEServer *pServer);
+void datalog_loop(void);
+void datalog_setConnected(bool connected);
+void datalog_write(datalog_type_t type, float a, float b, float c);
+
+#endif /* __DATALOG_H */
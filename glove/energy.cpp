@@ -0,0 +1,182 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module estimates how much of the battery's energy goes to each subsystem, so that we can see which sample rates and features
+ * are worth their cost. Energy is charged to a subsystem for:
+ *
+ *    - CPU time spent in its loop function
+ *    - Each bus transaction or BLE notification it makes, at a fixed cost per operation
+ *    - Time that its supply is switched on (5V boost converter only)
+ *
+ * Costs are estimates and should be calibrated by measuring battery current while each subsystem runs on its own.
+ *
+ * I2C operations are counted by the bus arbiter, once for each bracketed transaction. Register access and FIFO bursts we make
+ * ourselves, and all BSEC traffic (through our own bus callbacks), are one transaction each. A few sensor library calls are
+ * bracketed as one but make several transactions (AS7341 SMUX setup in startReading() and checkReadingProgress(), ENABLE
+ * read-modify-write), so the AS7341 count is a lower bound. Notifications are only charged while a client is connected and
+ * subscribed, as nothing is sent otherwise.
+ */
+
+#define ERR_MODULE_NAME "Energy"
+
+#include <Arduino.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+
+#include "blewrapper.h"
+#include "energy.h"
+#include "profile.h"
+#include "err.h"
+
+#define REPORT_TIME 5000 //milliseconds
+
+#define CPU_ACTIVE_POWER 110.0f //mW, 240MHz with radio idle. Equal to uJ per ms
+#define DCDC_POWER 15.0f //mW, boost converter quiescent plus conversion loss
+
+/*
+ * Energy cost of each operation (uJ), indexed by energy_op_t
+ */
+static const float OP_COST[NUM_ENERGY_OPS] = {
+  5.0f,  //energy_op_i2c: ~100us at 400kHz including sensor read current
+  0.5f,  //energy_op_spi: ~3us at 10MHz
+  30.0f  //energy_op_notify: radio TX and RX window for one packet
+};
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS NUM_ENERGY_SUBSYSTEMS
+
+#define BLE_SERVICE_UUID BLEUUID("0b8a7f6e-2c4d-4e19-a5b3-6d9f1c2e8a47")
+#define ADAF1080_UUID BLEUUID("3f1e9c2a-7b6d-4a58-8e04-b2c7d5f91a36")
+#define AS7341_UUID BLEUUID("8d4b2e6f-1a9c-47e3-b5d0-9c6f3a8e2b71")
+#define BME688_UUID BLEUUID("c7a2f5e8-6d3b-4190-8f2e-1b4d7c9a5e63")
+#define LSM9DS1_UUID BLEUUID("5e9d1b7c-3f8a-4c26-a1e5-7d2b9f4c6a08")
+#define BATTERY_UUID BLEUUID("a1c6e3f9-8b2d-4d75-9e4a-3f7c1b5d8e92")
+#define BLE_UUID BLEUUID("6b3f8d2e-9c1a-4e57-b2d6-8a5e4c7f1b39")
+#define DCDC_UUID BLEUUID("e4d9a7b1-5c2f-4a83-9d6e-2b8f5a1c7d40")
+
+#define ENERGY_FORMAT BLE2904::FORMAT_UINT32
+#define ENERGY_EXPONENT -2
+#define ENERGY_UNIT BLEUnit::Joule
+
+#define ADAF1080_NAME "ADAF1080 energy"
+#define AS7341_NAME "AS7341 energy"
+#define BME688_NAME "BME688 energy"
+#define LSM9DS1_NAME "LSM9DS1 energy"
+#define BATTERY_NAME "Battery monitor energy"
+#define BLE_NAME "Bluetooth energy"
+#define DCDC_NAME "5V boost converter energy"
+
+#define UJ_TO_J 1.0e-6
+
+static BLECharacteristic m_characteristics[NUM_CHARACTERISTICS] = {
+  BLECharacteristic(ADAF1080_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(AS7341_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(BME688_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(LSM9DS1_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(BATTERY_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(BLE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY),
+  BLECharacteristic(DCDC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY)
+};
+
+static BLEWrapper m_wrappers[NUM_CHARACTERISTICS] = {
+  BLEWrapper(&(m_characteristics[0]), ADAF1080_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT),
+  BLEWrapper(&(m_characteristics[1]), AS7341_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT),
+  BLEWrapper(&(m_characteristics[2]), BME688_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT),
+  BLEWrapper(&(m_characteristics[3]), LSM9DS1_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT),
+  BLEWrapper(&(m_characteristics[4]), BATTERY_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT),
+  BLEWrapper(&(m_characteristics[5]), BLE_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT),
+  BLEWrapper(&(m_characteristics[6]), DCDC_NAME, ENERGY_FORMAT, ENERGY_EXPONENT, ENERGY_UNIT)
+};
+
+static double m_energy[NUM_ENERGY_SUBSYSTEMS]; //uJ. Use double precision as this grows over a whole shift
+static bool m_dcdcOn = false;
+static unsigned long m_lastDcdcTime;
+static unsigned long m_lastReportTime;
+static bool m_ready = false;
+
+void energy_init(void) {
+  int i;
+  for (i = 0; i < NUM_ENERGY_SUBSYSTEMS; i++) {
+    m_energy[i] = 0.0;
+  }
+
+  m_lastReportTime = millis();
+  m_ready = true;
+}
+
+bool energy_addService(BLEServer *pServer) {
+  if (!m_ready) {
+    return false;
+  }
+
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    ERROR("Cannot add BLE service");
+    return false;
+  }
+
+  int i;
+  for (i = 0; i < NUM_CHARACTERISTICS; i++) {
+    pService->addCharacteristic(&(m_characteristics[i]));
+  }
+
+  pService->start();
+  return true;
+}
+
+static void updateDcdc(void) {
+  unsigned long now = millis();
+  if (m_dcdcOn) {
+    m_energy[energy_subsystem_dcdc] += (double)DCDC_POWER * (double)(now - m_lastDcdcTime);
+  }
+
+  m_lastDcdcTime = now;
+}
+
+void energy_loop(void) {
+  PROFILE_ZONE("energy_loop");
+  if (!m_ready) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if (now - m_lastReportTime < REPORT_TIME) {
+    return;
+  }
+
+  m_lastReportTime = now;
+  updateDcdc();
+
+  int i;
+  for (i = 0; i < NUM_ENERGY_SUBSYSTEMS; i++) {
+    m_wrappers[i].writeValue(energy_getTotal((energy_subsystem_t)i));
+  }
+}
+
+/*
+ * Duration in microseconds
+ */
+void energy_addActiveTime(energy_subsystem_t subsystem, unsigned long duration) {
+  m_energy[subsystem] += (double)CPU_ACTIVE_POWER * 0.001 * (double)duration;
+}
+
+void energy_addOp(energy_subsystem_t subsystem, energy_op_t op, unsigned int count) {
+  m_energy[subsystem] += (double)OP_COST[op] * (double)count;
+}
+
+void energy_setDcdc(bool on) {
+  updateDcdc(); //Charge time spent in previous state
+  m_dcdcOn = on;
+}
+
+/*
+ * Returns total energy since boot in joules
+ */
+float energy_getTotal(energy_subsystem_t subsystem) {
+  return (float)(m_energy[subsystem] * UJ_TO_J);
+}
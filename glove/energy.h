@@ -0,0 +1,42 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __ENERGY_H
+#define __ENERGY_H
+
+#include <BLEServer.h>
+
+typedef enum {
+  energy_subsystem_adaf1080 = 0,
+  energy_subsystem_as7341,
+  energy_subsystem_bme688,
+  energy_subsystem_lsm9ds1,
+  energy_subsystem_battery,
+  energy_subsystem_ble,
+  energy_subsystem_dcdc
+} energy_subsystem_t;
+
+#define NUM_ENERGY_SUBSYSTEMS 7
+
+typedef enum {
+  energy_op_i2c = 0,  //One I2C transaction (register or block read/write)
+  energy_op_spi,      //One SPI transaction
+  energy_op_notify    //One BLE notification
+} energy_op_t;
+
+#define NUM_ENERGY_OPS 3
+
+void energy_init(void);
+bool energy_addService(BLEServer *pServer);
+void energy_loop(void);
+void energy_addActiveTime(energy_subsystem_t subsystem, unsigned long duration);
+void energy_addOp(energy_subsystem_t subsystem, energy_op_t op, unsigned int count);
+void energy_setDcdc(bool on);
+float energy_getTotal(energy_subsystem_t subsystem);
+
+#endif /* __ENERGY_H */
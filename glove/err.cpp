@@ -4,55 +4,494 @@
  * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
  *
  * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Error messages are often raised from time critical code, so they are not formatted or printed by the caller. Instead err_print() copies
+ * the module name, format string pointer and raw arguments into a fixed size ring buffer. A low priority task drains the ring, formats each
+ * message and prints it to Serial and to the error log characteristic. Nothing is allocated and the caller never waits for the UART.
+ *
+ * The ring is lock free so that messages can be queued from any task. Each slot has a sequence number which tells producers when it is
+ * free and the consumer when it has been filled. If the ring is full the message is dropped and counted.
+ *
+ * Repeated messages from the same format string are rate limited. Messages over the limit are counted, and the count is reported with the
+ * next message that gets through. The rate limiter is not locked, so when two tasks race an extra message may get through.
  */
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
 #include <Arduino.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
 
+#include "blewrapper.h"
 #include "powermgmt.h"
 
 #define ERR_LED_PIN			LED_BUILTIN		//Use default LED pin for now
 #define FLASH_TIME      200           //ms
 
+#define RING_SIZE 32 //Must be a power of 2
+#define MAX_ARGS 4
+#define STRING_BUF_LEN 32 //Space for copies of string arguments, which may not exist by the time the message is printed
+#define MAX_SPEC_LEN 16
+#define LINE_LEN 160
+
+#define RATE_SLOTS 16 //Must be a power of 2
+#define RATE_WINDOW 1000 //ms
+#define RATE_LIMIT 4 //Messages per window from each format string
+
+#define TASK_STACK_SIZE 3072
+#define TASK_PRIORITY tskIDLE_PRIORITY //Below loop task, so messages are only printed when there is nothing else to do
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS 1
+
+#define BLE_SERVICE_UUID BLEUUID("e81c4b7a-3d9f-4a26-b1e8-5c7f2a9d4e13")
+#define LOG_UUID BLEUUID("4a9e2d6c-8f1b-4c73-9a5e-d2b7f1c83e60")
+#define LOG_FORMAT BLE2904::FORMAT_UTF8
+#define LOG_EXPONENT 0
+#define LOG_UNIT BLEUnit::Unitless
+#define LOG_NAME "Error log"
+
+typedef enum {
+  arg_type_int = 0,
+  arg_type_uint,
+  arg_type_double,
+  arg_type_string,
+  arg_type_pointer
+} arg_type_t;
+
+typedef struct {
+  const char *module;
+  const char *format;
+  unsigned long time;
+  uint16_t suppressed; //Messages from same format string dropped by rate limiter since last one printed
+  bool halt;
+  union {
+    long long i;
+    unsigned long long u;
+    double d;
+    uint8_t stringOffset;
+    const void *p;
+  } args[MAX_ARGS];
+  char strings[STRING_BUF_LEN];
+} err_entry_t;
+
+typedef struct {
+  std::atomic<uint32_t> seq;
+  err_entry_t entry;
+} err_slot_t;
+
+typedef struct {
+  std::atomic<const char *> format;
+  std::atomic<unsigned long> windowStart;
+  std::atomic<uint16_t> count;
+  std::atomic<uint16_t> suppressed;
+} rate_slot_t;
+
+static BLECharacteristic m_logCharacteristic(LOG_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_logWrapper(&m_logCharacteristic, LOG_NAME, LOG_FORMAT, LOG_EXPONENT, LOG_UNIT);
+static bool m_bleReady = false;
+
+static err_slot_t m_ring[RING_SIZE];
+static std::atomic<uint32_t> m_head(0); //Next slot to fill
+static uint32_t m_tail = 0; //Next slot to print. Only used by drain task
+static std::atomic<uint32_t> m_dropped(0);
+static rate_slot_t m_rateSlots[RATE_SLOTS];
+
+static TaskHandle_t m_drainTask = NULL;
+static char m_line[LINE_LEN]; //Only used by drain task
+
+/*
+ * Step over flags, width, precision and length modifiers of a conversion specification. Returns pointer to the conversion character
+ */
+static const char * skipSpec(const char *p) {
+  while ((*p != '\0') && (strchr("-+ #0123456789.hlzjtL", *p) != NULL)) {
+    p++;
+  }
+
+  return p;
+}
+
+static bool getArgType(char conversion, arg_type_t *pType) {
+  switch (conversion) {
+    case 'd':
+    case 'i':
+    case 'c':
+      *pType = arg_type_int;
+      return true;
+
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      *pType = arg_type_uint;
+      return true;
+
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+      *pType = arg_type_double;
+      return true;
+
+    case 's':
+      *pType = arg_type_string;
+      return true;
+
+    case 'p':
+      *pType = arg_type_pointer;
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/*
+ * Length modifier tells us what the caller actually passed. Everything shorter than int is promoted to int
+ */
+static bool isLongLong(const char *spec, const char *conversion) {
+  return (conversion - spec >= 2) && (conversion[-1] == 'l') && (conversion[-2] == 'l');
+}
+
+static bool isLong(const char *spec, const char *conversion) {
+  return (conversion - spec >= 1) && ((conversion[-1] == 'l') || (conversion[-1] == 'z') || (conversion[-1] == 't'));
+}
+
+static void captureArgs(err_entry_t *pEntry, const char *format, va_list args) {
+  int numArgs = 0;
+  int stringLen = 0;
+  const char *p = format;
+  while ((*p != '\0') && (numArgs < MAX_ARGS)) {
+    if (*p++ != '%') {
+      continue;
+    }
+
+    if (*p == '%') {
+      p++;
+      continue;
+    }
+
+    const char *spec = p;
+    const char *conversion = skipSpec(p);
+    arg_type_t type;
+    if (!getArgType(*conversion, &type)) {
+      break; //Unsupported conversion, remaining arguments are not captured
+    }
+
+    switch (type) {
+      case arg_type_int:
+        if (isLongLong(spec, conversion)) {
+          pEntry->args[numArgs].i = va_arg(args, long long);
+        } else if (isLong(spec, conversion)) {
+          pEntry->args[numArgs].i = va_arg(args, long);
+        } else {
+          pEntry->args[numArgs].i = va_arg(args, int);
+        }
+        break;
+
+      case arg_type_uint:
+        if (isLongLong(spec, conversion)) {
+          pEntry->args[numArgs].u = va_arg(args, unsigned long long);
+        } else if (isLong(spec, conversion)) {
+          pEntry->args[numArgs].u = va_arg(args, unsigned long);
+        } else {
+          pEntry->args[numArgs].u = va_arg(args, unsigned int);
+        }
+        break;
+
+      case arg_type_double:
+        pEntry->args[numArgs].d = va_arg(args, double);
+        break;
+
+      case arg_type_string: {
+        const char *str = va_arg(args, const char *);
+        if (str == NULL) {
+          str = "(null)";
+        }
+
+        int space = STRING_BUF_LEN - stringLen - 1;
+        if (space < 0) {
+          pEntry->args[numArgs].stringOffset = STRING_BUF_LEN - 1; //Buffer full, point at terminator of previous string
+          break;
+        }
+
+        int len = strnlen(str, space); //Truncate to fit
+        memcpy(&(pEntry->strings[stringLen]), str, len);
+        pEntry->strings[stringLen + len] = '\0';
+        pEntry->args[numArgs].stringOffset = stringLen;
+        stringLen += len + 1;
+        break;
+      }
+
+      case arg_type_pointer:
+        pEntry->args[numArgs].p = va_arg(args, const void *);
+        break;
+    }
+
+    numArgs++;
+    p = conversion + 1;
+  }
+}
+
+/*
+ * Returns number of messages suppressed since the last one from this format string, or -1 if this message should be suppressed
+ */
+static int checkRate(const char *format, unsigned long now) {
+  rate_slot_t *pSlot = &(m_rateSlots[((uintptr_t)format >> 2) & (RATE_SLOTS - 1)]);
+  if ((pSlot->format.load() != format) || (now - pSlot->windowStart.load() >= RATE_WINDOW)) {
+    pSlot->format.store(format); //New window. Different format strings that share a slot just reset each other's count
+    pSlot->windowStart.store(now);
+    pSlot->count.store(1);
+    return pSlot->suppressed.exchange(0);
+  }
+
+  if (pSlot->count.fetch_add(1) >= RATE_LIMIT) {
+    pSlot->suppressed.fetch_add(1);
+    return -1;
+  }
+
+  return pSlot->suppressed.exchange(0);
+}
+
+static bool push(bool halt, const char *module, const char *format, va_list args) {
+  unsigned long now = millis();
+  int suppressed = 0;
+  if (!halt) {
+    suppressed = checkRate(format, now);
+    if (suppressed < 0) {
+      return true;
+    }
+  }
+
+  /*
+   * Claim a slot. Slot is free when its sequence number equals the position we want to write
+   */
+  uint32_t pos = m_head.load(std::memory_order_relaxed);
+  err_slot_t *pSlot;
+  while (true) {
+    pSlot = &(m_ring[pos & (RING_SIZE - 1)]);
+    int32_t diff = (int32_t)(pSlot->seq.load(std::memory_order_acquire) - pos);
+    if (diff == 0) {
+      if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed); //Ring is full
+      return false;
+    } else {
+      pos = m_head.load(std::memory_order_relaxed); //Another task claimed this slot first
+    }
+  }
+
+  err_entry_t *pEntry = &(pSlot->entry);
+  pEntry->module = module;
+  pEntry->format = format;
+  pEntry->time = now;
+  pEntry->suppressed = (uint16_t)suppressed;
+  pEntry->halt = halt;
+  captureArgs(pEntry, format, args);
+  pSlot->seq.store(pos + 1, std::memory_order_release); //Hand over to drain task
+
+  if (m_drainTask != NULL) {
+    if (xPortInIsrContext()) {
+      vTaskNotifyGiveFromISR(m_drainTask, NULL);
+    } else {
+      xTaskNotifyGive(m_drainTask);
+    }
+  }
+
+  return true;
+}
+
+static int formatArg(char *buf, int size, const char *spec, const char *conversion, const err_entry_t *pEntry, int argIndex, arg_type_t type) {
+  char specBuf[MAX_SPEC_LEN];
+  int specLen = conversion - spec;
+  while ((specLen > 0) && (strchr("hlzjtL", spec[specLen - 1]) != NULL)) {
+    specLen--; //Length modifier is replaced below to match how the argument was stored
+  }
+
+  if (specLen > MAX_SPEC_LEN - 5) {
+    specLen = MAX_SPEC_LEN - 5;
+  }
+
+  specBuf[0] = '%';
+  memcpy(&(specBuf[1]), spec, specLen);
+  char *pEnd = &(specBuf[1 + specLen]);
+  if ((type == arg_type_int) || (type == arg_type_uint)) {
+    if (*conversion != 'c') {
+      *pEnd++ = 'l';
+      *pEnd++ = 'l';
+    }
+  }
+
+  *pEnd++ = *conversion;
+  *pEnd = '\0';
+
+  switch (type) {
+    case arg_type_int:
+      if (*conversion == 'c') {
+        return snprintf(buf, size, specBuf, (int)pEntry->args[argIndex].i);
+      }
+      return snprintf(buf, size, specBuf, pEntry->args[argIndex].i);
+
+    case arg_type_uint:
+      return snprintf(buf, size, specBuf, pEntry->args[argIndex].u);
+
+    case arg_type_double:
+      return snprintf(buf, size, specBuf, pEntry->args[argIndex].d);
+
+    case arg_type_string:
+      return snprintf(buf, size, specBuf, &(pEntry->strings[pEntry->args[argIndex].stringOffset]));
+
+    case arg_type_pointer:
+      return snprintf(buf, size, specBuf, pEntry->args[argIndex].p);
+
+    default:
+      return 0;
+  }
+}
+
+static void formatEntry(const err_entry_t *pEntry) {
+  int len = snprintf(m_line, LINE_LEN, "%s: ", pEntry->module);
+  int numArgs = 0;
+  const char *p = pEntry->format;
+  while ((*p != '\0') && (len < LINE_LEN - 1)) {
+    if ((*p != '%') || (p[1] == '%')) {
+      m_line[len++] = *p;
+      p += (*p == '%') ? 2 : 1;
+      continue;
+    }
+
+    p++;
+    const char *conversion = skipSpec(p);
+    arg_type_t type;
+    if ((numArgs >= MAX_ARGS) || !getArgType(*conversion, &type)) {
+      break; //Argument was not captured
+    }
+
+    int n = formatArg(&(m_line[len]), LINE_LEN - len, p, conversion, pEntry, numArgs++, type);
+    if (n > 0) {
+      len += n;
+    }
+
+    p = conversion + 1;
+  }
+
+  if (len > LINE_LEN - 1) {
+    len = LINE_LEN - 1;
+  }
+
+  m_line[len] = '\0';
+}
+
+static void printLine(const char *line) {
+  Serial.println(line);
+  if (m_bleReady && m_logWrapper.isSubscribed()) {
+    m_logCharacteristic.setValue((uint8_t *)line, strlen(line));
+    m_logCharacteristic.notify();
+  }
+}
+
+static void drain(void) {
+  char note[48];
+  while (true) {
+    err_slot_t *pSlot = &(m_ring[m_tail & (RING_SIZE - 1)]);
+    if (pSlot->seq.load(std::memory_order_acquire) != m_tail + 1) {
+      break; //Empty, or producer still writing this slot
+    }
+
+    formatEntry(&(pSlot->entry));
+    uint16_t suppressed = pSlot->entry.suppressed;
+    bool halt = pSlot->entry.halt;
+    pSlot->seq.store(m_tail + RING_SIZE, std::memory_order_release); //Slot is free again once a full lap behind
+    m_tail++;
+
+    printLine(m_line);
+    if (suppressed > 0) {
+      snprintf(note, sizeof(note), "ERR: %u similar messages suppressed", suppressed);
+      printLine(note);
+    }
+
+    if (halt) {
+      printLine("Halting!");
+    }
+  }
+
+  uint32_t dropped = m_dropped.exchange(0);
+  if (dropped > 0) {
+    snprintf(note, sizeof(note), "ERR: %lu messages dropped, log full", (unsigned long)dropped);
+    printLine(note);
+  }
+}
+
+static void drainTask(void *pParam) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    drain();
+  }
+}
+
 void err_init(void) {
   digitalWrite(ERR_LED_PIN, LOW);
 	pinMode(ERR_LED_PIN, OUTPUT);
+
+  int i;
+  for (i = 0; i < RING_SIZE; i++) {
+    m_ring[i].seq.store(i);
+  }
+
+  if (xTaskCreate(drainTask, "err", TASK_STACK_SIZE, NULL, TASK_PRIORITY, &m_drainTask) != pdPASS) {
+    m_drainTask = NULL; //Messages will be queued but not printed
+  }
 }
 
-static void innerPrint(bool halt, const char *module, const char *message) {
-	Serial.print(module);
-	Serial.print(": ");
-	Serial.println(message);
-	
-	if (halt) {
-    unsigned long lastTime = 0;
-    bool state = HIGH;
-		Serial.println("Halting!");
-
-		while (1) {
-      unsigned long now = millis();
-      if (now - lastTime >= FLASH_TIME) {
-  			digitalWrite(ERR_LED_PIN, state); //Flash LED
-        state = !state;
-        lastTime = now;
-      }
+bool err_addService(BLEServer *pServer) {
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    return false;
+  }
 
-      powermgmt_loop(); //Continue to monitor power button
-		}
-	}
+  pService->addCharacteristic(&m_logCharacteristic);
+  pService->start();
+  m_bleReady = true;
+  return true;
+}
+
+static void haltLoop(void) {
+  unsigned long lastTime = 0;
+  bool state = HIGH;
+  while (1) {
+    unsigned long now = millis();
+    if (now - lastTime >= FLASH_TIME) {
+      digitalWrite(ERR_LED_PIN, state); //Flash LED
+      state = !state;
+      lastTime = now;
+    }
+
+    powermgmt_loop(); //Continue to monitor power button
+    delay(1); //Let drain task print the error
+  }
 }
 
 void err_print(bool halt, const char *module, const char *message, ...) {
 	va_list args;
 	va_start(args, message);
-	
-	int len = vsnprintf(NULL, 0, message, args) + 1; //Leave space for null terminator
-	char *buffer = (char *)malloc(len);
-	if (buffer == NULL) {
-		innerPrint(true, "ERR", "An error occured while allocating memory to print a previous error message");
-	} else {
-		vsnprintf(buffer, len, message, args);
-		innerPrint(halt, module, buffer);
-		free(buffer);
+	bool queued = push(halt, module, message, args);
+	va_end(args);
+
+	if (halt) {
+    if (!queued) {
+      Serial.print(module); //Make sure reason for halting is seen, even if log is full
+      Serial.print(": ");
+      Serial.println(message);
+      Serial.println("Halting!");
+    }
+
+    haltLoop();
 	}
 }
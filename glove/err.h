@@ -13,10 +13,13 @@
 	#error "ERR_MODULE_NAME is not defined"
 #endif /* ERR_MODULE_NAME */
 
+#include <BLEServer.h>
+
 #define ERROR(x, ...)		err_print(false, ERR_MODULE_NAME, (x), ##__VA_ARGS__)
 #define ERROR_HALT(x, ...)	err_print(true, ERR_MODULE_NAME, (x), ##__VA_ARGS__)
 
 void err_init(void);
 void err_print(bool halt, const char *module, const char *message, ...);
+bool err_addService(BLEServer *pServer);
 
 #endif /* __ERR_H */
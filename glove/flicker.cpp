@@ -0,0 +1,76 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module analyses a burst of AS7341 flicker channel samples to find mains-related flicker and classify the light source.
+ *
+ * We only care about four frequencies (50, 60, 100 and 120Hz), so we use the Goertzel algorithm rather than a full FFT. This costs one
+ * multiply-accumulate per sample per frequency and needs no buffer beyond the raw samples.
+ *
+ * Modulation depth is the amplitude of each frequency component as a percentage of the average (DC) light level.
+ */
+
+#include <math.h>
+
+#include "flicker.h"
+
+static const float FLICKER_FREQS[FLICKER_NUM_FREQS] = { 50.0f, 60.0f, 100.0f, 120.0f };
+
+#define MIN_LEVEL 4.0f //ADC counts, below this it is too dark to classify
+#define STEADY_MAX_DEPTH 3.0f //%, below this light is considered steady
+#define THERMAL_MAX_DEPTH 20.0f //%, filament thermal inertia limits flicker of incandescent lamps
+#define THERMAL_NIR_RATIO 0.5f //NIR / Clear ratio above which the source has a strong infrared component
+
+static float goertzel(const uint16_t *samples, int nSamples, float mean, float coeff) {
+  float s1 = 0.0f, s2 = 0.0f;
+  int i;
+  for (i = 0; i < nSamples; i++) {
+    float s0 = ((float)samples[i] - mean) + coeff * s1 - s2; //Remove DC first to keep accumulators small
+    s2 = s1;
+    s1 = s0;
+  }
+
+  float power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+  return sqrtf((power > 0.0f) ? power : 0.0f);
+}
+
+void flicker_analyse(const uint16_t *samples, int nSamples, float sampleRate, float nirRatio, flicker_t *pResult) {
+  float sum = 0.0f;
+  int i;
+  for (i = 0; i < nSamples; i++) {
+    sum += (float)samples[i];
+  }
+
+  float mean = sum / (float)nSamples;
+  pResult->frequency = 0.0f;
+  pResult->maxDepth = 0.0f;
+
+  for (i = 0; i < FLICKER_NUM_FREQS; i++) {
+    float coeff = 2.0f * cosf(2.0f * (float)M_PI * FLICKER_FREQS[i] / sampleRate);
+    float magnitude = goertzel(samples, nSamples, mean, coeff);
+    float amplitude = 2.0f * magnitude / (float)nSamples; //Goertzel magnitude of a sine with amplitude A is A * N / 2
+    pResult->depth[i] = (mean > 0.0f) ? (100.0f * amplitude / mean) : 0.0f;
+
+    if (pResult->depth[i] > pResult->maxDepth) {
+      pResult->maxDepth = pResult->depth[i];
+      pResult->frequency = FLICKER_FREQS[i];
+    }
+  }
+
+  if (mean < MIN_LEVEL) {
+    pResult->source = light_source_unknown;
+    pResult->frequency = 0.0f;
+  } else if (pResult->maxDepth < STEADY_MAX_DEPTH) {
+    pResult->source = light_source_steady;
+    pResult->frequency = 0.0f;
+  } else if ((pResult->maxDepth < THERMAL_MAX_DEPTH) && (nirRatio > THERMAL_NIR_RATIO)) {
+    pResult->source = light_source_thermal;
+  } else if ((pResult->frequency == 50.0f) || (pResult->frequency == 100.0f)) {
+    pResult->source = light_source_mains_50hz;
+  } else {
+    pResult->source = light_source_mains_60hz;
+  }
+}
@@ -0,0 +1,33 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __FLICKER_H
+#define __FLICKER_H
+
+#include <stdint.h>
+
+typedef enum {
+  light_source_unknown = 0, //Too dark to classify
+  light_source_steady,      //No flicker, e.g. daylight or DC driven LED
+  light_source_thermal,     //Shallow mains flicker with strong NIR, e.g. incandescent or halogen
+  light_source_mains_50hz,  //Fluorescent or LED lighting on 50Hz grid
+  light_source_mains_60hz   //Fluorescent or LED lighting on 60Hz grid
+} light_source_t;
+
+#define FLICKER_NUM_FREQS 4
+
+typedef struct {
+  float depth[FLICKER_NUM_FREQS]; //Modulation depth (%) at 50, 60, 100 and 120Hz
+  float frequency; //Dominant flicker frequency (Hz), or 0 if none
+  float maxDepth; //Modulation depth at dominant frequency (%)
+  light_source_t source;
+} flicker_t;
+
+void flicker_analyse(const uint16_t *samples, int nSamples, float sampleRate, float nirRatio, flicker_t *pResult);
+
+#endif /* __FLICKER_H */
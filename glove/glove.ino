@@ -8,7 +8,6 @@
 
 #define ERR_MODULE_NAME "Core"
 
-#include <Wire.h>
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
@@ -16,20 +15,94 @@
 
 #include "err.h"
 #include "i2c_address.h"
+#include "blewrapper.h"
 #include "powermgmt.h"
 #include "battery.h"
 #include "bme688.h"
 #include "as7341.h"
 #include "lsm9ds1.h"
 #include "adaf1080.h"
+#include "activity.h"
+#include "energy.h"
+#include "idle.h"
+#include "retained.h"
+#include "datalog.h"
+#include "i2cbus.h"
+#include "timebase.h"
+#include "config.h"
+#include "trace.h"
+#include "bench.h"
+#include "profile.h"
 
 #define PRINT_INTERVAL 1000000 //1 second in us
 #define BAUD_RATE			 115200
 
 #define BLE_SERVER_NAME		"SmartGlove"
 
+#define RETRY_MIN_TIME 1000 //ms, first retry after a sensor fails
+#define RETRY_MAX_TIME 300000 //ms, retry interval doubles after each failure up to this limit
+#define BUS_CHECK_TIME 1000 //ms
+
+/*
+ * Sensors are brought up one at a time from loop(), after advertising has started. This means the glove is visible straight away,
+ * and sensors that are already running are serviced while the others start up. Every sensor's service is created in setup(), before
+ * advertising, so a client that connects early sees the full attribute table.
+ *
+ * This only changes the order of bring-up, not how long each step takes. Each init still runs to completion in one loop iteration:
+ * the Adafruit begin() calls and Bsec2 begin() are library code that does its own probe round trips, and the ADAF1080 checks its config
+ * with a write and read back. Splitting these into polled steps would mean forking the libraries, for a one-off cost of tens of ms per
+ * sensor. The one long wait, the ADAF1080 boost converter start-up, is taken out of init by its canInit() hook.
+ *
+ * Sensors that fail to start, or stop responding later, are re-initialised in the background with exponential backoff. They carry on
+ * notifying through the same characteristics when they come back.
+ */
+typedef enum {
+  sensor_state_waiting = 0,
+  sensor_state_ready,
+  sensor_state_failed
+} sensor_state_t;
+
+#define NO_BUS_DEVICE -1
+
+typedef struct {
+  const char *name;
+  int busDevice; //i2cbus_device_t, or NO_BUS_DEVICE if sensor is not on I2C bus
+  bool (*canInit)(void); //Returns true when dependencies are met, or NULL if there are none
+  bool (*init)(void);
+  bool (*addService)(BLEServer *pServer);
+  void (*loop)(void);
+  energy_subsystem_t subsystem;
+  sensor_state_t state;
+  unsigned long retryTime;
+  unsigned long retryInterval;
+} sensor_t;
+
+static bool initBme688(void);
+static bool initAs7341(void);
+
+typedef enum {
+  sensor_bme688 = 0,
+  sensor_as7341,
+  sensor_lsm9ds1,
+  sensor_adaf1080
+} sensor_index_t;
+
+#define NUM_SENSORS 4
+static sensor_t m_sensors[NUM_SENSORS] = {
+  { "BME688", i2cbus_device_bme688, NULL, initBme688, bme688_addService, bme688_loop, energy_subsystem_bme688, sensor_state_waiting, 0, RETRY_MIN_TIME },
+  { "AS7341", i2cbus_device_as7341, NULL, initAs7341, as7341_addService, as7341_loop, energy_subsystem_as7341, sensor_state_waiting, 0, RETRY_MIN_TIME },
+  { "LSM9DS1", i2cbus_device_lsm9ds1, NULL, lsm9ds1_init, lsm9ds1_addService, lsm9ds1_loop, energy_subsystem_lsm9ds1, sensor_state_waiting, 0, RETRY_MIN_TIME },
+  { "ADAF1080", NO_BUS_DEVICE, adaf1080_canInit, adaf1080_init, adaf1080_addService, adaf1080_loop, energy_subsystem_adaf1080, sensor_state_waiting, 0, RETRY_MIN_TIME } //Waits for 5V boost converter to start
+};
+
+static BLEServer *m_pServer = NULL;
+static bool m_bringupDone = false;
+static unsigned long m_lastBusCheckTime = 0;
+
 static BLEAdvertising *pAdvert = NULL;
-static bool m_deviceConnected = false;
+static volatile bool m_deviceConnected = false;
+static bool m_wasConnected = false;
+static bool m_bootTimeReported = false;
 
 static unsigned long m_lastLoopTime;
 static unsigned long m_lastPrintTime;
@@ -41,11 +114,13 @@ static unsigned long m_numIterations;
 class MyServerCallbacks: public BLEServerCallbacks {
 	void onConnect(BLEServer *pServer) {
 		m_deviceConnected = true;
+		BLEWrapper::setConnected(true);
 		Serial.println("Client connected");
 	}
 	
 	void onDisconnect(BLEServer *pServer) {
 		m_deviceConnected = false;
+		BLEWrapper::setConnected(false);
 		Serial.println("Client disconnected");
     if (pAdvert != NULL) {
       pAdvert->start(); //Resume advertising for next client
@@ -53,11 +128,150 @@ class MyServerCallbacks: public BLEServerCallbacks {
 	}
 };
 
+/*
+ * Run a module's loop function and charge the CPU time to its energy budget
+ */
+static void runModule(void (*loopFunc)(void), energy_subsystem_t subsystem) {
+  unsigned long start = micros();
+  loopFunc();
+  energy_addActiveTime(subsystem, micros() - start);
+}
+
+static bool initBme688(void) {
+  if (!bme688_init(i2c_address_bme688)) {
+    return false;
+  }
+
+  bme688_setLowPower(!m_wasConnected); //Client may have connected while sensor was starting up
+  return true;
+}
+
+static bool initAs7341(void) {
+  return as7341_init(i2c_address_as7341);
+}
+
+static void setFailed(sensor_t *pSensor) {
+  pSensor->state = sensor_state_failed;
+  pSensor->retryTime = millis() + pSensor->retryInterval;
+  ERROR("%s failed, retrying in %lums", pSensor->name, pSensor->retryInterval);
+
+  pSensor->retryInterval *= 2;
+  if (pSensor->retryInterval > RETRY_MAX_TIME) {
+    pSensor->retryInterval = RETRY_MAX_TIME;
+  }
+}
+
+static void startSensor(sensor_t *pSensor) {
+  bool ok = pSensor->init();
+  i2cbus_checkClock(); //Library may have reset bus clock
+  if (!ok) {
+    setFailed(pSensor);
+    return;
+  }
+
+  pSensor->state = sensor_state_ready;
+  pSensor->retryInterval = RETRY_MIN_TIME;
+  if (pSensor->busDevice != NO_BUS_DEVICE) {
+    i2cbus_resetErrors((i2cbus_device_t)pSensor->busDevice);
+  }
+
+  Serial.print(pSensor->name);
+  Serial.print(" ready after ");
+  Serial.print(millis());
+  Serial.println("ms");
+}
+
+/*
+ * A device holding SDA low blocks every other device, so check the bus is idle and clear it if not
+ */
+static void checkBus(void) {
+  unsigned long now = millis();
+  if (now - m_lastBusCheckTime < BUS_CHECK_TIME) {
+    return;
+  }
+
+  m_lastBusCheckTime = now;
+  if (i2cbus_isHung()) {
+    ERROR("I2C bus hung, attempting recovery");
+    if (!i2cbus_recover()) {
+      ERROR("I2C bus recovery failed");
+    }
+  }
+}
+
+/*
+ * Start sensors that are waiting or due a retry, and take sensors that have stopped responding out of service.
+ * Only one sensor is started per loop iteration
+ */
+static void superviseSensors(void) {
+  checkBus();
+
+  bool pending = false;
+  unsigned long now = millis();
+  int i;
+  for (i = 0; i < NUM_SENSORS; i++) {
+    sensor_t *pSensor = &(m_sensors[i]);
+    if (pSensor->state == sensor_state_ready) {
+      if ((pSensor->busDevice != NO_BUS_DEVICE) && i2cbus_hasFailed((i2cbus_device_t)pSensor->busDevice)) {
+        setFailed(pSensor);
+        i2cbus_recover(); //Sensor may have been reset in the middle of a read
+      }
+
+      continue;
+    }
+
+    if ((pSensor->state == sensor_state_failed) && ((long)(now - pSensor->retryTime) < 0)) {
+      continue;
+    }
+
+    if ((pSensor->canInit != NULL) && !pSensor->canInit()) {
+      if (pSensor->state == sensor_state_waiting) {
+        pending = true; //Dependency not met yet, carry on with other sensors
+      }
+
+      continue;
+    }
+
+    startSensor(pSensor);
+    return;
+  }
+
+  if (!m_bringupDone && !pending) {
+    m_bringupDone = true;
+    Serial.print("Sensor bring-up complete after ");
+    Serial.print(millis());
+    Serial.println("ms");
+  }
+}
+
+/*
+ * Run sensor's loop function if it is working
+ */
+static void runSensor(sensor_index_t index) {
+  sensor_t *pSensor = &(m_sensors[index]);
+  if (pSensor->state == sensor_state_ready) {
+    runModule(pSensor->loop, pSensor->subsystem);
+  }
+}
+
 static void resetLoopStats(void) {
   m_minLoopLength = UINT32_MAX;
   m_maxLoopLength = 0;
   m_avgLoopLength = 0;
   m_numIterations = 0;
+  idle_resetStats();
+  i2cbus_resetStats();
+}
+
+/*
+ * Time from boot (or wake) to first notification, to measure benefit of retained state
+ */
+static void printBootTime(void) {
+  Serial.print("Boot to first notification: ");
+  Serial.print(BLEWrapper::getFirstNotifyTime());
+  Serial.print("ms (");
+  Serial.print((esp_reset_reason() == ESP_RST_DEEPSLEEP) ? "wake from sleep" : "cold boot");
+  Serial.println(")");
 }
 
 static void printLoopStats(void) {
@@ -68,65 +282,94 @@ static void printLoopStats(void) {
   Serial.print(m_maxLoopLength);
   Serial.print("us, avg = ");
   Serial.print(avg);
-  Serial.println("us");
+  Serial.print("us, duty cycle = ");
+  Serial.print(idle_getDutyCycle(), 1);
+  Serial.println("%");
+
+  Serial.print("Activity dwell: moving = ");
+  Serial.print(activity_getDwellTime(activity_profile_moving) / 1000);
+  Serial.print("s, still = ");
+  Serial.print(activity_getDwellTime(activity_profile_still) / 1000);
+  Serial.println("s");
+
+  Serial.print("I2C bus: BME688 = ");
+  Serial.print(i2cbus_getUtilisation(i2cbus_device_bme688), 1);
+  Serial.print("%, AS7341 = ");
+  Serial.print(i2cbus_getUtilisation(i2cbus_device_as7341), 1);
+  Serial.print("%, LSM9DS1 = ");
+  Serial.print(i2cbus_getUtilisation(i2cbus_device_lsm9ds1), 1);
+  Serial.print("%, deferred ");
+  Serial.print(i2cbus_getDeferrals());
+  Serial.println(" times");
 }
 
 void setup(void) {
 	err_init(); //Set up error LED pin
 	Serial.begin(BAUD_RATE);
-	Wire.begin();
+	i2cbus_init();
 	
+  retained_init();
+  config_init(); //Before any module that reads parameters
+  trace_init(); //Replay builds replay here and never return. Record builds must start before battery_init() takes its first reading
+  energy_init();
+  idle_init();
   powermgmt_init();
   battery_init();
-
-	int nSensors = 0;
-	if (bme688_init(i2c_address_bme688)) {
-		nSensors++;
-	}
-  if (as7341_init(i2c_address_as7341)) {
-    nSensors++;
-  }
-  if (lsm9ds1_init()) {
-    nSensors++;
-  }
-  if (adaf1080_init()) {
-    nSensors++;
-  }
-
-	if (nSensors == 0) {
-		ERROR_HALT("Failed to initialise any sensors");
-	}
+  datalog_init();
+  timebase_init();
+  profile_init();
 	
 	BLEDevice::init(BLE_SERVER_NAME);
-	BLEServer *pServer = BLEDevice::createServer();
-	if (pServer == NULL) {
+	m_pServer = BLEDevice::createServer();
+	if (m_pServer == NULL) {
 		ERROR_HALT("Failed to create BLE server");
 	}
 	
-	pServer->setCallbacks(new MyServerCallbacks());
-  if (!battery_addService(pServer)) {
+	m_pServer->setCallbacks(new MyServerCallbacks());
+  if (!battery_addService(m_pServer)) {
     ERROR("Failed to add battery monitor service");
   }
-	if (!bme688_addService(pServer)) {
-		ERROR("Failed to add BME688 service");
-	}
-  if (!as7341_addService(pServer)) {
-    ERROR("Failed to add AS7341 service");
+  if (!energy_addService(m_pServer)) {
+    ERROR("Failed to add energy monitor service");
+  }
+  if (!datalog_addService(m_pServer)) {
+    ERROR("Failed to add data log service");
   }
-  if (!lsm9ds1_addService(pServer)) {
-    ERROR("Failed to add LSM9DS1 service");
+  if (!err_addService(m_pServer)) {
+    ERROR("Failed to add error log service");
   }
-  if (!adaf1080_addService(pServer)) {
-    ERROR("Failed to add ADAF1080 service");
+  if (!timebase_addService(m_pServer)) {
+    ERROR("Failed to add time sync service");
   }
+  if (!config_addService(m_pServer)) {
+    ERROR("Failed to add configuration service");
+  }
+  if (!profile_addService(m_pServer)) {
+    ERROR("Failed to add profiler service");
+  }
+
+  /*
+   * Sensors start later from the loop, but their services must all exist before advertising. Clients cache the attribute table,
+   * and we don't send Service Changed, so a service added after a client has connected would never be found
+   */
+  int i;
+  for (i = 0; i < NUM_SENSORS; i++) {
+    if (!m_sensors[i].addService(m_pServer)) {
+      ERROR("Failed to add %s service", m_sensors[i].name);
+    }
+  }
+
+  bench_init(m_pServer); //Benchmark builds run benchmarks here and never return
 	
-	pAdvert = pServer->getAdvertising();
+	pAdvert = m_pServer->getAdvertising();
 	if (pAdvert == NULL) {
 		ERROR_HALT("Failed to start advertising BLE services");
 	}
 	
 	pAdvert->start();
-	Serial.println("Waiting for client");
+  Serial.print("Advertising after ");
+  Serial.print(millis());
+  Serial.println("ms, waiting for client");
 
   resetLoopStats();
   m_lastLoopTime = m_lastPrintTime = micros();
@@ -134,22 +377,40 @@ void setup(void) {
 
 void loop(void) {
   powermgmt_loop();
-  
-	if (m_deviceConnected) {
-    adaf1080_loop(); //Call adaf1080_loop() between each other sensor as ADAF1080 has faster readout requirement
-    battery_loop();
-    
-    adaf1080_loop();
-		bme688_loop();
 
-    adaf1080_loop();
-    as7341_loop();
+  bool connected = m_deviceConnected;
+  if (connected != m_wasConnected) {
+    m_wasConnected = connected;
+    bme688_setLowPower(!connected);
+    battery_setConnected(connected);
+    datalog_setConnected(connected);
+    timebase_setConnected(connected);
+  }
 
-    adaf1080_loop();
-    lsm9ds1_loop();
+  superviseSensors();
+  if (!m_bringupDone) {
+    idle_wakeAfter(0); //Don't sleep until all sensors have been tried
+  }
 
-    adaf1080_loop();
-	}
+  runSensor(sensor_bme688); //Environmental sensing runs regardless of connection state to keep BSEC baseline tracking going
+  runModule(battery_loop, energy_subsystem_battery); //Battery monitoring also runs all the time, so consumption is integrated while disconnected
+  energy_loop();
+  datalog_loop();
+  timebase_loop();
+  trace_loop();
+  profile_loop();
+  config_loop();
+
+  /*
+   * Other sensors also run while disconnected so that their readings are recorded to the data log
+   */
+  runSensor(sensor_adaf1080); //Call adaf1080_loop() between each other sensor as ADAF1080 has faster readout requirement
+  runSensor(sensor_as7341);
+
+  runSensor(sensor_adaf1080);
+  runSensor(sensor_lsm9ds1);
+
+  runSensor(sensor_adaf1080);
 
   unsigned long now = micros();
   unsigned long duration = now - m_lastLoopTime;
@@ -165,9 +426,21 @@ void loop(void) {
     m_maxLoopLength = duration;
   }
 
+  if (m_bringupDone) {
+    profile_endLoop(duration); //Sensor init is slow by design, so only look for stalls once running
+  }
+
   if (now - m_lastPrintTime >= PRINT_INTERVAL) {
     m_lastPrintTime = now;
     printLoopStats();
     resetLoopStats();
   }
+
+  if (!m_bootTimeReported && (BLEWrapper::getFirstNotifyTime() != 0)) {
+    m_bootTimeReported = true;
+    printBootTime();
+  }
+
+  idle_sleep(); //Wait for next deadline. Loop length statistics only include time spent running
+  m_lastLoopTime = micros();
 }
@@ -0,0 +1,186 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module calculates hand-arm vibration exposure from raw accelerometer data, following the method in ISO 5349-1:
+ *
+ *    - Each axis is passed through the Wh frequency weighting filter
+ *    - The weighted RMS acceleration of each axis is calculated over a one second window
+ *    - The vibration total value (ahv) is the root sum of squares of the three axes
+ *    - Daily exposure A(8) is the energy-equivalent ahv normalised to an 8 hour reference period
+ *
+ * The Wh filter is made up of a band-limiting high pass filter and an acceleration-velocity transition filter, each implemented as a
+ * second order IIR "biquad" section. Coefficients are calculated from the analog prototypes in ISO 5349-1 Annex A using the bilinear transform.
+ *
+ * Exposure accumulates over a working day. It is only cleared by havs_resetExposure(), so the caller decides when a new shift starts.
+ *
+ * The band-limiting low pass filter (f2 = 1258.9Hz) is above the Nyquist frequency of the accelerometer, so is omitted. The sensor's own
+ * anti-aliasing filter limits the upper bandwidth instead: 408Hz at the default 952Hz ODR, 211Hz at 476Hz. ISO 5349-1 covers the
+ * one-third octave bands up to 1250Hz, so the bands above this are missing from the measurement. Wh weighting is below 0.04 there
+ * (it falls as 1/f above 16Hz), so this only matters for tools whose vibration is mostly at high frequency, such as die grinders and
+ * high-speed sanders, where ahv will read low.
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "havs.h"
+
+#define NUM_AXES 3
+#define NUM_STAGES 2
+
+/*
+ * Wh filter parameters from ISO 5349-1 table A.1
+ */
+#define WH_F1 6.310   //Hz, band-limiting high pass corner frequency
+#define WH_Q1 0.71
+#define WH_F3 15.915  //Hz, acceleration-velocity transition
+#define WH_F4 15.915  //Hz
+#define WH_Q4 0.64
+
+#define WINDOW_TIME 1.0f //seconds, report ahv over 1 second windows
+#define REFERENCE_TIME 28800.0 //8 hours in seconds
+
+typedef struct {
+  float b0, b1, b2;
+  float a1, a2;
+} biquad_coeffs_t;
+
+typedef struct {
+  float z1, z2;
+} biquad_state_t;
+
+static biquad_coeffs_t m_coeffs[NUM_STAGES];
+static biquad_state_t m_state[NUM_AXES][NUM_STAGES];
+
+static float m_sampleRate;
+static int m_windowSamples;
+static int m_sampleCount;
+static float m_sumSquares[NUM_AXES];
+static float m_vibration = 0.0f;
+static double m_energy = 0.0; //Accumulated exposure in (m/s^2)^2 * s. Use double precision as this grows over a whole shift
+
+/*
+ * Convert analog transfer function H(s) = (b0 + b1*s + b2*s^2) / (a0 + a1*s + a2*s^2) into digital biquad using the bilinear transform.
+ * Frequency is pre-warped so that the response matches the analog prototype exactly at fWarp.
+ */
+static biquad_coeffs_t bilinear(double b0, double b1, double b2, double a0, double a1, double a2, double fWarp, double fs) {
+  double w = 2.0 * M_PI * fWarp;
+  double k = w / tan(w / (2.0 * fs));
+  double kk = k * k;
+
+  double nb0 = b0 + b1 * k + b2 * kk;
+  double nb1 = 2.0 * b0 - 2.0 * b2 * kk;
+  double nb2 = b0 - b1 * k + b2 * kk;
+  double na0 = a0 + a1 * k + a2 * kk;
+  double na1 = 2.0 * a0 - 2.0 * a2 * kk;
+  double na2 = a0 - a1 * k + a2 * kk;
+
+  biquad_coeffs_t c;
+  c.b0 = (float)(nb0 / na0);
+  c.b1 = (float)(nb1 / na0);
+  c.b2 = (float)(nb2 / na0);
+  c.a1 = (float)(na1 / na0);
+  c.a2 = (float)(na2 / na0);
+  return c;
+}
+
+static float biquad(const biquad_coeffs_t *c, biquad_state_t *s, float x) {
+  /*
+   * Transposed direct form II has the best numerical behaviour for single precision floating point
+   */
+  float y = c->b0 * x + s->z1;
+  s->z1 = c->b1 * x - c->a1 * y + s->z2;
+  s->z2 = c->b2 * x - c->a2 * y;
+  return y;
+}
+
+static void resetWindow(void) {
+  m_sampleCount = 0;
+  int i;
+  for (i = 0; i < NUM_AXES; i++) {
+    m_sumSquares[i] = 0.0f;
+  }
+}
+
+void havs_init(float sampleRate) {
+  double fs = (double)sampleRate;
+  double w1 = 2.0 * M_PI * WH_F1;
+  double w3 = 2.0 * M_PI * WH_F3;
+  double w4 = 2.0 * M_PI * WH_F4;
+
+  m_coeffs[0] = bilinear(0.0, 0.0, 1.0, w1 * w1, w1 / WH_Q1, 1.0, WH_F1, fs); //High pass: H(s) = s^2 / (s^2 + s*w1/Q1 + w1^2)
+  m_coeffs[1] = bilinear(1.0, 1.0 / w3, 0.0, 1.0, 1.0 / (w4 * WH_Q4), 1.0 / (w4 * w4), WH_F4, fs); //Transition: H(s) = (1 + s/w3) / (1 + s/(w4*Q4) + s^2/w4^2)
+
+  int i, j;
+  for (i = 0; i < NUM_AXES; i++) {
+    for (j = 0; j < NUM_STAGES; j++) {
+      m_state[i][j].z1 = m_state[i][j].z2 = 0.0f;
+    }
+  }
+
+  m_sampleRate = sampleRate;
+  m_windowSamples = (int)round(WINDOW_TIME * sampleRate);
+  resetWindow();
+}
+
+bool havs_addSample(float x, float y, float z) {
+  float in[NUM_AXES] = { x, y, z };
+  int i, j;
+  for (i = 0; i < NUM_AXES; i++) {
+    float weighted = in[i];
+    for (j = 0; j < NUM_STAGES; j++) {
+      weighted = biquad(&m_coeffs[j], &m_state[i][j], weighted);
+    }
+
+    m_sumSquares[i] += weighted * weighted;
+  }
+
+  m_sampleCount++;
+  if (m_sampleCount < m_windowSamples) {
+    return false;
+  }
+
+  /*
+   * ahv = sqrt(ahwx^2 + ahwy^2 + ahwz^2), where ahwx etc. are the RMS weighted accelerations of each axis.
+   * Sum of mean squares is equal to the square of ahv so we can skip square root for the energy accumulator.
+   */
+  float ahvSquared = 0.0f;
+  for (i = 0; i < NUM_AXES; i++) {
+    ahvSquared += m_sumSquares[i] / (float)m_sampleCount;
+  }
+
+  m_vibration = sqrtf(ahvSquared);
+  m_energy += (double)ahvSquared * (double)m_sampleCount / (double)m_sampleRate;
+  resetWindow();
+  return true;
+}
+
+float havs_getVibration(void) {
+  return m_vibration;
+}
+
+float havs_getDailyExposure(void) {
+  return (float)sqrt(m_energy / REFERENCE_TIME); //A(8) = ahv(eq) * sqrt(T / T0)
+}
+
+/*
+ * Accumulated exposure in (m/s^2)^2 * s, so it can be kept through deep sleep
+ */
+double havs_getEnergy(void) {
+  return m_energy;
+}
+
+void havs_setEnergy(double energy) {
+  m_energy = energy;
+}
+
+/*
+ * Start of a new shift
+ */
+void havs_resetExposure(void) {
+  m_energy = 0.0;
+}
@@ -0,0 +1,20 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __HAVS_H
+#define __HAVS_H
+
+void havs_init(float sampleRate);
+bool havs_addSample(float x, float y, float z);
+float havs_getVibration(void);
+float havs_getDailyExposure(void);
+double havs_getEnergy(void);
+void havs_setEnergy(double energy);
+void havs_resetExposure(void);
+
+#endif /* __HAVS_H */
@@ -0,0 +1,290 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module arbitrates the shared I2C bus between the BME688, AS7341 and LSM9DS1. The sensor libraries drive the bus synchronously, so
+ * while a device is being read the loop task is blocked and the ADAF1080 (on SPI) cannot take its next sample.
+ *
+ * The ADAF1080 module publishes the time of its next sample as a deadline. Before using the bus, each device calls i2cbus_acquire(),
+ * which refuses if the device's recent worst case bus time would run past the deadline. The device tries again on the next loop
+ * iteration, straight after the ADAF1080 sample. Devices are prioritised by how long they may be put off: once a device has waited
+ * longer than its MAX_DEFER_TIME it gets the bus anyway, and the ADAF1080 sample is taken late instead.
+ *
+ * Only the bus transactions themselves are timed: each one is bracketed with I2CBUS_TRANSFER(), and the time inside transactions
+ * between acquire and release is the device's bus time for that hold. Processing between transactions (sensor fusion, BSEC, BLE
+ * notifications) doesn't count, so the estimate is the time the bus is actually busy. Devices keep each hold to a slice of work that
+ * fits the gap between ADAF1080 samples, and carry on with the next slice on the next loop iteration.
+ *
+ * A device whose work is a run of similar transactions (draining a FIFO) can instead take the bus with i2cbus_acquireSlice(), which only
+ * needs its longest recent transaction to fit, and call i2cbus_hasTime() before each further one. The slice then stretches to fill
+ * whatever is left of the gap, rather than being sized for the worst case.
+ *
+ * Devices report the result of each read, and are considered failed after MAX_ERRORS in a row. A device that resets or browns out in
+ * the middle of a read can be left holding SDA low, which blocks every other device. This is cleared by clocking SCL until the device
+ * has shifted out the rest of its byte and released SDA, then sending a STOP.
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "i2cbus.h"
+#include "energy.h"
+
+#define I2C_CLOCK 400000 //Hz. AS7341 and LSM9DS1 support fast mode (400kHz) but not fast mode plus (1MHz)
+#define I2C_TIMEOUT 20 //ms, so a stuck device cannot block the loop for the default 50ms
+
+#define MIN_BUS_TIME 20 //us, shorter than a single transaction so device did not use the bus. Doesn't update estimate
+#define ESTIMATE_DECAY 32 //Worst case estimate decays by 1/32 on each use, so a one-off slow read is forgotten
+#define STALE_DEADLINE_TIME 20000 //us, ignore a deadline that passed this long ago (ADAF1080 busy calibrating or stopped)
+
+#define MAX_ERRORS 5 //Consecutive failed reads before device is considered failed
+#define RECOVERY_PULSES 9 //Enough for a device to finish any byte, plus the ACK bit
+#define RECOVERY_HALF_PERIOD 5 //us, 100kHz
+
+/*
+ * Longest time each device may be kept off the bus (us), indexed by i2cbus_device_t
+ */
+static const unsigned long MAX_DEFER_TIME[NUM_I2CBUS_DEVICES] = {
+  10000, //i2cbus_device_lsm9ds1: leaves 23ms margin before FIFO overflows at 952Hz
+  20000, //i2cbus_device_as7341: flicker FIFO is polled every 20ms and holds 128ms, so a late poll still leaves 88ms margin
+  50000  //i2cbus_device_bme688: BSEC tolerates late calls
+};
+
+/*
+ * Subsystem charged for each transaction, indexed by i2cbus_device_t
+ */
+static const energy_subsystem_t ENERGY_SUBSYSTEM[NUM_I2CBUS_DEVICES] = {
+  energy_subsystem_lsm9ds1,
+  energy_subsystem_as7341,
+  energy_subsystem_bme688
+};
+
+static unsigned long m_deadline;
+static bool m_deadlineValid = false;
+
+static unsigned long m_estimate[NUM_I2CBUS_DEVICES]; //us, recent worst case bus time
+static unsigned long m_transferEstimate[NUM_I2CBUS_DEVICES]; //us, recent worst case single transaction
+static unsigned long m_deferStart[NUM_I2CBUS_DEVICES];
+static bool m_deferred[NUM_I2CBUS_DEVICES];
+static bool m_sliced[NUM_I2CBUS_DEVICES]; //Held with i2cbus_acquireSlice()
+static bool m_forced[NUM_I2CBUS_DEVICES]; //Held past the deadline after waiting MAX_DEFER_TIME
+static unsigned long m_holdTime[NUM_I2CBUS_DEVICES]; //us, time in transactions since acquire
+static unsigned long m_transferStart[NUM_I2CBUS_DEVICES];
+
+static int m_numErrors[NUM_I2CBUS_DEVICES];
+
+static unsigned long m_busTime[NUM_I2CBUS_DEVICES];
+static unsigned long m_numDeferrals;
+static unsigned long m_statsStartTime;
+
+static void startBus(void) {
+  Wire.begin();
+  Wire.setClock(I2C_CLOCK);
+  Wire.setTimeOut(I2C_TIMEOUT);
+}
+
+void i2cbus_init(void) {
+  startBus();
+
+  int i;
+  for (i = 0; i < NUM_I2CBUS_DEVICES; i++) {
+    m_estimate[i] = 0;
+    m_transferEstimate[i] = 0;
+    m_deferred[i] = false;
+    m_sliced[i] = false;
+    m_forced[i] = false;
+    m_holdTime[i] = 0;
+    m_numErrors[i] = 0;
+  }
+
+  i2cbus_resetStats();
+}
+
+/*
+ * Sensor libraries may reset the clock when they start, so call after each one is initialised
+ */
+void i2cbus_checkClock(void) {
+  if (Wire.getClock() != I2C_CLOCK) {
+    Wire.setClock(I2C_CLOCK);
+  }
+}
+
+/*
+ * Time of next ADAF1080 sample, from micros()
+ */
+void i2cbus_setDeadline(unsigned long deadline) {
+  m_deadline = deadline;
+  m_deadlineValid = true;
+}
+
+static unsigned long decayEstimate(unsigned long estimate, unsigned long duration) {
+  unsigned long decayed = estimate - estimate / ESTIMATE_DECAY;
+  return (duration > decayed) ? duration : decayed;
+}
+
+/*
+ * Returns true if busTime (us) from now fits before the next ADAF1080 sample
+ */
+static bool fitsBeforeDeadline(unsigned long now, unsigned long busTime) {
+  long remaining = (long)(m_deadline - now);
+  return !m_deadlineValid || (remaining < -STALE_DEADLINE_TIME) || ((remaining >= 0) && ((unsigned long)remaining >= busTime));
+}
+
+static bool acquire(i2cbus_device_t device, unsigned long busTime, bool sliced) {
+  unsigned long now = micros();
+  bool clear = fitsBeforeDeadline(now, busTime);
+  if (!clear) {
+    if (!m_deferred[device]) {
+      m_deferred[device] = true;
+      m_deferStart[device] = now;
+    }
+
+    if (now - m_deferStart[device] < MAX_DEFER_TIME[device]) {
+      m_numDeferrals++;
+      return false;
+    }
+  }
+
+  m_deferred[device] = false;
+  m_sliced[device] = sliced;
+  m_forced[device] = !clear;
+  m_holdTime[device] = 0;
+  return true;
+}
+
+/*
+ * Returns true if device may use the bus now. Must be followed by i2cbus_release()
+ */
+bool i2cbus_acquire(i2cbus_device_t device) {
+  return acquire(device, m_estimate[device], false);
+}
+
+/*
+ * As i2cbus_acquire(), for a run of transactions that stops when i2cbus_hasTime() returns false. Only one transaction needs to fit
+ */
+bool i2cbus_acquireSlice(i2cbus_device_t device) {
+  return acquire(device, m_transferEstimate[device], true);
+}
+
+/*
+ * Returns true if another transaction fits before the next ADAF1080 sample. Always true once a device has been kept waiting
+ * MAX_DEFER_TIME, as that sample is late already
+ */
+bool i2cbus_hasTime(i2cbus_device_t device) {
+  return m_forced[device] || fitsBeforeDeadline(micros(), m_transferEstimate[device]);
+}
+
+void i2cbus_release(i2cbus_device_t device) {
+  unsigned long duration = m_holdTime[device];
+  if (m_sliced[device] || (duration < MIN_BUS_TIME)) {
+    return; //Slices fill the gap they are given, so would inflate the estimate for the device's other holds
+  }
+
+  m_estimate[device] = decayEstimate(m_estimate[device], duration);
+}
+
+/*
+ * Called by I2CBUS_TRANSFER() around each transaction, which is also charged as one I2C operation. Transactions outside acquire and
+ * release (during initialisation) are counted towards utilisation and the single transaction estimate, but not the hold estimate
+ */
+void i2cbus_beginTransfer(i2cbus_device_t device) {
+  m_transferStart[device] = micros();
+}
+
+void i2cbus_endTransfer(i2cbus_device_t device) {
+  unsigned long duration = micros() - m_transferStart[device];
+  m_holdTime[device] += duration;
+  m_transferEstimate[device] = decayEstimate(m_transferEstimate[device], duration);
+  m_busTime[device] += duration;
+  energy_addOp(ENERGY_SUBSYSTEM[device], energy_op_i2c, 1);
+}
+
+void i2cbus_reportResult(i2cbus_device_t device, bool ok) {
+  if (ok) {
+    m_numErrors[device] = 0;
+  } else if (m_numErrors[device] < MAX_ERRORS) {
+    m_numErrors[device]++;
+  }
+}
+
+bool i2cbus_hasFailed(i2cbus_device_t device) {
+  return (m_numErrors[device] >= MAX_ERRORS);
+}
+
+void i2cbus_resetErrors(i2cbus_device_t device) {
+  m_numErrors[device] = 0;
+}
+
+/*
+ * Both lines idle high when no transaction is in progress. Only call between transactions
+ */
+bool i2cbus_isHung(void) {
+  return (digitalRead(SDA) == LOW) || (digitalRead(SCL) == LOW);
+}
+
+/*
+ * Clock out any device holding SDA low, then send STOP to reset all devices' bus state. Takes around 100us.
+ * Returns true if both lines are released
+ */
+bool i2cbus_recover(void) {
+  Wire.end();
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, OUTPUT_OPEN_DRAIN);
+  digitalWrite(SCL, HIGH);
+  delayMicroseconds(RECOVERY_HALF_PERIOD);
+
+  int i;
+  for (i = 0; (i < RECOVERY_PULSES) && (digitalRead(SDA) == LOW); i++) {
+    digitalWrite(SCL, LOW);
+    delayMicroseconds(RECOVERY_HALF_PERIOD);
+    digitalWrite(SCL, HIGH);
+    delayMicroseconds(RECOVERY_HALF_PERIOD);
+  }
+
+  /*
+   * STOP condition is a rising edge on SDA while SCL is high
+   */
+  pinMode(SDA, OUTPUT_OPEN_DRAIN);
+  digitalWrite(SCL, LOW);
+  digitalWrite(SDA, LOW);
+  delayMicroseconds(RECOVERY_HALF_PERIOD);
+  digitalWrite(SCL, HIGH);
+  delayMicroseconds(RECOVERY_HALF_PERIOD);
+  digitalWrite(SDA, HIGH);
+  delayMicroseconds(RECOVERY_HALF_PERIOD);
+
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, INPUT_PULLUP);
+  bool released = (digitalRead(SDA) == HIGH) && (digitalRead(SCL) == HIGH);
+  startBus(); //Give pins back to I2C peripheral
+  return released;
+}
+
+/*
+ * Percentage of time since stats were reset that device spent in bus transactions
+ */
+float i2cbus_getUtilisation(i2cbus_device_t device) {
+  unsigned long elapsed = micros() - m_statsStartTime;
+  if (elapsed == 0) {
+    return 0.0f;
+  }
+
+  return 100.0f * (float)m_busTime[device] / (float)elapsed;
+}
+
+unsigned long i2cbus_getDeferrals(void) {
+  return m_numDeferrals;
+}
+
+void i2cbus_resetStats(void) {
+  int i;
+  for (i = 0; i < NUM_I2CBUS_DEVICES; i++) {
+    m_busTime[i] = 0;
+  }
+
+  m_numDeferrals = 0;
+  m_statsStartTime = micros();
+}
@@ -0,0 +1,54 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __I2CBUS_H
+#define __I2CBUS_H
+
+typedef enum {
+  i2cbus_device_lsm9ds1 = 0, //Highest priority: FIFO overflows after 33ms
+  i2cbus_device_as7341,
+  i2cbus_device_bme688
+} i2cbus_device_t;
+
+#define NUM_I2CBUS_DEVICES 3
+
+void i2cbus_init(void);
+void i2cbus_checkClock(void);
+void i2cbus_setDeadline(unsigned long deadline);
+bool i2cbus_acquire(i2cbus_device_t device);
+bool i2cbus_acquireSlice(i2cbus_device_t device);
+bool i2cbus_hasTime(i2cbus_device_t device);
+void i2cbus_release(i2cbus_device_t device);
+void i2cbus_beginTransfer(i2cbus_device_t device);
+void i2cbus_endTransfer(i2cbus_device_t device);
+void i2cbus_reportResult(i2cbus_device_t device, bool ok);
+bool i2cbus_hasFailed(i2cbus_device_t device);
+void i2cbus_resetErrors(i2cbus_device_t device);
+bool i2cbus_isHung(void);
+bool i2cbus_recover(void);
+float i2cbus_getUtilisation(i2cbus_device_t device);
+unsigned long i2cbus_getDeferrals(void);
+void i2cbus_resetStats(void);
+
+/*
+ * Brackets one bus transaction, from the start of the scope to the end. Only time inside transactions is counted as bus time
+ */
+class I2CBusTransfer {
+  private:
+    i2cbus_device_t m_device;
+
+  public:
+    I2CBusTransfer(i2cbus_device_t device) : m_device(device) { i2cbus_beginTransfer(device); }
+    ~I2CBusTransfer() { i2cbus_endTransfer(m_device); }
+};
+
+#define I2CBUS_CONCAT2(a, b) a##b
+#define I2CBUS_CONCAT(a, b) I2CBUS_CONCAT2(a, b)
+#define I2CBUS_TRANSFER(device) I2CBusTransfer I2CBUS_CONCAT(i2cbusTransfer, __LINE__)(device)
+
+#endif /* __I2CBUS_H */
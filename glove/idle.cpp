@@ -0,0 +1,100 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module lets the CPU idle between deadlines, instead of spinning round loop() polling timers. Each module calls idle_wakeAfter()
+ * from its loop function with the time until it next needs to run. At the end of loop(), idle_sleep() blocks the loop task until the
+ * earliest deadline. Interrupt handlers call idle_wakeFromISR() to end the sleep early when data arrives.
+ *
+ * While the loop task is blocked, the FreeRTOS idle task halts the CPU until the next interrupt, and power management scales the CPU
+ * clock down. Light sleep is not used: the Feather has no 32kHz crystal, so the BLE controller needs the main clock to keep its
+ * connection events, and would block light sleep anyway.
+ */
+
+#define ERR_MODULE_NAME "Idle"
+
+#include <Arduino.h>
+#include <esp_pm.h>
+
+#include "idle.h"
+#include "err.h"
+
+#define MAX_CPU_FREQ 240 //MHz
+#define MIN_CPU_FREQ 80 //MHz, lowest frequency that keeps APB clock at 80MHz for peripherals
+#define MAX_IDLE_TIME 50000 //us, modules without a deadline (e.g. button polling) are still run at least this often
+#define US_PER_TICK (1000UL * portTICK_PERIOD_MS)
+
+static TaskHandle_t m_taskHandle = NULL;
+static unsigned long m_deadline;
+static unsigned long m_sleepTime = 0;
+static unsigned long m_statsStartTime;
+
+void idle_init(void) {
+  m_taskHandle = xTaskGetCurrentTaskHandle(); //Arduino runs setup() and loop() in the same task
+
+  esp_pm_config_t config = {};
+  config.max_freq_mhz = MAX_CPU_FREQ;
+  config.min_freq_mhz = MIN_CPU_FREQ;
+  config.light_sleep_enable = false;
+  if (esp_pm_configure(&config) != ESP_OK) {
+    ERROR("Power management not available, CPU will idle at full speed");
+  }
+
+  m_deadline = micros() + MAX_IDLE_TIME;
+  idle_resetStats();
+}
+
+/*
+ * Delay in microseconds from now
+ */
+void idle_wakeAfter(unsigned long delay) {
+  unsigned long deadline = micros() + delay;
+  if ((long)(deadline - m_deadline) < 0) {
+    m_deadline = deadline;
+  }
+}
+
+void IRAM_ATTR idle_wakeFromISR(void) {
+  if (m_taskHandle == NULL) {
+    return;
+  }
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(m_taskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void idle_sleep(void) {
+  unsigned long start = micros();
+  long remaining = (long)(m_deadline - start);
+
+  /*
+   * Only sleep for whole ticks, rounding down so that we never oversleep a deadline
+   */
+  if (remaining >= (long)US_PER_TICK) {
+    ulTaskNotifyTake(pdTRUE, (TickType_t)(remaining / US_PER_TICK));
+    m_sleepTime += micros() - start;
+  }
+
+  m_deadline = micros() + MAX_IDLE_TIME;
+}
+
+/*
+ * Returns percentage of time the loop task was running (not sleeping) since stats were reset
+ */
+float idle_getDutyCycle(void) {
+  unsigned long total = micros() - m_statsStartTime;
+  if (total == 0) {
+    return 100.0f;
+  }
+
+  return 100.0f * (float)(total - m_sleepTime) / (float)total;
+}
+
+void idle_resetStats(void) {
+  m_sleepTime = 0;
+  m_statsStartTime = micros();
+}
@@ -0,0 +1,21 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __IDLE_H
+#define __IDLE_H
+
+#include <Arduino.h>
+
+void idle_init(void);
+void idle_wakeAfter(unsigned long delay);
+void IRAM_ATTR idle_wakeFromISR(void);
+void idle_sleep(void);
+float idle_getDutyCycle(void);
+void idle_resetStats(void);
+
+#endif /* __IDLE_H */
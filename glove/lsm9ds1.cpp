@@ -8,19 +8,90 @@
 
 #define ERR_MODULE_NAME "LSM9DS1"
 
+#include <time.h>
 #include <Wire.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <Adafruit_LSM9DS1.h>
 #include <Adafruit_Sensor.h>
+#include <Adafruit_BusIO_Register.h>
 #include "SensorFusion.h"
 
 #include "blewrapper.h"
+#include "havs.h"
+#include "activity.h"
+#include "idle.h"
+#include "i2cbus.h"
+#include "datalog.h"
+#include "timebase.h"
+#include "config.h"
+#include "retained.h"
+#include "trace.h"
+#include "bench.h"
+#include "profile.h"
 #include "err.h"
 
-#define SAMPLE_TIME 1000 //milliseconds
+/*
+ * Accelerometer runs at maximum ODR (952Hz) for vibration measurement while the hand is moving, so the Wh weighting covers as much of
+ * its band as the sensor allows (see havs.cpp). Gyro shares the same ODR (accelerometer follows the gyro while it is on, and fusion
+ * needs the gyro), so every FIFO level holds both.
+ * Samples are buffered in the LSM9DS1's internal FIFO and drained a slice at a time between ADAF1080 samples, so we don't need to poll
+ * at the full rate. Use 16g range, as power tool vibration easily exceeds the 2g range.
+ */
+#define ACCEL_RANGE m_sensor.LSM9DS1_ACCELRANGE_16G
+#define ACCEL_DATA_RATE m_sensor.LSM9DS1_ACCELDATARATE_952HZ
+#define ACCEL_SCALE (LSM9DS1_ACCEL_MG_LSB_16G / 1000.0f * SENSORS_GRAVITY_STANDARD) //Raw counts to m/s^2
+#define GYRO_SCALE (LSM9DS1_GYRO_DPS_DIGIT_245DPS * SENSORS_DPS_TO_RADS) //Raw counts to rad/s
+#define MAG_SCALE (LSM9DS1_MAG_MGAUSS_4GAUSS / 1000.0f * SENSORS_GAUSS_TO_MICROTESLA) //Raw counts to uT
+
+#define REG_WHO_AM_I 0x0F
+#define REG_CTRL_REG1_G 0x10
+#define REG_CTRL_REG9 0x23
+#define REG_FIFO_CTRL 0x2E
+#define REG_FIFO_SRC 0x2F
+#define REG_OUT_X_L_G 0x18
+#define CTRL_REG1_G_ODR_SHIFT 5U
+#define CTRL_REG1_G_ODR_MASK (0x7U << CTRL_REG1_G_ODR_SHIFT)
+#define CTRL_REG9_FIFO_EN (1U << 1U)
+#define FIFO_MODE_CONTINUOUS (0x6U << 5U) //New samples overwrite oldest when full
+#define FIFO_SRC_OVRN (1U << 6U)
+#define FIFO_SRC_FSS_MASK 0x3FU //Number of unread samples in FIFO
+#define WHO_AM_I_VALUE 0x68
+#define XG_I2C_ADDRESS 0x6B
+
+/*
+ * One FIFO level is read as a single burst from OUT_X_L_G (0x18) to OUT_Z_H_XL (0x2D), rather than separate gyro and accelerometer
+ * reads. The 10 registers in between are discarded, but it saves a whole transaction per level.
+ * Each level takes around 0.6ms at 400kHz, and the FIFO fills a level every 1.05ms at 952Hz, so a fixed slice sized for the worst
+ * case gap between ADAF1080 samples (4ms at 250Hz) would only just keep up. Instead the bus is taken a slice at a time (see i2cbus.cpp)
+ * and levels are read for as long as they fit before the next sample, up to about 6 per gap. Once the FIFO has been caught up, each
+ * slice reads the 3 or 4 levels that arrived since the last one, and the rest of the gap is left for the other I2C devices.
+ * FIFO_MAX_SLICE stops a slice that has been let past the deadline from draining the whole FIFO in one go. Anything left over is read
+ * on the next loop.
+ */
+#define FIFO_LEVEL_LEN 22
+#define FIFO_GYRO_OFFSET 0
+#define FIFO_ACCEL_OFFSET 16
+#define FIFO_MAX_SLICE 8
+
+#define HEALTH_CHECK_TIME 1000 //milliseconds. Library hides read errors, so check ID register to detect a device that has stopped responding
+
+/*
+ * Vibration exposure is kept through deep sleep, and starts again from zero once there has been no exposure for this long (seconds),
+ * i.e. the next shift has started. The client can also reset it at the start of a shift. Gap is measured with time(), which runs from
+ * the RTC so keeps counting through deep sleep.
+ */
+#define EXPOSURE_RESET_TIME 14400 //4 hours
+
+/*
+ * Gyro/accel sample rate for each ODR code (Hz), indexed by CTRL_REG1_G ODR field. ODR code, fusion time and report time for each
+ * activity profile are runtime parameters (952Hz / 20ms / 1s moving, 59.5Hz / 200ms / 5s still by default)
+ */
+#define NUM_ODRS 7
+static const float ODR_SAMPLE_RATE[NUM_ODRS] = { 0.0f, 14.9f, 59.5f, 119.0f, 238.0f, 476.0f, 952.0f }; //Code 0 is power down
+
 #define BLE_INST_ID 0
-#define NUM_CHARACTERISTICS 12
+#define NUM_CHARACTERISTICS 17
 
 #define BLE_SERVICE_UUID BLEUUID("606a0692-1e69-422a-9f73-de87d239aade")
 #define ACCEL_X_UUID BLEUUID("0436b72d-c94e-4cf8-93e0-60fb68c0f6dd")
@@ -35,21 +106,38 @@
 #define PITCH_UUID BLEUUID("8fccbd0f-7afd-419d-a01e-9ee6ca6f6f16")
 #define ROLL_UUID BLEUUID("acd5b86b-f7ed-42b3-82fe-96668ca32a08")
 #define YAW_UUID BLEUUID("bb54840e-2907-40ce-bd38-5d967b66e036")
+#define VIBRATION_UUID BLEUUID("c3a1e0f2-6d4b-4a8e-9f57-2b8d41c7e930")
+#define EXPOSURE_UUID BLEUUID("d8f27b64-0c3e-4f19-a6d2-75e9b1c4f083")
+#define MOVING_UUID BLEUUID("e1b6c9d3-42a7-4f0e-8c15-9a3d7e2b64f1")
+#define FRAME_UUID BLEUUID("f4c8a2e6-9d1b-4f73-b5e0-3a6d8c1f9b57")
+#define RESET_EXPOSURE_UUID BLEUUID("2c7e5a91-b3d4-4f86-a0e2-6d19c8b74f35")
 
 #define ACCEL_FORMAT BLE2904::FORMAT_SINT16
 #define MAG_FORMAT BLE2904::FORMAT_SINT16
 #define GYRO_FORMAT BLE2904::FORMAT_SINT16
 #define ANGLE_FORMAT BLE2904::FORMAT_SINT16
+#define VIBRATION_FORMAT BLE2904::FORMAT_UINT16
+#define MOVING_FORMAT BLE2904::FORMAT_BOOLEAN
+#define FRAME_FORMAT BLE2904::FORMAT_OPAQUE
+#define RESET_EXPOSURE_FORMAT BLE2904::FORMAT_BOOLEAN
 
 #define ACCEL_EXPONENT -2
 #define MAG_EXPONENT -2
 #define GYRO_EXPONENT -2
 #define ANGLE_EXPONENT -2
+#define VIBRATION_EXPONENT -2
+#define MOVING_EXPONENT 0
+#define FRAME_EXPONENT 0
+#define RESET_EXPOSURE_EXPONENT 0
 
 #define ACCEL_UNIT BLEUnit::MetresPerSecondSquared
 #define MAG_UNIT BLEUnit::uTesla
 #define GYRO_UNIT BLEUnit::RadsPerSecond
 #define ANGLE_UNIT BLEUnit::Radian
+#define VIBRATION_UNIT BLEUnit::MetresPerSecondSquared
+#define MOVING_UNIT BLEUnit::Unitless
+#define FRAME_UNIT BLEUnit::Unitless
+#define RESET_EXPOSURE_UNIT BLEUnit::Unitless
 
 #define ACCEL_X_NAME "Acceleration (X)"
 #define ACCEL_Y_NAME "Acceleration (Y)"
@@ -63,6 +151,13 @@
 #define PITCH_NAME "Pitch"
 #define ROLL_NAME "Roll"
 #define YAW_NAME "Yaw"
+#define VIBRATION_NAME "Vibration total value (ahv)"
+#define EXPOSURE_NAME "Daily vibration exposure A(8)"
+#define MOVING_NAME "Hand moving"
+#define FRAME_NAME "Orientation frame"
+#define RESET_EXPOSURE_NAME "Reset vibration exposure"
+
+#define FRAME_NUM_VALUES 3 //Pitch, roll, yaw (rad)
 
 static BLECharacteristic m_accelXCharacteristic(ACCEL_X_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_accelYCharacteristic(ACCEL_Y_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
@@ -76,6 +171,11 @@ static BLECharacteristic m_gyroZCharacteristic(GYRO_Z_UUID, BLECharacteristic::P
 static BLECharacteristic m_pitchCharacteristic(PITCH_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_rollCharacteristic(ROLL_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
 static BLECharacteristic m_yawCharacteristic(YAW_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_vibrationCharacteristic(VIBRATION_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_exposureCharacteristic(EXPOSURE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_movingCharacteristic(MOVING_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_frameCharacteristic(FRAME_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+static BLECharacteristic m_resetExposureCharacteristic(RESET_EXPOSURE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
 
 static BLEWrapper m_accelXWrapper(&m_accelXCharacteristic, ACCEL_X_NAME, ACCEL_FORMAT, ACCEL_EXPONENT, ACCEL_UNIT);
 static BLEWrapper m_accelYWrapper(&m_accelYCharacteristic, ACCEL_Y_NAME, ACCEL_FORMAT, ACCEL_EXPONENT, ACCEL_UNIT);
@@ -89,37 +189,165 @@ static BLEWrapper m_gyroZWrapper(&m_gyroZCharacteristic, GYRO_Z_NAME, GYRO_FORMA
 static BLEWrapper m_pitchWrapper(&m_pitchCharacteristic, PITCH_NAME, ANGLE_FORMAT, ANGLE_EXPONENT, ANGLE_UNIT);
 static BLEWrapper m_rollWrapper(&m_rollCharacteristic, ROLL_NAME, ANGLE_FORMAT, ANGLE_EXPONENT, ANGLE_UNIT);
 static BLEWrapper m_yawWrapper(&m_yawCharacteristic, YAW_NAME, ANGLE_FORMAT, ANGLE_EXPONENT, ANGLE_UNIT);
+static BLEWrapper m_vibrationWrapper(&m_vibrationCharacteristic, VIBRATION_NAME, VIBRATION_FORMAT, VIBRATION_EXPONENT, VIBRATION_UNIT);
+static BLEWrapper m_exposureWrapper(&m_exposureCharacteristic, EXPOSURE_NAME, VIBRATION_FORMAT, VIBRATION_EXPONENT, VIBRATION_UNIT);
+static BLEWrapper m_movingWrapper(&m_movingCharacteristic, MOVING_NAME, MOVING_FORMAT, MOVING_EXPONENT, MOVING_UNIT);
+static BLEWrapper m_frameWrapper(&m_frameCharacteristic, FRAME_NAME, FRAME_FORMAT, FRAME_EXPONENT, FRAME_UNIT);
+static BLEWrapper m_resetExposureWrapper(&m_resetExposureCharacteristic, RESET_EXPOSURE_NAME, RESET_EXPOSURE_FORMAT, RESET_EXPOSURE_EXPONENT, RESET_EXPOSURE_UNIT);
 
 static Adafruit_LSM9DS1 m_sensor = Adafruit_LSM9DS1();
+static Adafruit_I2CDevice *m_pI2cDev = NULL; //Direct register access for FIFO bursts
 static SF m_fusion;
 static unsigned long m_lastTime;
+static unsigned long m_lastFusionTime;
+static unsigned long m_lastHealthTime;
 static bool m_ready = false;
 
+static float m_accel[3]; //Latest samples drained from FIFO
+static float m_gyro[3];
+static float m_mag[3];
+static uint32_t m_configGeneration;
+static uint64_t m_fifoTime; //Timebase, when FIFO was last drained. Newest sample was taken within one ODR period before this
+static uint64_t m_fusionTime; //Timebase, time of samples used in last fusion update
+static int m_fifoLevels; //Unread FIFO levels, as of the last FIFO_SRC read
+static int m_staleLevels; //Unread FIFO levels that were taken before the last ODR change
+static bool m_measureVibration;
+static volatile bool m_requestExposureReset = false;
+
+class ResetExposureCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    if (pCharacteristic == NULL) {
+      return;
+    }
+
+    size_t dataLen = pCharacteristic->getLength();
+    if (dataLen < 1) {
+      return;
+    }
+
+    uint8_t *pData = pCharacteristic->getData();
+    if (pData[0]) { //Client writes '1' at the start of a shift
+      m_requestExposureReset = true; //Callback runs in different thread, so main thread does the reset
+    }
+  }
+};
+
+static uint8_t getOdr(activity_profile_t profile) {
+  return (uint8_t)config_getUint((config_param_t)(config_param_lsm9ds1Odr + profile));
+}
+
+static float getSampleRate(activity_profile_t profile) {
+  return ODR_SAMPLE_RATE[getOdr(profile)];
+}
+
+static unsigned long getFusionTime(activity_profile_t profile) {
+  return config_getUint((config_param_t)(config_param_lsm9ds1FusionTime + profile));
+}
+
+static unsigned long getReportTime(activity_profile_t profile) {
+  return config_getUint((config_param_t)(config_param_lsm9ds1SampleTime + profile));
+}
+
+static void commitExposure(uint32_t exposureTime) {
+  retained_get()->havsEnergy = havs_getEnergy();
+  retained_get()->havsTime = exposureTime;
+  retained_commit(RETAINED_HAVS);
+}
+
+/*
+ * Exposure carries on from before deep sleep, unless the gap since it last increased means this is a new shift
+ */
+static void restoreExposure(void) {
+  if (!retained_isValid(RETAINED_HAVS)) {
+    commitExposure((uint32_t)time(NULL));
+    return;
+  }
+
+  uint32_t gap = (uint32_t)time(NULL) - retained_get()->havsTime;
+  havs_setEnergy((gap < EXPOSURE_RESET_TIME) ? retained_get()->havsEnergy : 0.0);
+}
+
+/*
+ * Keeps accumulated exposure in retained memory, and starts a new shift after a long gap with no exposure
+ */
+static void updateExposure(void) {
+  uint32_t now = (uint32_t)time(NULL);
+  if (havs_getEnergy() != retained_get()->havsEnergy) {
+    commitExposure(now);
+  } else if ((havs_getEnergy() != 0.0) && (now - retained_get()->havsTime >= EXPOSURE_RESET_TIME)) {
+    havs_resetExposure();
+    commitExposure(now);
+  }
+}
+
+static void setOdr(activity_profile_t profile) {
+  uint8_t ctrlReg1;
+  {
+    PROFILE_ZONE("lsm9ds1 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+    ctrlReg1 = m_sensor.read8(XGTYPE, REG_CTRL_REG1_G);
+  }
+
+  PROFILE_ZONE("lsm9ds1 I2C");
+  I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+  m_sensor.write8(XGTYPE, REG_CTRL_REG1_G, (ctrlReg1 & ~CTRL_REG1_G_ODR_MASK) | (getOdr(profile) << CTRL_REG1_G_ODR_SHIFT));
+}
+
 bool lsm9ds1_init(void) {
+  m_ready = false; //May be called again to recover from failure
   if (!m_sensor.begin()) {
     ERROR("Could not initialise sensor");
     return false;
   }
 
-  m_sensor.setupAccel(m_sensor.LSM9DS1_ACCELRANGE_2G, m_sensor.LSM9DS1_ACCELDATARATE_10HZ);
+  m_sensor.setupAccel(ACCEL_RANGE, ACCEL_DATA_RATE);
   m_sensor.setupMag(m_sensor.LSM9DS1_MAGGAIN_4GAUSS);
   m_sensor.setupGyro(m_sensor.LSM9DS1_GYROSCALE_245DPS);
 
-  m_lastTime = millis();
+  if (m_pI2cDev == NULL) {
+    m_pI2cDev = new Adafruit_I2CDevice(XG_I2C_ADDRESS, &Wire);
+  }
+
+  if ((m_pI2cDev == NULL) || !m_pI2cDev->begin()) {
+    ERROR("Could not initialise FIFO register access");
+    return false;
+  }
+
+  uint8_t ctrlReg9;
+  {
+    I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+    ctrlReg9 = m_sensor.read8(XGTYPE, REG_CTRL_REG9);
+  }
+
+  {
+    I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+    m_sensor.write8(XGTYPE, REG_CTRL_REG9, ctrlReg9 | CTRL_REG9_FIFO_EN);
+  }
+
+  {
+    I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+    m_sensor.write8(XGTYPE, REG_FIFO_CTRL, FIFO_MODE_CONTINUOUS);
+  }
+
+  activity_profile_t profile = activity_profile_moving;
+  m_configGeneration = config_getGeneration();
+  setOdr(profile);
+  activity_init(getSampleRate(profile));
+  havs_init(getSampleRate(profile));
+  restoreExposure();
+  m_fifoLevels = 0;
+  m_staleLevels = 0;
+
+  m_lastTime = m_lastFusionTime = m_lastHealthTime = millis();
   m_ready = true;
   return true;
 }
 
 bool lsm9ds1_addService(BLEServer *pServer) {
-  if (!m_ready) {
-    return false;
-  }
-
   int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
   BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
   if (pService == NULL) {
     ERROR("Cannot add BLE service");
-    m_ready = false;
     return false;
   }
 
@@ -135,39 +363,314 @@ bool lsm9ds1_addService(BLEServer *pServer) {
   pService->addCharacteristic(&m_pitchCharacteristic);
   pService->addCharacteristic(&m_rollCharacteristic);
   pService->addCharacteristic(&m_yawCharacteristic);
-
+  pService->addCharacteristic(&m_vibrationCharacteristic);
+  pService->addCharacteristic(&m_exposureCharacteristic);
+  pService->addCharacteristic(&m_movingCharacteristic);
+  pService->addCharacteristic(&m_frameCharacteristic);
+  pService->addCharacteristic(&m_resetExposureCharacteristic);
+  m_resetExposureCharacteristic.setCallbacks(new ResetExposureCallbacks());
   pService->start();
+
+  uint8_t temp = 0;
+  m_resetExposureCharacteristic.setValue(&temp, 1);
   return true;
 }
 
+static void setFilterRate(activity_profile_t profile) {
+  activity_setSampleRate(getSampleRate(profile));
+
+  if (profile == activity_profile_moving) {
+    havs_init(getSampleRate(profile)); //Restart weighting filters at full rate. Accumulated exposure is kept
+  }
+}
+
+static void applyProfile(activity_profile_t profile) {
+  setOdr(profile);
+  setFilterRate(profile);
+  m_movingWrapper.writeValue(profile == activity_profile_moving);
+}
+
+/*
+ * Raw gyro x, y, z then accel x, y, z. Returns true if the activity profile has changed
+ */
+static bool processImu(const int16_t *raw, bool measureVibration, unsigned long now) {
+  m_gyro[0] = GYRO_SCALE * (float)raw[0];
+  m_gyro[1] = GYRO_SCALE * (float)raw[1];
+  m_gyro[2] = GYRO_SCALE * (float)raw[2];
+  m_accel[0] = ACCEL_SCALE * (float)raw[3];
+  m_accel[1] = ACCEL_SCALE * (float)raw[4];
+  m_accel[2] = ACCEL_SCALE * (float)raw[5];
+
+  if (measureVibration) {
+    havs_addSample(m_accel[0], m_accel[1], m_accel[2]);
+  }
+
+  return activity_update(m_accel[0], m_accel[1], m_accel[2], now);
+}
+
+static void processMag(const int16_t *raw, float deltaT) {
+  m_mag[0] = MAG_SCALE * (float)raw[0];
+  m_mag[1] = MAG_SCALE * (float)raw[1];
+  m_mag[2] = MAG_SCALE * (float)raw[2];
+  m_fusion.MadgwickUpdate(m_gyro[0], m_gyro[1], m_gyro[2], m_accel[0], m_accel[1], m_accel[2], m_mag[0], m_mag[1], m_mag[2], deltaT);
+}
+
+/*
+ * Start of a FIFO slice. Vibration exposure is only measured while moving, as the weighting filters are designed for full ODR.
+ * When the hand is still there is no vibration, so no exposure is missed.
+ */
+static void startSlice(uint8_t fifoSrc) {
+  m_fifoLevels = fifoSrc & FIFO_SRC_FSS_MASK;
+  m_measureVibration = (activity_getProfile() == activity_profile_moving);
+}
+
+/*
+ * Raw gyro x, y, z then accel x, y, z for the oldest unread FIFO level. Returns true if the activity profile has changed
+ */
+static bool processLevel(const int16_t *raw, unsigned long now) {
+  if (m_fifoLevels > 0) {
+    m_fifoLevels--;
+  }
+
+  bool stale = (m_staleLevels > 0);
+  if (stale) {
+    m_staleLevels--;
+  }
+
+  if (!processImu(raw, m_measureVibration && !stale, now)) {
+    return false;
+  }
+
+  m_staleLevels = m_fifoLevels; //Samples still in FIFO were taken at the old rate
+  return true;
+}
+
+/*
+ * Reads as many levels as fit before the next ADAF1080 sample, up to FIFO_MAX_SLICE. Returns the number still left in the FIFO
+ */
+static int readFifo(void) {
+  uint8_t fifoSrc;
+  {
+    PROFILE_ZONE("lsm9ds1 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+    fifoSrc = m_sensor.read8(XGTYPE, REG_FIFO_SRC);
+  }
+
+  uint64_t srcTime = timebase_now();
+  trace_record(trace_source_lsm9ds1Fifo, &fifoSrc, sizeof(fifoSrc));
+  if (fifoSrc & FIFO_SRC_OVRN) {
+    ERROR("FIFO overrun, vibration samples lost");
+  }
+
+  startSlice(fifoSrc);
+  float sampleRate = getSampleRate(activity_getProfile()); //Rate the levels in the FIFO were taken at, even if the profile changes part way
+  int nSamples = (m_fifoLevels < FIFO_MAX_SLICE) ? m_fifoLevels : FIFO_MAX_SLICE;
+
+  Adafruit_BusIO_Register fifoData(m_pI2cDev, REG_OUT_X_L_G, FIFO_LEVEL_LEN);
+  unsigned long now = millis();
+  int i;
+  for (i = 0; (i < nSamples) && i2cbus_hasTime(i2cbus_device_lsm9ds1); i++) {
+    uint8_t level[FIFO_LEVEL_LEN];
+    bool ok;
+    {
+      PROFILE_ZONE("lsm9ds1 I2C");
+      I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+      ok = fifoData.read(level, FIFO_LEVEL_LEN);
+    }
+
+    if (!ok) {
+      i2cbus_reportResult(i2cbus_device_lsm9ds1, false);
+      break;
+    }
+
+    int16_t raw[6]; //ESP32 is little endian, same as sensor
+    memcpy(&raw[0], &level[FIFO_GYRO_OFFSET], 3 * sizeof(int16_t));
+    memcpy(&raw[3], &level[FIFO_ACCEL_OFFSET], 3 * sizeof(int16_t));
+    trace_record(trace_source_lsm9ds1Imu, raw, sizeof(raw));
+    if (processLevel(raw, now)) {
+      applyProfile(activity_getProfile());
+    }
+  }
+
+  /*
+   * Newest sample read was taken within one ODR period before FIFO_SRC was read, plus one period for each level left in the FIFO
+   */
+  m_fifoTime = srcTime - (uint64_t)(1000000.0f * (float)m_fifoLevels / sampleRate);
+  return m_fifoLevels;
+}
+
+static void updateFusion(void) {
+  {
+    PROFILE_ZONE("lsm9ds1 I2C");
+    I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+    m_sensor.readMag(); //Magnetometer is not part of the FIFO
+  }
+
+  int16_t raw[3] = { m_sensor.magData.x, m_sensor.magData.y, m_sensor.magData.z };
+  trace_record(trace_source_lsm9ds1Mag, raw, sizeof(raw));
+
+  m_fusionTime = m_fifoTime; //Accel and gyro are the newest from FIFO, mag was read just after
+  processMag(raw, m_fusion.deltatUpdate());
+}
+
 void lsm9ds1_loop(void) {
+  PROFILE_ZONE("lsm9ds1_loop");
+  if (!m_ready) {
+    return;
+  }
+
+  if (m_requestExposureReset) { //BTC_TASK thread has requested a new shift
+    m_requestExposureReset = false;
+    havs_resetExposure();
+    commitExposure((uint32_t)time(NULL));
+    uint8_t temp = 0;
+    m_resetExposureCharacteristic.setValue(&temp, 1); //Set value back to '0' when reset is complete
+    m_resetExposureWrapper.notify();
+    m_exposureWrapper.writeValue(havs_getDailyExposure());
+  }
+
+  if (!i2cbus_acquireSlice(i2cbus_device_lsm9ds1)) {
+    return; //Bus would delay next ADAF1080 sample, try again after it
+  }
+
+  int fifoRemaining = readFifo(); //Must be drained faster than it fills (32 samples at 952Hz = 33ms)
+  i2cbus_release(i2cbus_device_lsm9ds1);
+  if (fifoRemaining > 0) {
+    idle_wakeAfter(0); //Rest of the FIFO is read after the next ADAF1080 sample, then fusion uses the newest samples
+    return;
+  }
+
+  /*
+   * ODR change, magnetometer and health check are a separate, shorter slice
+   */
+  activity_profile_t profile = activity_getProfile();
   unsigned long now = millis();
-  if (m_ready && (now - m_lastTime >= SAMPLE_TIME)) {
-    m_lastTime = now;
+  bool configChanged = (config_getGeneration() != m_configGeneration);
+  bool fusionDue = (now - m_lastFusionTime >= getFusionTime(profile));
+  bool healthDue = (now - m_lastHealthTime >= HEALTH_CHECK_TIME);
+  if (configChanged || fusionDue || healthDue) {
+    if (!i2cbus_acquire(i2cbus_device_lsm9ds1)) {
+      return; //Try again after the next ADAF1080 sample
+    }
 
-    sensors_event_t a, m, g, t;
-    if (!m_sensor.getEvent(&a, &m, &g, &t)) {
-      ERROR("Error reading sensor");
-      return;
+    if (configChanged) {
+      m_configGeneration = config_getGeneration();
+      applyProfile(profile); //ODR may have changed. Fusion and report times are read from config as they are needed
+    }
+
+    if (fusionDue) {
+      m_lastFusionTime = now;
+      updateFusion();
     }
 
-    float deltaT = m_fusion.deltatUpdate();
-    m_fusion.MadgwickUpdate(g.gyro.x, g.gyro.y, g.gyro.z, a.acceleration.x, a.acceleration.y, a.acceleration.z, m.magnetic.x, m.magnetic.y, m.magnetic.z, deltaT);
+    if (healthDue) {
+      m_lastHealthTime = now;
+      bool ok;
+      {
+        PROFILE_ZONE("lsm9ds1 I2C");
+        I2CBUS_TRANSFER(i2cbus_device_lsm9ds1);
+        ok = (m_sensor.read8(XGTYPE, REG_WHO_AM_I) == WHO_AM_I_VALUE);
+      }
+
+      i2cbus_reportResult(i2cbus_device_lsm9ds1, ok);
+    }
+
+    i2cbus_release(i2cbus_device_lsm9ds1);
+  }
+
+  if (now - m_lastTime >= getReportTime(profile)) {
+    m_lastTime = now;
+    updateExposure();
+
     float pitch = m_fusion.getPitchRadians();
     float roll = m_fusion.getRollRadians();
     float yaw = m_fusion.getYawRadians();
 
-    m_accelXWrapper.writeValue(a.acceleration.x);
-    m_accelYWrapper.writeValue(a.acceleration.y);
-    m_accelZWrapper.writeValue(a.acceleration.z);
-    m_magXWrapper.writeValue(m.magnetic.x);
-    m_magYWrapper.writeValue(m.magnetic.y);
-    m_magZWrapper.writeValue(m.magnetic.z);
-    m_gyroXWrapper.writeValue(g.gyro.x);
-    m_gyroYWrapper.writeValue(g.gyro.y);
-    m_gyroZWrapper.writeValue(g.gyro.z);
+    m_accelXWrapper.writeValue(m_accel[0]);
+    m_accelYWrapper.writeValue(m_accel[1]);
+    m_accelZWrapper.writeValue(m_accel[2]);
+    m_magXWrapper.writeValue(m_mag[0]);
+    m_magYWrapper.writeValue(m_mag[1]);
+    m_magZWrapper.writeValue(m_mag[2]);
+    m_gyroXWrapper.writeValue(m_gyro[0]);
+    m_gyroYWrapper.writeValue(m_gyro[1]);
+    m_gyroZWrapper.writeValue(m_gyro[2]);
     m_pitchWrapper.writeValue(pitch);
     m_rollWrapper.writeValue(roll);
     m_yawWrapper.writeValue(yaw);
+    m_vibrationWrapper.writeValue(havs_getVibration());
+    m_exposureWrapper.writeValue(havs_getDailyExposure());
+    m_movingWrapper.writeValue(profile == activity_profile_moving);
+
+    datalog_write(datalog_type_orientation, pitch, roll, yaw);
+
+    float frameValues[FRAME_NUM_VALUES] = { pitch, roll, yaw };
+    uint8_t frame[TIMEBASE_FRAME_LEN(FRAME_NUM_VALUES)];
+    int frameLen = timebase_packFrame(frame, m_fusionTime, frameValues, FRAME_NUM_VALUES);
+    m_frameCharacteristic.setValue(frame, frameLen);
+    m_frameWrapper.notify();
+    datalog_write(datalog_type_vibration, havs_getVibration(), havs_getDailyExposure(), (profile == activity_profile_moving) ? 1.0f : 0.0f);
+  }
+
+  unsigned long fusionRemaining = getFusionTime(profile) - (now - m_lastFusionTime);
+  unsigned long sampleRemaining = getReportTime(profile) - (now - m_lastTime);
+  idle_wakeAfter(1000UL * ((fusionRemaining < sampleRemaining) ? fusionRemaining : sampleRemaining));
+}
+
+/*
+ * Trace replay: restarts filters and fusion as if the sensor had just been initialised
+ */
+void lsm9ds1_replayStart(void) {
+  activity_init(getSampleRate(activity_profile_moving));
+  havs_init(getSampleRate(activity_profile_moving));
+  m_fusion = SF();
+  m_fifoLevels = 0;
+  m_staleLevels = 0;
+}
+
+/*
+ * Trace replay: start of a FIFO slice, from the recorded FIFO_SRC
+ */
+void lsm9ds1_replayFifo(uint8_t fifoSrc) {
+  startSlice(fifoSrc);
+}
+
+/*
+ * Trace replay: one FIFO level, through the same processing as readFifo(). Returns true if the activity profile has changed
+ */
+bool lsm9ds1_replayImu(const int16_t *raw, unsigned long now) {
+  if (!processLevel(raw, now)) {
+    return false;
   }
+
+  setFilterRate(activity_getProfile());
+  return true;
+}
+
+/*
+ * Trace replay: one fusion update, with deltaT from recorded timestamps. Fills pResults (LSM9DS1_NUM_RESULTS values)
+ */
+void lsm9ds1_replayMag(const int16_t *raw, float deltaT, float *pResults) {
+  processMag(raw, deltaT);
+  pResults[0] = m_fusion.getPitchRadians();
+  pResults[1] = m_fusion.getRollRadians();
+  pResults[2] = m_fusion.getYawRadians();
+  pResults[3] = havs_getVibration();
+}
+
+static void benchImu(uint32_t iteration) {
+  int16_t raw[6] = { 0, 0, 0, (int16_t)(iteration & 0xFF), 0, 2048 }; //About 1g on Z at 16g range, with some motion on X
+  bench_keep((float)processImu(raw, true, millis()));
+}
+
+static void benchMadgwick(uint32_t iteration) {
+  float wobble = 0.001f * (float)(iteration & 0xFF);
+  m_fusion.MadgwickUpdate(wobble, 0.0f, 0.0f, 0.0f, 0.0f, 9.81f, 20.0f, 0.0f, -40.0f, 0.02f); //Angles are only computed when reported, so not included
+  bench_keep(wobble);
+}
+
+void lsm9ds1_bench(void) {
+  lsm9ds1_replayStart();
+  bench_run("lsm9ds1 activity/HAVS update", benchImu);
+  bench_run("MadgwickUpdate", benchMadgwick);
 }
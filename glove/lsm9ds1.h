@@ -9,10 +9,18 @@
 #ifndef __LSM9DS1_H
 #define __LSM9DS1_H
 
+#include <stdint.h>
 #include <BLEServer.h>
 
+#define LSM9DS1_NUM_RESULTS 4 //Pitch, roll, yaw (rad), ahv (m/s^2)
+
 bool lsm9ds1_init(void);
 bool lsm9ds1_addService(BLEServer *pServer);
 void lsm9ds1_loop(void);
+void lsm9ds1_replayStart(void);
+void lsm9ds1_replayFifo(uint8_t fifoSrc);
+bool lsm9ds1_replayImu(const int16_t *raw, unsigned long now);
+void lsm9ds1_replayMag(const int16_t *raw, float deltaT, float *pResults);
+void lsm9ds1_bench(void);
 
 #endif /* __LSM9DS1_H */
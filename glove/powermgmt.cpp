@@ -12,16 +12,24 @@
 #include <Arduino.h>
 
 #include "driver/rtc_io.h"
+#include "powermgmt.h"
+#include "energy.h"
+#include "profile.h"
 #include "err.h"
 
 #define DCDC_EN_PIN 12 //5V boost converter enable pin
 #define BTTN_PIN 38
 #define BTTN_PIN_MASK (1ULL << BTTN_PIN)
 #define DEBOUNCE_TIME 100 //ms
+#define MAX_SLEEP_CALLBACKS 8
 
 static bool m_lastState = HIGH;
 static bool m_released = false;
 static unsigned long m_debounceStartTime;
+static unsigned long m_dcdcOnTime;
+
+static powermgmt_callback_t m_sleepCallbacks[MAX_SLEEP_CALLBACKS];
+static int m_numSleepCallbacks = 0;
 
 void powermgmt_init(void) {
   pinMode(NEOPIXEL_I2C_POWER, OUTPUT);
@@ -30,6 +38,8 @@ void powermgmt_init(void) {
 
   digitalWrite(NEOPIXEL_I2C_POWER, HIGH);
   digitalWrite(DCDC_EN_PIN, HIGH);
+  m_dcdcOnTime = millis();
+  energy_setDcdc(true);
 
   /*
    * Take pins out of hold mode, in case we are waking from deep sleep
@@ -51,10 +61,36 @@ void powermgmt_init(void) {
   }
 }
 
+/*
+ * Returns time (from millis()) that 5V boost converter was switched on
+ */
+unsigned long powermgmt_getDcdcOnTime(void) {
+  return m_dcdcOnTime;
+}
+
+bool powermgmt_addSleepCallback(powermgmt_callback_t callback) {
+  if (m_numSleepCallbacks >= MAX_SLEEP_CALLBACKS) {
+    ERROR("Too many sleep callbacks");
+    return false;
+  }
+
+  m_sleepCallbacks[m_numSleepCallbacks++] = callback;
+  return true;
+}
+
 static void goToSleep(void) {
+  /*
+   * Give modules a chance to save any state they need after wake. Sensors are still powered at this point
+   */
+  int i;
+  for (i = 0; i < m_numSleepCallbacks; i++) {
+    m_sleepCallbacks[i]();
+  }
+
   Serial.println("Powering down! Zzzzzzz");
   digitalWrite(NEOPIXEL_I2C_POWER, LOW); //Power down I2C sensors
   digitalWrite(DCDC_EN_PIN, LOW); //Power down 5V boost converter
+  energy_setDcdc(false);
 
   /*
    * Make sure pins keep their state in deep sleep mode
@@ -69,6 +105,7 @@ static void goToSleep(void) {
 }
 
 void powermgmt_loop(void) {
+  PROFILE_ZONE("powermgmt_loop");
   bool state = digitalRead(BTTN_PIN);
   if ((m_lastState == LOW) && (state == HIGH)) { //Rising edge, button released
     m_released = true;
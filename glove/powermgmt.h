@@ -9,7 +9,11 @@
 #ifndef __POWERMGMT_H
 #define __POWERMGMT_H
 
+typedef void (*powermgmt_callback_t)(void);
+
 void powermgmt_init(void);
 void powermgmt_loop(void);
+bool powermgmt_addSleepCallback(powermgmt_callback_t callback);
+unsigned long powermgmt_getDcdcOnTime(void);
 
 #endif /* __POWERMGMT_H */
@@ -0,0 +1,307 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module records where the main loop spends its time, so that a single slow iteration can be inspected in a timeline viewer.
+ * It is only active in profiling builds (PROFILE_ENABLE).
+ *
+ * PROFILE_ZONE() marks a scope: module loops, SPI and I2C transactions, BLE notifications and BSEC runs. Each zone is timed with the
+ * CPU cycle counter and written to a fixed ring of the most recent RING_SIZE zones when it ends. Zones are only used from the main loop,
+ * so the ring needs no locking. The error task's notifications are not profiled for this reason.
+ *
+ * Power management (see idle.cpp) drops the CPU clock whenever the loop task blocks, which includes waits inside I2C and SPI transactions,
+ * so cycles would not convert to time at any single rate. Profiling builds hold the clock at maximum instead. This costs power, so energy
+ * figures from a profiling build are not representative.
+ *
+ * The ring is frozen and dumped when a loop iteration takes longer than any before it (and at least TRIGGER_MIN_TIME), or when the
+ * client writes '1' to the profile characteristic. Loop triggers dump to Serial. Client triggers stream to the client in notifications,
+ * filled up to the negotiated MTU. Either way the dump is Chrome trace event JSON (array format, one complete event per zone), which
+ * loads straight into chrome://tracing or Perfetto. The dump is paced so that it doesn't stall the loop, and no zones are recorded until
+ * it has finished.
+ */
+
+#define ERR_MODULE_NAME "Profile"
+
+#include <stdio.h>
+#include <string.h>
+#include <Arduino.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+#if PROFILE_ENABLE
+#include <esp_pm.h>
+#endif
+
+#include "blewrapper.h"
+#include "profile.h"
+#include "timebase.h"
+#include "err.h"
+
+#if PROFILE_ENABLE
+#define RING_SIZE 1024 //Zones, power of 2. About 12kB
+#else
+#define RING_SIZE 1 //Other builds don't record zones, so don't need the RAM
+#endif
+
+#define TRIGGER_MIN_TIME 10000 //us, shortest loop iteration worth dumping
+#define MAX_LINE_LEN 128
+#define STREAM_INTERVAL 10 //milliseconds between bursts of notifications, so the BLE stack's queue doesn't overflow
+#define FRAMES_PER_BURST 4
+#define ATT_HEADER_LEN 3 //Opcode and handle in each notification
+#define ATT_MAX_VALUE_LEN 512
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS 1
+
+#define BLE_SERVICE_UUID BLEUUID("8d2f6a4c-9e1b-4c57-a3d8-5f7b2e1c9a63")
+#define TRACE_UUID BLEUUID("3b7e1d9a-6c4f-4a28-9b5e-2d8f1a6c4e97")
+#define TRACE_FORMAT BLE2904::FORMAT_OPAQUE
+#define TRACE_EXPONENT 0
+#define TRACE_UNIT BLEUnit::Unitless
+#define TRACE_NAME "Profile trace"
+
+typedef struct {
+  const char *name;
+  uint32_t start; //Cycle counter
+  uint32_t cycles;
+} zone_t;
+
+typedef enum {
+  dump_target_none = 0,
+  dump_target_serial,
+  dump_target_ble
+} dump_target_t;
+
+static BLECharacteristic m_traceCharacteristic(TRACE_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_traceWrapper(&m_traceCharacteristic, TRACE_NAME, TRACE_FORMAT, TRACE_EXPONENT, TRACE_UNIT);
+
+static BLEServer *m_pServer = NULL;
+
+static zone_t m_ring[RING_SIZE];
+static uint32_t m_head = 0; //Next slot to write
+static uint32_t m_count = 0;
+static bool m_frozen = false;
+static unsigned long m_worstLoop = TRIGGER_MIN_TIME;
+
+static volatile bool m_dumpRequested = false;
+static dump_target_t m_dumpTarget = dump_target_none;
+static int m_dumpLine; //-1 is the opening line, then one line per zone, then the closing line
+static uint32_t m_freezeCycles; //Cycle counter and timebase when frozen, to turn zone start times into timestamps
+static uint64_t m_freezeTime;
+static uint32_t m_cpuMhz;
+#if PROFILE_ENABLE
+static esp_pm_lock_handle_t m_cpuLock = NULL;
+#endif
+static unsigned long m_lastStreamTime;
+static char m_frame[ATT_MAX_VALUE_LEN];
+
+class TraceCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    if ((pCharacteristic == NULL) || (pCharacteristic->getLength() < 1)) {
+      return;
+    }
+
+    if (pCharacteristic->getData()[0]) { //Client writes '1' to request a dump
+      m_dumpRequested = true; //Callback runs in BLE thread, so freeze from main loop
+    }
+  }
+};
+
+void profile_addZone(const char *name, uint32_t start, uint32_t cycles) {
+  if (m_frozen) {
+    return;
+  }
+
+  zone_t *pZone = &(m_ring[m_head]);
+  pZone->name = name;
+  pZone->start = start;
+  pZone->cycles = cycles;
+  m_head = (m_head + 1) & (RING_SIZE - 1);
+  if (m_count < RING_SIZE) {
+    m_count++;
+  }
+}
+
+void profile_init(void) {
+  m_head = m_count = 0;
+  m_frozen = false;
+#if PROFILE_ENABLE
+  if (m_cpuLock == NULL) {
+    if ((esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "profile", &m_cpuLock) != ESP_OK) || (esp_pm_lock_acquire(m_cpuLock) != ESP_OK)) {
+      ERROR("Cannot hold CPU clock at maximum, zone times will be short while the clock is scaled down");
+    }
+  }
+#endif
+
+  m_cpuMhz = getCpuFrequencyMhz(); //After taking the lock, so this is the rate zones are timed at
+}
+
+bool profile_addService(BLEServer *pServer) {
+  if (!PROFILE_ENABLE) {
+    return true; //Nothing to dump
+  }
+
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    ERROR("Cannot add BLE service");
+    return false;
+  }
+
+  m_traceCharacteristic.setCallbacks(new TraceCallbacks());
+  pService->addCharacteristic(&m_traceCharacteristic);
+  pService->start();
+  m_pServer = pServer;
+  return true;
+}
+
+static void freeze(dump_target_t target) {
+  m_frozen = true;
+  m_freezeCycles = esp_cpu_get_cycle_count();
+  m_freezeTime = timebase_now();
+  m_dumpTarget = target;
+  m_dumpLine = -1;
+  m_lastStreamTime = millis();
+}
+
+static void unfreeze(void) {
+  m_dumpTarget = dump_target_none;
+  m_head = m_count = 0; //Start afresh, so the next dump only shows zones after this one
+  m_frozen = false;
+}
+
+/*
+ * Formats the next line of the dump. Returns its length, or 0 when the dump is complete
+ */
+static int formatLine(char *line) {
+  int zones = (int)m_count;
+  if (m_dumpLine > zones) {
+    return 0;
+  }
+
+  int len;
+  if (m_dumpLine < 0) {
+    len = snprintf(line, MAX_LINE_LEN, "[{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"main loop\"}}");
+  } else if (m_dumpLine == zones) {
+    len = snprintf(line, MAX_LINE_LEN, "]\n");
+  } else {
+    const zone_t *pZone = &(m_ring[(m_head - m_count + m_dumpLine) & (RING_SIZE - 1)]); //Oldest first
+    double age = (double)(m_freezeCycles - pZone->start) / (double)m_cpuMhz; //us before freeze. Cycle counter wraps every 17s at 240MHz, far longer than the ring lasts
+    double ts = (double)m_freezeTime - age;
+    double dur = (double)pZone->cycles / (double)m_cpuMhz;
+    len = snprintf(line, MAX_LINE_LEN, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}", pZone->name, ts, dur);
+  }
+
+  m_dumpLine++;
+  return (len < MAX_LINE_LEN) ? len : (MAX_LINE_LEN - 1);
+}
+
+/*
+ * Writes as much as Serial can take without blocking
+ */
+static void dumpSerial(void) {
+  char line[MAX_LINE_LEN];
+  while (Serial.availableForWrite() >= MAX_LINE_LEN) {
+    if (m_dumpLine < 0) {
+      Serial.println("Profile trace (Chrome trace event JSON):");
+    }
+
+    int len = formatLine(line);
+    if (len == 0) {
+      Serial.println("End of profile trace");
+      unfreeze();
+      return;
+    }
+
+    Serial.write((const uint8_t *)line, len);
+  }
+}
+
+/*
+ * Sends the next frame of the dump, filled up to the negotiated MTU. Returns false when the dump is complete
+ */
+static bool sendFrame(void) {
+  int mtu = m_pServer->getPeerMTU(m_pServer->getConnId());
+  int maxLen = mtu - ATT_HEADER_LEN;
+  if (maxLen > ATT_MAX_VALUE_LEN) {
+    maxLen = ATT_MAX_VALUE_LEN;
+  }
+
+  if (maxLen < MAX_LINE_LEN) {
+    ERROR("MTU too small for profile dump");
+    return false;
+  }
+
+  int frameLen = 0;
+  char line[MAX_LINE_LEN];
+  while (frameLen + MAX_LINE_LEN <= maxLen) { //Only whole lines, so a line never has to be held over to the next frame
+    int len = formatLine(line);
+    if (len == 0) {
+      break;
+    }
+
+    memcpy(&(m_frame[frameLen]), line, len);
+    frameLen += len;
+  }
+
+  if (frameLen == 0) {
+    return false;
+  }
+
+  m_traceCharacteristic.setValue((uint8_t *)m_frame, frameLen);
+  m_traceWrapper.notify();
+  return true;
+}
+
+static void dumpBle(void) {
+  if ((m_pServer == NULL) || (m_pServer->getConnectedCount() == 0) || !m_traceWrapper.isSubscribed()) {
+    unfreeze(); //Client has gone, nobody to send to
+    return;
+  }
+
+  unsigned long now = millis();
+  if (now - m_lastStreamTime < STREAM_INTERVAL) {
+    return;
+  }
+
+  m_lastStreamTime = now;
+  int i;
+  for (i = 0; i < FRAMES_PER_BURST; i++) {
+    if (!sendFrame()) {
+      unfreeze();
+      return;
+    }
+  }
+}
+
+void profile_loop(void) {
+  if (!PROFILE_ENABLE) {
+    return;
+  }
+
+  if (m_dumpRequested && (m_dumpTarget == dump_target_none)) {
+    m_dumpRequested = false;
+    freeze(dump_target_ble);
+  }
+
+  if (m_dumpTarget == dump_target_serial) {
+    dumpSerial();
+  } else if (m_dumpTarget == dump_target_ble) {
+    dumpBle();
+  }
+}
+
+/*
+ * Called at the end of each main loop iteration, with its length in us
+ */
+void profile_endLoop(unsigned long duration) {
+  if (!PROFILE_ENABLE || m_frozen || (duration <= m_worstLoop)) {
+    return;
+  }
+
+  m_worstLoop = duration; //Only dump again for a longer iteration
+  ERROR("Loop took %luus, dumping profile", duration);
+  freeze(dump_target_serial);
+}
@@ -0,0 +1,50 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+#include <esp_cpu.h>
+#include <BLEServer.h>
+
+/*
+ * Build option, add -DPROFILE_ENABLE=1 to build flags. Normal builds compile zones away
+ */
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 0
+#endif
+
+void profile_init(void);
+bool profile_addService(BLEServer *pServer);
+void profile_loop(void);
+void profile_endLoop(unsigned long duration);
+void profile_addZone(const char *name, uint32_t start, uint32_t cycles);
+
+#if PROFILE_ENABLE
+/*
+ * Times from construction to end of scope. Name must be a string literal, as only the pointer is kept
+ */
+class ProfileZone {
+  private:
+    const char *m_name;
+    uint32_t m_start;
+
+  public:
+    ProfileZone(const char *name) : m_name(name), m_start(esp_cpu_get_cycle_count()) {}
+    ~ProfileZone() { profile_addZone(m_name, m_start, esp_cpu_get_cycle_count() - m_start); }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,56 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module keeps runtime state that is expensive to rebuild in RTC slow memory, which survives deep sleep (and software resets)
+ * but not power loss. On wake, modules pick up where they left off instead of starting cold, e.g. ADAF1080 doesn't need recalibrating,
+ * AS7341 auto-exposure starts from the last gain, and vibration exposure carries on through the shift.
+ *
+ * Modules update their part of the state whenever it changes, then call retained_commit(). The block carries a version number and CRC,
+ * so garbage after power-on or state from an older firmware layout is ignored.
+ */
+
+#include <Arduino.h>
+#include <rom/crc.h>
+
+#include "retained.h"
+
+#define RETAINED_VERSION 3 //Increment whenever retained_state_t changes
+
+typedef struct {
+  uint32_t version;
+  retained_state_t state;
+  uint32_t crc;
+} retained_block_t;
+
+RTC_DATA_ATTR static retained_block_t m_block;
+static bool m_valid = false;
+
+static uint32_t calcCrc(void) {
+  return crc32_le(0, (const uint8_t *)&m_block, offsetof(retained_block_t, crc));
+}
+
+void retained_init(void) {
+  m_valid = (m_block.version == RETAINED_VERSION) && (m_block.crc == calcCrc());
+  if (!m_valid) {
+    memset(&m_block, 0, sizeof(m_block));
+    m_block.version = RETAINED_VERSION;
+    m_block.crc = calcCrc();
+  }
+}
+
+bool retained_isValid(uint32_t flag) {
+  return m_valid && ((m_block.state.flags & flag) != 0);
+}
+
+retained_state_t * retained_get(void) {
+  return &(m_block.state);
+}
+
+void retained_commit(uint32_t flag) {
+  m_block.state.flags |= flag;
+  m_block.crc = calcCrc();
+}
@@ -0,0 +1,38 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __RETAINED_H
+#define __RETAINED_H
+
+#include <stdint.h>
+
+/*
+ * Flags showing which parts of the retained state have been written
+ */
+#define RETAINED_ADAF1080 (1 << 0)
+#define RETAINED_AS7341   (1 << 1)
+#define RETAINED_BATTERY  (1 << 2)
+#define RETAINED_HAVS     (1 << 3)
+
+typedef struct {
+  uint32_t flags;
+  int32_t adaf1080Offset;   //ADC counts
+  uint8_t as7341GainIndex;
+  uint16_t as7341Astep;
+  float batterySoc;         //percent
+  float batteryCurrent;     //mA, average
+  double havsEnergy;        //(m/s^2)^2 * s, accumulated vibration exposure
+  uint32_t havsTime;        //seconds from time(), when exposure last increased
+} retained_state_t;
+
+void retained_init(void);
+bool retained_isValid(uint32_t flag);
+retained_state_t * retained_get(void);
+void retained_commit(uint32_t flag);
+
+#endif /* __RETAINED_H */
@@ -0,0 +1,107 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module estimates battery state of charge (SoC) and remaining runtime. Two estimates are combined:
+ *
+ *    - Open circuit voltage (OCV): terminal voltage is corrected for the drop across the cell's internal resistance at the
+ *      estimated load current, then looked up in a LiPo discharge curve. Absolute, but noisy and affected by load transients
+ *    - Integrated consumption: estimated load current is integrated over time. Smooth, but drifts as the current is only an estimate
+ *
+ * The integrated estimate is pulled slowly towards the OCV estimate, so short term changes follow the consumption model and long
+ * term accuracy comes from the discharge curve. Runtime is the remaining charge divided by the average load current.
+ */
+
+#include <math.h>
+
+#include "soc.h"
+
+#define BATTERY_CAPACITY 1200.0f //mAh, must match the fitted cell
+#define INTERNAL_RESISTANCE 0.15f //ohms, cell plus protection circuit and wiring
+#define CORRECTION_TIME_CONSTANT 600.0f //seconds, how quickly integrated estimate follows OCV estimate
+#define CURRENT_TIME_CONSTANT 300.0f //seconds, averaging for runtime prediction
+#define REANCHOR_THRES 10.0f //percent, about one step of the discharge curve
+#define SECONDS_PER_HOUR 3600.0f
+#define MINUTES_PER_HOUR 60.0f
+
+/*
+ * Typical LiPo discharge curve at low rate (open circuit voltage against SoC). Declared const so that it is stored in flash rather
+ * than RAM. Voltage must be increasing.
+ */
+#define NUM_OCV_POINTS 12
+
+static const float OCV_VOLTAGE[NUM_OCV_POINTS] = { 3.27f, 3.45f, 3.68f, 3.74f, 3.77f, 3.79f, 3.82f, 3.87f, 3.92f, 3.98f, 4.06f, 4.20f };
+static const float OCV_SOC[NUM_OCV_POINTS] = { 0.0f, 5.0f, 10.0f, 20.0f, 30.0f, 40.0f, 50.0f, 60.0f, 70.0f, 80.0f, 90.0f, 100.0f };
+
+static float m_soc = 0.0f; //percent
+static float m_avgCurrent = 0.0f; //mA
+
+static float lookupOcv(float vbat, float current) {
+  float ocv = vbat + 0.001f * current * INTERNAL_RESISTANCE; //Load compensation: terminal voltage is lower than OCV under load
+  if (ocv <= OCV_VOLTAGE[0]) {
+    return OCV_SOC[0];
+  }
+
+  int i;
+  for (i = 1; i < NUM_OCV_POINTS; i++) {
+    if (ocv < OCV_VOLTAGE[i]) {
+      float frac = (ocv - OCV_VOLTAGE[i - 1]) / (OCV_VOLTAGE[i] - OCV_VOLTAGE[i - 1]);
+      return OCV_SOC[i - 1] + frac * (OCV_SOC[i] - OCV_SOC[i - 1]);
+    }
+  }
+
+  return OCV_SOC[NUM_OCV_POINTS - 1];
+}
+
+void soc_init(float vbat, float current) {
+  m_soc = lookupOcv(vbat, current);
+  m_avgCurrent = current;
+}
+
+/*
+ * Restore state saved before deep sleep, so that integrated consumption carries on. If the battery voltage on waking disagrees with
+ * the saved SoC by more than REANCHOR_THRES (e.g. charged while asleep), start again from the discharge curve instead
+ */
+void soc_restore(float soc, float avgCurrent, float vbat) {
+  m_avgCurrent = avgCurrent;
+  float ocvSoc = lookupOcv(vbat, avgCurrent);
+  m_soc = (fabsf(ocvSoc - soc) > REANCHOR_THRES) ? ocvSoc : soc;
+}
+
+void soc_update(float vbat, float current, float dt) {
+  m_soc -= 100.0f * current * dt / (BATTERY_CAPACITY * SECONDS_PER_HOUR);
+
+  float alpha = dt / (CORRECTION_TIME_CONSTANT + dt);
+  m_soc += alpha * (lookupOcv(vbat, current) - m_soc);
+  if (m_soc < 0.0f) {
+    m_soc = 0.0f;
+  } else if (m_soc > 100.0f) {
+    m_soc = 100.0f;
+  }
+
+  alpha = dt / (CURRENT_TIME_CONSTANT + dt);
+  m_avgCurrent += alpha * (current - m_avgCurrent);
+}
+
+float soc_getLevel(void) {
+  return m_soc;
+}
+
+float soc_getAverageCurrent(void) {
+  return m_avgCurrent;
+}
+
+/*
+ * Returns estimated runtime to empty in minutes
+ */
+float soc_getRuntime(void) {
+  if (m_avgCurrent <= 0.0f) {
+    return 0.0f;
+  }
+
+  float remaining = BATTERY_CAPACITY * m_soc / 100.0f; //mAh
+  return MINUTES_PER_HOUR * remaining / m_avgCurrent;
+}
@@ -0,0 +1,19 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __SOC_H
+#define __SOC_H
+
+void soc_init(float vbat, float current);
+void soc_restore(float soc, float avgCurrent, float vbat);
+void soc_update(float vbat, float current, float dt);
+float soc_getLevel(void);
+float soc_getAverageCurrent(void);
+float soc_getRuntime(void);
+
+#endif /* __SOC_H */
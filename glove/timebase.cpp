@@ -0,0 +1,210 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module provides a common timebase for all sensor data, so that readings from different sensors can be lined up.
+ *
+ * Device time is the ESP32's 64 bit microsecond timer, which counts from boot and never wraps. Modules stamp each reading when it is
+ * taken (or as close as the sensor allows) and send the stamp at the start of a packed frame: timestamp (uint64, us) followed by the
+ * values (float32), all little endian. Frames carry at most 3 values so that they fit in a notification at the default MTU.
+ *
+ * To convert device time to its own clock, the client periodically writes its current time (uint64, us) to the time sync
+ * characteristic. Each write gives one sample of the offset between the clocks. A straight line fitted through recent samples gives
+ * offset and drift, which are published on the same characteristic as:
+ *
+ *    Reference device time (uint64, us)
+ *    Offset at reference time (int64, us): client time = device time + offset
+ *    Drift (int32, parts per billion): offset changes by drift * (device time - reference time)
+ *
+ * Every sample is late by the BLE latency, which varies from one connection interval to the next. Samples well below the fitted line
+ * were delayed more than the others, so they are dropped and the line is fitted again.
+ */
+
+#define ERR_MODULE_NAME "Timebase"
+
+#include <string.h>
+#include <esp_timer.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+
+#include "blewrapper.h"
+#include "timebase.h"
+#include "profile.h"
+#include "err.h"
+
+#define MAX_SYNC_POINTS 16
+#define LATENCY_REJECT 2000.0 //us, drop samples delayed this much more than the fit
+#define US_PER_S 1.0e6
+#define PPB_PER_PPM 1000.0
+
+#define SYNC_LEN 20 //Reference time (uint64), offset (int64), drift (int32)
+
+#define BLE_INST_ID 0
+#define NUM_CHARACTERISTICS 1
+
+#define BLE_SERVICE_UUID BLEUUID("c5e3a8d1-7b2f-4e94-a6c0-8d1f3b7e5a29")
+#define SYNC_UUID BLEUUID("f2b7d4e9-1c6a-4b38-9e5d-7a3c8f1b6d42")
+#define SYNC_FORMAT BLE2904::FORMAT_OPAQUE
+#define SYNC_EXPONENT 0
+#define SYNC_UNIT BLEUnit::Unitless
+#define SYNC_NAME "Time sync"
+
+typedef struct {
+  uint64_t local;
+  int64_t offset;
+} sync_point_t;
+
+static BLECharacteristic m_syncCharacteristic(SYNC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+static BLEWrapper m_syncWrapper(&m_syncCharacteristic, SYNC_NAME, SYNC_FORMAT, SYNC_EXPONENT, SYNC_UNIT);
+
+static sync_point_t m_points[MAX_SYNC_POINTS];
+static int m_numPoints = 0;
+static int m_nextPoint = 0;
+
+static volatile bool m_syncPending = false;
+static volatile uint64_t m_syncLocal;
+static volatile uint64_t m_syncHost;
+
+static uint8_t m_syncValue[SYNC_LEN];
+
+class SyncCallbacks : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    uint64_t now = timebase_now(); //Stamp on arrival, before anything else delays us
+    if ((pCharacteristic == NULL) || (pCharacteristic->getLength() < sizeof(uint64_t))) {
+      return;
+    }
+
+    uint64_t host;
+    memcpy(&host, pCharacteristic->getData(), sizeof(host)); //ESP32 is little endian, same as BLE
+    m_syncLocal = now;
+    m_syncHost = host;
+    m_syncPending = true; //Callback runs in BLE thread, so fit from main loop
+  }
+};
+
+uint64_t IRAM_ATTR timebase_now(void) {
+  return (uint64_t)esp_timer_get_time();
+}
+
+void timebase_init(void) {
+  m_numPoints = 0;
+  m_nextPoint = 0;
+  memset(m_syncValue, 0, SYNC_LEN);
+}
+
+bool timebase_addService(BLEServer *pServer) {
+  int numHandles = BLEWrapper::calcNumHandles(NUM_CHARACTERISTICS);
+  BLEService *pService = pServer->createService(BLE_SERVICE_UUID, numHandles, BLE_INST_ID);
+  if (pService == NULL) {
+    ERROR("Cannot add BLE service");
+    return false;
+  }
+
+  m_syncCharacteristic.setCallbacks(new SyncCallbacks());
+  m_syncCharacteristic.setValue(m_syncValue, SYNC_LEN);
+  pService->addCharacteristic(&m_syncCharacteristic);
+  pService->start();
+  return true;
+}
+
+/*
+ * Least squares fit of offset against device time, using points selected by mask. Slope is in us per second (ppm), intercept is offset
+ * at refLocal
+ */
+static bool fitLine(uint64_t refLocal, uint32_t mask, double *pSlope, double *pIntercept) {
+  double sumX = 0.0, sumY = 0.0;
+  int n = 0;
+  int i;
+  for (i = 0; i < m_numPoints; i++) {
+    if (mask & (1UL << i)) {
+      sumX += (double)(int64_t)(m_points[i].local - refLocal) / US_PER_S;
+      sumY += (double)m_points[i].offset;
+      n++;
+    }
+  }
+
+  if (n == 0) {
+    return false;
+  }
+
+  double meanX = sumX / n;
+  double meanY = sumY / n;
+  double sxx = 0.0, sxy = 0.0;
+  for (i = 0; i < m_numPoints; i++) {
+    if (mask & (1UL << i)) {
+      double dx = (double)(int64_t)(m_points[i].local - refLocal) / US_PER_S - meanX;
+      sxx += dx * dx;
+      sxy += dx * ((double)m_points[i].offset - meanY);
+    }
+  }
+
+  *pSlope = (sxx > 0.0) ? (sxy / sxx) : 0.0; //Need points spread over time to measure drift
+  *pIntercept = meanY - *pSlope * meanX;
+  return true;
+}
+
+static void updateFit(uint64_t refLocal) {
+  uint32_t mask = (1UL << m_numPoints) - 1;
+  double slope, intercept;
+  if (!fitLine(refLocal, mask, &slope, &intercept)) {
+    return;
+  }
+
+  int i;
+  for (i = 0; i < m_numPoints; i++) {
+    double x = (double)(int64_t)(m_points[i].local - refLocal) / US_PER_S;
+    if ((double)m_points[i].offset < intercept + slope * x - LATENCY_REJECT) {
+      mask &= ~(1UL << i); //Delayed more than the others
+    }
+  }
+
+  fitLine(refLocal, mask, &slope, &intercept);
+
+  int64_t offset = (int64_t)llround(intercept);
+  int32_t drift = (int32_t)lround(slope * PPB_PER_PPM);
+  memcpy(&(m_syncValue[0]), &refLocal, sizeof(refLocal));
+  memcpy(&(m_syncValue[8]), &offset, sizeof(offset));
+  memcpy(&(m_syncValue[16]), &drift, sizeof(drift));
+  m_syncCharacteristic.setValue(m_syncValue, SYNC_LEN);
+  m_syncWrapper.notify();
+}
+
+void timebase_loop(void) {
+  PROFILE_ZONE("timebase_loop");
+  if (!m_syncPending) {
+    return;
+  }
+
+  m_syncPending = false;
+  uint64_t local = m_syncLocal;
+  m_points[m_nextPoint].local = local;
+  m_points[m_nextPoint].offset = (int64_t)(m_syncHost - local);
+  m_nextPoint = (m_nextPoint + 1) % MAX_SYNC_POINTS;
+  if (m_numPoints < MAX_SYNC_POINTS) {
+    m_numPoints++;
+  }
+
+  updateFit(local);
+}
+
+/*
+ * Next client may have a different clock, so start again
+ */
+void timebase_setConnected(bool connected) {
+  if (!connected) {
+    m_numPoints = 0;
+    m_nextPoint = 0;
+  }
+}
+
+/*
+ * Returns frame length in bytes. Frame must have space for TIMEBASE_FRAME_LEN(numValues)
+ */
+int timebase_packFrame(uint8_t *pFrame, uint64_t timestamp, const float *values, int numValues) {
+  memcpy(pFrame, &timestamp, TIMEBASE_STAMP_LEN);
+  memcpy(&(pFrame[TIMEBASE_STAMP_LEN]), values, numValues * sizeof(float));
+  return TIMEBASE_FRAME_LEN(numValues);
+}
@@ -0,0 +1,26 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __TIMEBASE_H
+#define __TIMEBASE_H
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <BLEServer.h>
+
+#define TIMEBASE_STAMP_LEN 8 //Bytes, timestamp at start of each frame
+#define TIMEBASE_FRAME_LEN(numValues) (TIMEBASE_STAMP_LEN + (numValues) * sizeof(float))
+
+void timebase_init(void);
+bool timebase_addService(BLEServer *pServer);
+void timebase_loop(void);
+void timebase_setConnected(bool connected);
+uint64_t IRAM_ATTR timebase_now(void);
+int timebase_packFrame(uint8_t *pFrame, uint64_t timestamp, const float *values, int numValues);
+
+#endif /* __TIMEBASE_H */
@@ -0,0 +1,447 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * This module records raw sensor data to flash, and replays it through the processing code, so that changes to the signal
+ * processing can be checked against real data without the glove being on a hand. It is selected at build time by TRACE_MODE.
+ *
+ * Record builds capture each raw reading where it comes off the bus: AD4002 codes, LSM9DS1 FIFO status, gyro/accel and mag triplets,
+ * AS7341 channel arrays with the gain and integration time they were taken with, BME688 fields and battery ADC readings. The trace
+ * file starts with a header (magic, version, start time in timebase microseconds) followed by records:
+ *
+ *    Source (uint8, trace_source_t)
+ *    Payload length (uint8)
+ *    Time since previous record (uint32, us)
+ *    Payload
+ *
+ * Records are buffered in RAM and appended to TRACE_PATH once a second or when the buffer is half full. Recording stops when the
+ * file reaches TRACE_MAX_SIZE. Each boot of a record build starts a new trace. Read the trace back by dumping the filesystem partition.
+ *
+ * Replay builds feed the trace through the same processing the sensor loops use (ADAF1080 statistics, LSM9DS1 activity, HAVS and
+ * Madgwick fusion, AS7341 gain correction, colorimetry and auto-exposure, battery averaging) at boot, before any hardware is touched.
+ * Time driven steps take their time from the recorded timestamps, so replay is deterministic. BME688 records are not replayed, as
+ * BSEC reads the sensor itself and cannot be fed raw data.
+ *
+ * The first replay saves every result to GOLDEN_PATH. Later replays compare against it, so a change to the processing can be checked by
+ * replaying the same trace before and after. Throughput of each stage (samples per second of processing time) is printed at the end.
+ *
+ * The same replay runs on a PC through trace_replayFile() (host/replay_main.cpp), on a trace dumped from the filesystem partition or
+ * made by host/tracegen.cpp. Traces and their golden results in host/traces are replayed by ctest.
+ */
+
+#define ERR_MODULE_NAME "Trace"
+
+#include <math.h>
+#include <string.h>
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+#include "trace.h"
+#include "adaf1080.h"
+#include "lsm9ds1.h"
+#include "as7341.h"
+#include "battery.h"
+#include "powermgmt.h"
+#include "timebase.h"
+#include "err.h"
+
+#define TRACE_DIR "/trace"
+#define TRACE_PATH TRACE_DIR "/input"
+#define GOLDEN_PATH TRACE_DIR "/golden"
+
+#define TRACE_MAX_SIZE 262144 //bytes, about 12 seconds while moving. Filesystem partition must also hold the data log
+
+#if TRACE_MODE == TRACE_MODE_RECORD
+#define BUFFER_SIZE 8192 //bytes held in RAM between writes to flash, several loops' worth at full rate
+#else
+#define BUFFER_SIZE 1 //Other builds don't record, so don't need the RAM
+#endif
+#define FLUSH_THRES (BUFFER_SIZE / 2)
+#define FLUSH_TIME 1000 //milliseconds, maximum time records are held in RAM
+
+#define MAX_PAYLOAD_LEN 32
+#define MAX_RESULTS 6
+#define GOLDEN_TOLERANCE 1.0e-5f //Relative, or absolute for values below 1
+#define US_PER_S 1.0e6f
+#define US_PER_MS 1000ULL
+
+typedef struct __attribute__((packed)) {
+  uint8_t source;
+  uint8_t numResults;
+} result_header_t;
+
+/*
+ * Payload length for each source, indexed by trace_source_t. Records of any other length are skipped on replay
+ */
+static const uint8_t PAYLOAD_LEN[NUM_TRACE_SOURCES] = {
+  sizeof(uint32_t),       //trace_source_ad4002
+  sizeof(uint8_t),        //trace_source_lsm9ds1Fifo
+  6 * sizeof(int16_t),    //trace_source_lsm9ds1Imu
+  3 * sizeof(int16_t),    //trace_source_lsm9ds1Mag
+  sizeof(trace_as7341_t), //trace_source_as7341
+  sizeof(trace_bme688_t), //trace_source_bme688
+  sizeof(uint32_t)        //trace_source_battery
+};
+
+static const char *STAGE_NAMES[NUM_TRACE_SOURCES] = {
+  "ADAF1080 statistics",
+  "LSM9DS1 FIFO",
+  "LSM9DS1 activity/HAVS",
+  "LSM9DS1 fusion",
+  "AS7341 colour/auto-exposure",
+  "BME688 (not replayed)",
+  "Battery average"
+};
+
+typedef struct {
+  uint32_t numSamples;
+  uint32_t numResults;
+  uint32_t numMismatches;
+  uint64_t time; //us spent processing
+} stage_t;
+
+static uint8_t m_buffer[BUFFER_SIZE];
+static size_t m_bufferLen = 0;
+static uint32_t m_fileSize = 0;
+static uint32_t m_numDropped = 0;
+static uint64_t m_lastRecordTime;
+static unsigned long m_lastFlushTime;
+static bool m_recording = false;
+
+static stage_t m_stages[NUM_TRACE_SOURCES];
+static File m_golden;
+static bool m_compare = false; //Golden results exist, so compare rather than save
+static bool m_inStep = true; //Golden results still line up with this replay
+static bool m_batteryStarted = false;
+static bool m_haveMagTime = false;
+static uint64_t m_lastMagTime;
+
+static void flush(void) {
+  if (m_bufferLen == 0) {
+    return;
+  }
+
+  File file = LittleFS.open(TRACE_PATH, FILE_APPEND);
+  if (!file) {
+    ERROR("Cannot open %s", TRACE_PATH);
+  } else {
+    size_t written = file.write(m_buffer, m_bufferLen);
+    file.close();
+    m_fileSize += written;
+    if (written != m_bufferLen) {
+      ERROR("Failed to write %s", TRACE_PATH);
+    }
+  }
+
+  m_bufferLen = 0; //Records that could not be written are lost
+  m_lastFlushTime = millis();
+}
+
+static bool startRecording(void) {
+  LittleFS.remove(TRACE_PATH); //Each boot starts a new trace
+  trace_header_t header = { TRACE_MAGIC, TRACE_VERSION, NUM_TRACE_SOURCES, 0, timebase_now() };
+  File file = LittleFS.open(TRACE_PATH, FILE_WRITE);
+  if (!file || (file.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))) {
+    ERROR("Cannot create %s", TRACE_PATH);
+    return false;
+  }
+
+  file.close();
+  m_fileSize = sizeof(header);
+  m_lastRecordTime = header.startTime;
+  m_lastFlushTime = millis();
+  powermgmt_addSleepCallback(flush); //Keep buffered records when we go to sleep
+  return true;
+}
+
+#if TRACE_MODE == TRACE_MODE_RECORD
+void trace_record(trace_source_t source, const void *pData, size_t len) {
+  if (!m_recording) {
+    return;
+  }
+
+  size_t recordLen = sizeof(record_header_t) + len;
+  if (m_bufferLen + recordLen > BUFFER_SIZE) {
+    m_numDropped++; //Main loop hasn't flushed for too long, replay will see a gap
+    return;
+  }
+
+  uint64_t now = timebase_now();
+  record_header_t header = { (uint8_t)source, (uint8_t)len, (uint32_t)(now - m_lastRecordTime) };
+  m_lastRecordTime = now;
+  memcpy(&(m_buffer[m_bufferLen]), &header, sizeof(header));
+  memcpy(&(m_buffer[m_bufferLen + sizeof(header)]), pData, len);
+  m_bufferLen += recordLen;
+}
+#endif
+
+/*
+ * Returns false if replay should stop comparing, because golden results no longer line up
+ */
+static bool compareResults(trace_source_t source, const float *results, int numResults) {
+  result_header_t golden;
+  float expected[MAX_RESULTS];
+  if ((m_golden.read((uint8_t *)&golden, sizeof(golden)) != sizeof(golden)) || (golden.source != source) ||
+      (golden.numResults != numResults) || (m_golden.read((uint8_t *)expected, numResults * sizeof(float)) != numResults * sizeof(float))) {
+    ERROR("%s result %lu out of step with golden results, stopping comparison", STAGE_NAMES[source], (unsigned long)m_stages[source].numResults);
+    return false;
+  }
+
+  int i;
+  for (i = 0; i < numResults; i++) {
+    float tolerance = GOLDEN_TOLERANCE * fmaxf(1.0f, fabsf(expected[i]));
+    bool bothNan = isnan(results[i]) && isnan(expected[i]);
+    if (!bothNan && !(fabsf(results[i] - expected[i]) <= tolerance)) { //NaN fails the comparison
+      if (m_stages[source].numMismatches == 0) {
+        ERROR("%s result %lu is %f, expected %f", STAGE_NAMES[source], (unsigned long)m_stages[source].numResults, results[i], expected[i]);
+      }
+
+      m_stages[source].numMismatches++;
+      break;
+    }
+  }
+
+  return true;
+}
+
+static void handleResults(trace_source_t source, const float *results, int numResults) {
+  if (m_compare) {
+    if (m_inStep) {
+      m_inStep = compareResults(source, results, numResults);
+    }
+  } else {
+    result_header_t header = { (uint8_t)source, (uint8_t)numResults };
+    m_golden.write((const uint8_t *)&header, sizeof(header));
+    m_golden.write((const uint8_t *)results, numResults * sizeof(float));
+  }
+
+  m_stages[source].numResults++;
+}
+
+/*
+ * now is the record's time in milliseconds, on the same scale as millis() was when replay started
+ */
+static void replayRecord(trace_source_t source, const uint8_t *pData, uint64_t timestamp, unsigned long now) {
+  float results[MAX_RESULTS];
+  int numResults = 0;
+  uint64_t startTime = timebase_now();
+  switch (source) {
+    case trace_source_ad4002: {
+      uint32_t adcCounts;
+      memcpy(&adcCounts, pData, sizeof(adcCounts));
+      if (adaf1080_replaySample(adcCounts, results)) {
+        numResults = ADAF1080_NUM_RESULTS;
+      }
+      break;
+    }
+
+    case trace_source_lsm9ds1Fifo:
+      lsm9ds1_replayFifo(*pData);
+      break;
+
+    case trace_source_lsm9ds1Imu: {
+      int16_t raw[6];
+      memcpy(raw, pData, sizeof(raw));
+      lsm9ds1_replayImu(raw, now);
+      break;
+    }
+
+    case trace_source_lsm9ds1Mag: {
+      int16_t raw[3];
+      memcpy(raw, pData, sizeof(raw));
+      float deltaT = m_haveMagTime ? (float)(timestamp - m_lastMagTime) / US_PER_S : 0.0f;
+      m_haveMagTime = true;
+      m_lastMagTime = timestamp;
+      lsm9ds1_replayMag(raw, deltaT, results);
+      numResults = LSM9DS1_NUM_RESULTS;
+      break;
+    }
+
+    case trace_source_as7341: {
+      trace_as7341_t trace;
+      memcpy(&trace, pData, sizeof(trace));
+      uint16_t readings[12];
+      memcpy(readings, trace.readings, sizeof(readings)); //Packed struct, copy to aligned buffer
+      int gainIndex = trace.gainIndex;
+      uint16_t astep = trace.astep;
+      as7341_replayReadings(readings, &gainIndex, &astep, results);
+      numResults = AS7341_NUM_RESULTS;
+      break;
+    }
+
+    case trace_source_battery: {
+      uint32_t mv;
+      memcpy(&mv, pData, sizeof(mv));
+      if (!m_batteryStarted) {
+        m_batteryStarted = true; //First reading is the one battery_init() started from
+        battery_replayStart(mv);
+      } else {
+        results[0] = battery_replaySample(mv);
+        numResults = 1;
+      }
+      break;
+    }
+
+    default: //BME688
+      break;
+  }
+
+  m_stages[source].time += timebase_now() - startTime;
+  m_stages[source].numSamples++;
+  if (numResults > 0) {
+    handleResults(source, results, numResults);
+  }
+}
+
+static void printReport(void) {
+  Serial.println("Replay complete");
+  int i;
+  for (i = 0; i < NUM_TRACE_SOURCES; i++) {
+    const stage_t *pStage = &(m_stages[i]);
+    if (pStage->numSamples == 0) {
+      continue;
+    }
+
+    Serial.print(STAGE_NAMES[i]);
+    Serial.print(": ");
+    Serial.print(pStage->numSamples);
+    Serial.print(" samples in ");
+    Serial.print((unsigned long)pStage->time);
+    Serial.print("us (");
+    Serial.print((pStage->time > 0) ? ((float)pStage->numSamples * US_PER_S / (float)pStage->time) : 0.0f, 0);
+    Serial.print(" samples/s), ");
+    Serial.print(pStage->numResults);
+    if (m_compare) {
+      Serial.print(" results, ");
+      Serial.print(pStage->numMismatches);
+      Serial.println(" differ from golden");
+    } else {
+      Serial.println(" results saved as golden");
+    }
+  }
+
+  if (m_compare && !m_inStep) {
+    Serial.println("Golden results went out of step, later results were not compared");
+  }
+}
+
+/*
+ * Replays tracePath, saving results to goldenPath or comparing against it. Returns true if every result was saved or matched
+ */
+bool trace_replayFile(const char *tracePath, const char *goldenPath, bool saveGolden) {
+  File input = LittleFS.open(tracePath, FILE_READ);
+  if (!input) {
+    ERROR("No trace to replay");
+    return false;
+  }
+
+  trace_header_t header;
+  if ((input.read((uint8_t *)&header, sizeof(header)) != sizeof(header)) || (header.magic != TRACE_MAGIC) || (header.version != TRACE_VERSION)) {
+    ERROR("Trace header is not valid");
+    input.close();
+    return false;
+  }
+
+  m_compare = !saveGolden;
+  m_inStep = true;
+  m_batteryStarted = false;
+  m_haveMagTime = false;
+  m_golden = LittleFS.open(goldenPath, m_compare ? FILE_READ : FILE_WRITE);
+  if (!m_golden) {
+    ERROR("Cannot open %s", goldenPath);
+    input.close();
+    return false;
+  }
+
+  Serial.println(m_compare ? "Replaying trace, comparing with golden results" : "Replaying trace, saving golden results");
+  memset(m_stages, 0, sizeof(m_stages));
+  lsm9ds1_replayStart();
+  as7341_replayStart();
+  unsigned long startMillis = millis(); //Activity dwell times are measured from here
+
+  uint64_t timestamp = header.startTime;
+  record_header_t record;
+  uint8_t payload[MAX_PAYLOAD_LEN];
+  bool ok = true;
+  while (input.read((uint8_t *)&record, sizeof(record)) == sizeof(record)) {
+    if ((record.len > MAX_PAYLOAD_LEN) || (input.read(payload, record.len) != record.len)) {
+      ERROR("Trace is truncated");
+      ok = false;
+      break;
+    }
+
+    timestamp += record.delta;
+    if ((record.source >= NUM_TRACE_SOURCES) || (record.len != PAYLOAD_LEN[record.source])) {
+      continue; //Recorded by a different firmware version
+    }
+
+    unsigned long now = startMillis + (unsigned long)((timestamp - header.startTime) / US_PER_MS);
+    replayRecord((trace_source_t)record.source, payload, timestamp, now);
+  }
+
+  if (m_compare) {
+    result_header_t extra;
+    if (m_inStep && (m_golden.read((uint8_t *)&extra, sizeof(extra)) == sizeof(extra))) {
+      ERROR("Golden results continue past the end of the trace");
+      m_inStep = false;
+    }
+
+    int i;
+    for (i = 0; i < NUM_TRACE_SOURCES; i++) {
+      ok = ok && (m_stages[i].numMismatches == 0);
+    }
+
+    ok = ok && m_inStep;
+  }
+
+  input.close();
+  m_golden.close();
+  printReport();
+  return ok;
+}
+
+void trace_init(void) {
+  if (TRACE_MODE == TRACE_MODE_OFF) {
+    return;
+  }
+
+  if (!LittleFS.begin(true)) { //Format on first use
+    ERROR("Cannot mount filesystem");
+    return;
+  }
+
+  if (!LittleFS.exists(TRACE_DIR) && !LittleFS.mkdir(TRACE_DIR)) {
+    ERROR("Cannot create trace directory");
+    return;
+  }
+
+  if (TRACE_MODE == TRACE_MODE_RECORD) {
+    m_recording = startRecording();
+    return;
+  }
+
+  trace_replayFile(TRACE_PATH, GOLDEN_PATH, !LittleFS.exists(GOLDEN_PATH));
+  Serial.println("Replay build, halting");
+  while (true) {
+    delay(1000); //Nothing else to do, hardware was never initialised
+  }
+}
+
+void trace_loop(void) {
+  if (!m_recording) {
+    return;
+  }
+
+  if ((m_bufferLen >= FLUSH_THRES) || (millis() - m_lastFlushTime >= FLUSH_TIME)) {
+    flush();
+    if (m_fileSize >= TRACE_MAX_SIZE) {
+      m_recording = false;
+      Serial.print("Trace full, recording stopped. Records dropped: ");
+      Serial.println(m_numDropped);
+    }
+  }
+}
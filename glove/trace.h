@@ -0,0 +1,83 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Build option, e.g. add -DTRACE_MODE=1 to build flags. Normal builds neither record nor replay, and trace_record() compiles away
+ */
+#define TRACE_MODE_OFF 0
+#define TRACE_MODE_RECORD 1 //Record raw sensor data to flash
+#define TRACE_MODE_REPLAY 2 //Feed recorded data through processing at boot, then halt
+
+#ifndef TRACE_MODE
+#define TRACE_MODE TRACE_MODE_OFF
+#endif
+
+typedef enum {
+  trace_source_ad4002 = 0,  //uint32: ADC code
+  trace_source_lsm9ds1Fifo, //uint8: FIFO_SRC, starts each batch of IMU samples
+  trace_source_lsm9ds1Imu,  //int16[6]: gyro x, y, z then accel x, y, z
+  trace_source_lsm9ds1Mag,  //int16[3]: mag x, y, z
+  trace_source_as7341,      //trace_as7341_t
+  trace_source_bme688,      //trace_bme688_t, recorded only as BSEC drives the sensor itself
+  trace_source_battery      //uint32: millivolts at ADC pin
+} trace_source_t;
+
+#define NUM_TRACE_SOURCES 7
+
+/*
+ * Trace file format, see trace.cpp. Host tools (host/tracegen.cpp) write traces in the same format
+ */
+#define TRACE_MAGIC 0x43525447UL //"GTRC"
+#define TRACE_VERSION 1
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t numSources;
+  uint16_t reserved;
+  uint64_t startTime; //Timebase
+} trace_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t source;
+  uint8_t len;
+  uint32_t delta; //us since previous record
+} record_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t readings[12]; //Full spectrum, channel order as returned by library
+  uint8_t gainIndex;     //Settings the readings were taken with
+  uint16_t astep;
+} trace_as7341_t;
+
+typedef struct __attribute__((packed)) {
+  float temperature;
+  float pressure;
+  float humidity;
+  float gasResistance;
+  uint8_t status;
+  uint8_t gasIndex;
+} trace_bme688_t;
+
+void trace_init(void);
+void trace_loop(void);
+bool trace_replayFile(const char *tracePath, const char *goldenPath, bool saveGolden);
+
+#if TRACE_MODE == TRACE_MODE_RECORD
+void trace_record(trace_source_t source, const void *pData, size_t len);
+#else
+static inline void trace_record(trace_source_t source, const void *pData, size_t len) {}
+#endif
+
+#endif /* __TRACE_H */
@@ -0,0 +1,183 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Step response of AS7341 auto-exposure. A simple sensor model is driven through a series of light level steps, and each reading goes
+ * through as7341_replayReadings(), which runs the same auto-exposure as the sensor loop and returns the gain and ASTEP to use next.
+ *
+ * For each step we measure:
+ *
+ *    - Settle time: integrations (and ms, at two SMUX passes per reading) until auto-exposure stops changing the settings. Short
+ *      probe integrations, taken when every channel saturates, are counted separately
+ *    - Overshoot: how far (in stops) the peak reading goes past the target band on the far side from where it started. Only counted
+ *      after the first correction, as the first reading after a step is bound to be out of band, and not for probes, which are
+ *      meant to read low
+ *
+ * Steps beyond the sensor's range (too bright at minimum gain, too dark at maximum exposure) settle when the settings reach their
+ * limit. Exits non-zero if any step takes more than MAX_SETTLE_INTEGRATIONS full integrations or MAX_PROBES probes, or overshoots by
+ * more than MAX_OVERSHOOT_STOPS.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <Arduino.h>
+
+#include "config.h"
+#include "as7341.h"
+
+#define NUM_CHANNELS 12
+#define ADC_COUNTS_LIMIT 65535
+#define ASTEP_PERIOD_US 2.78f
+#define MAX_INTEGRATIONS 20 //Give up on a step after this many
+
+#define TARGET_LOW_PCT 25 //Band auto-exposure leaves alone, percent of default full scale
+#define TARGET_HIGH_PCT 75
+
+/*
+ * Limits follow from the design. Any reading with a channel in range gives the true level, so a step takes one reading to see it and
+ * one to confirm the correction. If every channel saturates, one probe at minimum gain covers the whole range. The model's spectrum
+ * doesn't change, so corrections land on target; the overshoot limit leaves room for rounding to whole gain steps
+ */
+#define MAX_SETTLE_INTEGRATIONS 2
+#define MAX_PROBES 1
+#define MAX_OVERSHOOT_STOPS 0.5f
+
+/*
+ * Relative response of each channel to warm white light, in library channel order. Peak channel (Clear) is 1
+ */
+static const float SPECTRUM[NUM_CHANNELS] = { 0.10f, 0.25f, 0.35f, 0.45f, 1.0f, 0.15f, 0.55f, 0.65f, 0.70f, 0.60f, 1.0f, 0.15f };
+
+/*
+ * Light levels, as peak channel counts at 1x gain and default integration time. Each one is a step from the one before
+ */
+static const float LEVELS[] = {
+  2000.0f,   //Indoor, start point
+  64000.0f,  //Step up 5 stops, saturates
+  300.0f,    //Step down nearly 8 stops
+  310.0f,    //Tiny step, should not react
+  1.0e6f,    //Direct sunlight, every channel saturates
+  5.0e7f,    //Beyond range at minimum gain
+  20.0f,     //Dim room
+  0.02f,     //Beyond range at maximum exposure
+  4000.0f,   //Back indoors
+  20.0f,     //Dim room again, settles at 512x
+  34.0f      //Just over saturation at 512x, estimated from the other channels
+};
+
+#define NUM_LEVELS (sizeof(LEVELS) / sizeof(LEVELS[0]))
+
+static uint32_t m_atime;
+static uint16_t m_defaultAstep;
+
+static float gainValue(int gainIndex) {
+  return 0.5f * exp2f((float)gainIndex); //0.5x to 512x in powers of 2
+}
+
+static uint32_t getFullScale(uint16_t astep) {
+  uint32_t fullScale = (m_atime + 1) * (uint32_t)(astep + 1);
+  return (fullScale > ADC_COUNTS_LIMIT) ? ADC_COUNTS_LIMIT : fullScale;
+}
+
+/*
+ * Sensor model: counts scale with gain and integration time, and clip at full scale
+ */
+static void takeReading(float level, int gainIndex, uint16_t astep, uint16_t *readings) {
+  float exposure = gainValue(gainIndex) * (float)(astep + 1) / (float)(m_defaultAstep + 1);
+  float fullScale = (float)getFullScale(astep);
+  int i;
+  for (i = 0; i < NUM_CHANNELS; i++) {
+    readings[i] = (uint16_t)fminf(level * SPECTRUM[i] * exposure, fullScale);
+  }
+}
+
+static float integrationMs(uint16_t astep) {
+  return 2.0f * (float)(m_atime + 1) * (float)(astep + 1) * ASTEP_PERIOD_US / 1000.0f; //Two SMUX passes
+}
+
+/*
+ * Stops from the peak reading to the target band, positive above it, negative below, 0 inside
+ */
+static float stopsOutsideBand(uint16_t peak) {
+  float low = (float)(TARGET_LOW_PCT * getFullScale(m_defaultAstep) / 100);
+  float high = (float)(TARGET_HIGH_PCT * getFullScale(m_defaultAstep) / 100);
+  float value = (peak > 0) ? (float)peak : 1.0f;
+  if (value > high) {
+    return log2f(value / high);
+  } else if (value < low) {
+    return log2f(value / low);
+  }
+
+  return 0.0f;
+}
+
+/*
+ * Runs integrations at one light level until auto-exposure stops changing settings. Returns false if it never settles
+ */
+static bool runStep(float level, int *pGainIndex, uint16_t *pAstep, int *pIntegrations, int *pProbes, float *pSettleMs,
+                    float *pOvershoot) {
+  *pIntegrations = 0;
+  *pProbes = 0;
+  *pSettleMs = 0.0f;
+  *pOvershoot = 0.0f;
+  float startSide = 0.0f;
+  while ((*pIntegrations + *pProbes) < MAX_INTEGRATIONS) {
+    uint16_t readings[NUM_CHANNELS];
+    takeReading(level, *pGainIndex, *pAstep, readings);
+    *pSettleMs += integrationMs(*pAstep);
+
+    if (*pAstep < m_defaultAstep) { //Probe
+      (*pProbes)++;
+    } else {
+      (*pIntegrations)++;
+      float outside = stopsOutsideBand(readings[4]);
+      if (*pIntegrations == 1) {
+        startSide = outside;
+      } else if (((startSide > 0.0f) && (outside < 0.0f)) || ((startSide < 0.0f) && (outside > 0.0f))) {
+        *pOvershoot = fmaxf(*pOvershoot, fabsf(outside));
+      }
+    }
+
+    int gainIndex = *pGainIndex;
+    uint16_t astep = *pAstep;
+    float results[AS7341_NUM_RESULTS];
+    as7341_replayReadings(readings, pGainIndex, pAstep, results);
+    if ((*pGainIndex == gainIndex) && (*pAstep == astep)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int main(void) {
+  config_init();
+  as7341_replayStart();
+  m_atime = config_getUint(config_param_as7341Atime);
+  m_defaultAstep = (uint16_t)config_getUint(config_param_as7341Astep);
+
+  int gainIndex = 8; //128x, a typical indoor setting
+  uint16_t astep = m_defaultAstep;
+  int integrations;
+  int probes;
+  float settleMs;
+  float overshoot;
+  runStep(LEVELS[0], &gainIndex, &astep, &integrations, &probes, &settleMs, &overshoot); //Settle at the start point
+
+  printf("%12s %12s %8s %8s %12s %6s %10s\n", "from", "to", "gain", "astep", "integrations", "probes", "ms");
+  int numFailed = 0;
+  size_t i;
+  for (i = 1; i < NUM_LEVELS; i++) {
+    bool settled = runStep(LEVELS[i], &gainIndex, &astep, &integrations, &probes, &settleMs, &overshoot);
+    bool ok = settled && (integrations <= MAX_SETTLE_INTEGRATIONS) && (probes <= MAX_PROBES) && (overshoot <= MAX_OVERSHOOT_STOPS);
+    printf("%12g %12g %8g %8u %12d %6d %10.0f  overshoot %.2f stops%s\n", LEVELS[i - 1], LEVELS[i], gainValue(gainIndex),
+           (unsigned int)astep, integrations, probes, settleMs, overshoot, ok ? "" : "  FAIL");
+    if (!ok) {
+      numFailed++;
+    }
+  }
+
+  return (numFailed == 0) ? 0 : 1;
+}
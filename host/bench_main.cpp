@@ -0,0 +1,24 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Runs the firmware benchmarks on the host. Output is the same JSON lines as a benchmark build prints to Serial, with "cycles" in
+ * nanoseconds (getCpuFrequencyMhz() reports 1000).
+ */
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+#include "config.h"
+#include "bench.h"
+
+int main(void) {
+  config_init(); //Cases read sample rates and integration settings from config
+  BLEServer *pServer = BLEDevice::createServer();
+  bench_runAll(pServer);
+  delete pServer;
+  return 0;
+}
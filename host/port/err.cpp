@@ -0,0 +1,38 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build of the error module: messages are printed to stderr straight away, and halting exits
+ */
+
+#define ERR_MODULE_NAME "Err"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "err.h"
+
+void err_init(void) {
+}
+
+void err_print(bool halt, const char *module, const char *message, ...) {
+  va_list args;
+  va_start(args, message);
+  fprintf(stderr, "%s: ", module);
+  vfprintf(stderr, message, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+
+  if (halt) {
+    fprintf(stderr, "Halting!\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+bool err_addService(BLEServer *pServer) {
+  return true;
+}
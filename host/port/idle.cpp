@@ -0,0 +1,30 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build of the idle module: host programs call module functions directly rather than running the loop, so there is nothing to wait for
+ */
+
+#include "idle.h"
+
+void idle_init(void) {
+}
+
+void idle_wakeAfter(unsigned long delay) {
+}
+
+void idle_wakeFromISR(void) {
+}
+
+void idle_sleep(void) {
+}
+
+float idle_getDutyCycle(void) {
+  return 100.0f;
+}
+
+void idle_resetStats(void) {
+}
@@ -0,0 +1,25 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build of the power management module: the 5V supply is on from the start and the host never sleeps
+ */
+
+#include "powermgmt.h"
+
+void powermgmt_init(void) {
+}
+
+void powermgmt_loop(void) {
+}
+
+bool powermgmt_addSleepCallback(powermgmt_callback_t callback) {
+  return true;
+}
+
+unsigned long powermgmt_getDcdcOnTime(void) {
+  return 0;
+}
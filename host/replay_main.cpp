@@ -0,0 +1,32 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Replays a trace on the host through the same processing as a replay build, via trace_replayFile(). The trace can be dumped from a
+ * record build's filesystem partition, or written by glove_tracegen.
+ *
+ * Usage: glove_replay <trace> <golden> [--update]
+ *
+ * Compares every result with the golden file and exits non-zero if any differ. --update writes the golden file instead, after a
+ * deliberate change to the processing. Paths are host paths: LittleFS isn't mounted, so the stub opens them as given.
+ */
+
+#include <string.h>
+#include <Arduino.h>
+
+#include "config.h"
+#include "trace.h"
+
+int main(int argc, char **argv) {
+  bool update = (argc == 4) && (strcmp(argv[3], "--update") == 0);
+  if ((argc != 3) && !update) {
+    fprintf(stderr, "Usage: %s <trace> <golden> [--update]\n", argv[0]);
+    return 2;
+  }
+
+  config_init(); //Default sample rates and integration settings, as a freshly flashed glove
+  return trace_replayFile(argv[1], argv[2], update) ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: AS7341 with no device attached. Only the calls the firmware makes are provided
+ */
+
+#ifndef __ADAFRUIT_AS7341_H
+#define __ADAFRUIT_AS7341_H
+
+#include <Adafruit_BusIO_Register.h>
+
+typedef enum {
+  AS7341_GAIN_0_5X,
+  AS7341_GAIN_1X,
+  AS7341_GAIN_2X,
+  AS7341_GAIN_4X,
+  AS7341_GAIN_8X,
+  AS7341_GAIN_16X,
+  AS7341_GAIN_32X,
+  AS7341_GAIN_64X,
+  AS7341_GAIN_128X,
+  AS7341_GAIN_256X,
+  AS7341_GAIN_512X
+} as7341_gain_t;
+
+typedef enum {
+  AS7341_INT_COUNT_ALL,
+  AS7341_INT_COUNT_1
+} as7341_int_cycle_count_t;
+
+class Adafruit_AS7341 {
+  public:
+    bool begin(uint8_t addr = 0x39, TwoWire *theWire = &Wire, int32_t sensorId = 0) { return true; }
+    bool setATIME(uint8_t atimeValue) { return true; }
+    bool setASTEP(uint16_t astepValue) { return true; }
+    bool setGain(as7341_gain_t gainValue) { return true; }
+    bool setAPERS(as7341_int_cycle_count_t cycleCount) { return true; }
+    bool enableSpectralInterrupt(bool enable) { return true; }
+    bool enableSpectralMeasurement(bool enable) { return true; }
+    bool clearInterruptStatus(void) { return true; }
+    void startReading(void) {}
+    bool checkReadingProgress(void) { return true; }
+    bool getIsDataReady(void) { return false; }
+    bool getAllChannels(uint16_t *readingsBuffer) { memset(readingsBuffer, 0, 12 * sizeof(uint16_t)); return true; }
+};
+
+#endif /* __ADAFRUIT_AS7341_H */
@@ -0,0 +1,34 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: register access with no device attached. Writes succeed and reads return zeros
+ */
+
+#ifndef __ADAFRUIT_BUSIO_REGISTER_H
+#define __ADAFRUIT_BUSIO_REGISTER_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+class Adafruit_I2CDevice {
+  public:
+    Adafruit_I2CDevice(uint8_t addr, TwoWire *theWire = &Wire) {}
+    bool begin(bool addrDetect = true) { return true; }
+};
+
+class Adafruit_BusIO_Register {
+  private:
+    uint8_t m_width;
+
+  public:
+    Adafruit_BusIO_Register(Adafruit_I2CDevice *pDevice, uint16_t reg, uint8_t width = 1, uint8_t byteOrder = LSBFIRST) : m_width(width) {}
+    bool read(uint8_t *buffer, uint8_t len) { memset(buffer, 0, len); return true; }
+    uint32_t read(void) { return 0; }
+    bool write(uint32_t value, uint8_t numBytes = 0) { return true; }
+};
+
+#endif /* __ADAFRUIT_BUSIO_REGISTER_H */
@@ -0,0 +1,52 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: LSM9DS1 with no device attached. Only the calls and constants the firmware uses are provided
+ */
+
+#ifndef __ADAFRUIT_LSM9DS1_H
+#define __ADAFRUIT_LSM9DS1_H
+
+#include <Wire.h>
+#include <Adafruit_Sensor.h>
+
+#define XGTYPE false
+#define MAGTYPE true
+
+#define LSM9DS1_ACCEL_MG_LSB_16G (0.732F)
+#define LSM9DS1_MAG_MGAUSS_4GAUSS (0.14F)
+#define LSM9DS1_GYRO_DPS_DIGIT_245DPS (0.00875F)
+
+typedef struct {
+  int16_t x;
+  int16_t y;
+  int16_t z;
+} lsm9ds1Vector_t;
+
+class Adafruit_LSM9DS1 {
+  public:
+    typedef enum { LSM9DS1_ACCELRANGE_2G, LSM9DS1_ACCELRANGE_16G, LSM9DS1_ACCELRANGE_4G, LSM9DS1_ACCELRANGE_8G } lsm9ds1AccelRange_t;
+    typedef enum { LSM9DS1_ACCELDATARATE_476HZ = 5, LSM9DS1_ACCELDATARATE_952HZ = 6 } lm9ds1AccelDataRate_t;
+    typedef enum { LSM9DS1_MAGGAIN_4GAUSS, LSM9DS1_MAGGAIN_8GAUSS } lsm9ds1MagGain_t;
+    typedef enum { LSM9DS1_GYROSCALE_245DPS, LSM9DS1_GYROSCALE_500DPS } lsm9ds1GyroScale_t;
+
+    lsm9ds1Vector_t accelData = {};
+    lsm9ds1Vector_t gyroData = {};
+    lsm9ds1Vector_t magData = {};
+
+    bool begin(void) { return true; }
+    void setupAccel(lsm9ds1AccelRange_t range, lm9ds1AccelDataRate_t rate) {}
+    void setupMag(lsm9ds1MagGain_t gain) {}
+    void setupGyro(lsm9ds1GyroScale_t scale) {}
+    void readAccel(void) {}
+    void readGyro(void) {}
+    void readMag(void) {}
+    uint8_t read8(bool type, uint8_t reg) { return 0; }
+    void write8(bool type, uint8_t reg, uint8_t value) {}
+};
+
+#endif /* __ADAFRUIT_LSM9DS1_H */
@@ -0,0 +1,18 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: unit constants from the Adafruit unified sensor library
+ */
+
+#ifndef __ADAFRUIT_SENSOR_H
+#define __ADAFRUIT_SENSOR_H
+
+#define SENSORS_GRAVITY_STANDARD (9.80665F)
+#define SENSORS_DPS_TO_RADS (0.017453293F)
+#define SENSORS_GAUSS_TO_MICROTESLA (100)
+
+#endif /* __ADAFRUIT_SENSOR_H */
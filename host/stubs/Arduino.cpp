@@ -0,0 +1,85 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#include <chrono>
+#include <thread>
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+
+#define HOST_CPU_MHZ 1000 //"Cycles" are nanoseconds
+
+HardwareSerial Serial;
+TwoWire Wire;
+SPIClass SPI;
+
+static const std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+
+static uint64_t elapsedNs(void) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+unsigned long millis(void) {
+  return (unsigned long)(uint32_t)(elapsedNs() / 1000000ULL); //Wraps at 32 bits, as on the ESP32
+}
+
+unsigned long micros(void) {
+  return (unsigned long)(uint32_t)(elapsedNs() / 1000ULL);
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+int64_t esp_timer_get_time(void) {
+  return (int64_t)(elapsedNs() / 1000ULL);
+}
+
+uint32_t esp_cpu_get_cycle_count(void) {
+  return (uint32_t)elapsedNs();
+}
+
+uint32_t getCpuFrequencyMhz(void) {
+  return HOST_CPU_MHZ;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+int digitalRead(uint8_t pin) {
+  return HIGH; //Idle level of the I2C lines and active low inputs
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  return 0;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {}
+
+bool analogContinuous(const uint8_t pins[], size_t pinsCount, uint32_t conversionsPerPin, uint32_t samplingFrequency, void (*userFunc)(void)) {
+  return false;
+}
+
+bool analogContinuousRead(adc_continuous_data_t **buffer, uint32_t timeout_ms) {
+  return false;
+}
+
+bool analogContinuousStart(void) {
+  return false;
+}
+
+bool analogContinuousStop(void) {
+  return true;
+}
@@ -0,0 +1,92 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Minimal Arduino core for host builds. Only what the firmware modules use is provided. Time comes from the host's steady clock,
+ * pins and interrupts do nothing, and Serial writes to stdout.
+ */
+
+#ifndef __ARDUINO_H
+#define __ARDUINO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define IRAM_ATTR
+#define ARDUINO_ISR_ATTR
+#define RTC_DATA_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define OUTPUT_OPEN_DRAIN 0x13
+#define FALLING 0x02
+#define RISING 0x01
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SDA 22
+#define SCL 20
+#define MOSI 19
+#define A5 4
+#define A13 35
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint32_t analogReadMilliVolts(uint8_t pin);
+#define digitalPinToInterrupt(pin) (pin)
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+uint32_t getCpuFrequencyMhz(void);
+
+typedef struct {
+  uint8_t pin;
+  uint8_t channel;
+  int avg_read_raw;
+  int avg_read_mvolts;
+} adc_continuous_data_t;
+
+bool analogContinuous(const uint8_t pins[], size_t pinsCount, uint32_t conversionsPerPin, uint32_t samplingFrequency, void (*userFunc)(void));
+bool analogContinuousRead(adc_continuous_data_t **buffer, uint32_t timeout_ms);
+bool analogContinuousStart(void);
+bool analogContinuousStop(void);
+
+class HardwareSerial {
+  public:
+    void begin(unsigned long baud) {}
+    int availableForWrite(void) { return 4096; }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+    size_t print(const char *s) { return printf("%s", s); }
+    size_t print(char c) { return printf("%c", c); }
+    size_t print(int n) { return printf("%d", n); }
+    size_t print(unsigned int n) { return printf("%u", n); }
+    size_t print(long n) { return printf("%ld", n); }
+    size_t print(unsigned long n) { return printf("%lu", n); }
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    size_t println(double n, int digits) { size_t len = print(n, digits); return len + println(); }
+    size_t println(void) { return printf("\n"); }
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif /* __ARDUINO_H */
@@ -0,0 +1,5 @@
+/*
+ * Host build: all BLE classes are in BLEHost.h
+ */
+
+#include "BLEHost.h"
@@ -0,0 +1,200 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Minimal BLE classes for host builds, standing in for the ESP32 Bluedroid wrapper. Characteristics hold their value and count
+ * notifications, but nothing is ever sent. Host programs can connect a client and subscribe or write to a characteristic to drive
+ * the same paths the BLE thread would.
+ */
+
+#ifndef __BLEHOST_H
+#define __BLEHOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class BLEUUID {
+  private:
+    std::string m_uuid;
+
+  public:
+    BLEUUID(void) {}
+    BLEUUID(const char *uuid) : m_uuid(uuid) {}
+    BLEUUID(std::string uuid) : m_uuid(uuid) {}
+    BLEUUID(uint16_t uuid) : m_uuid(std::to_string(uuid)) {}
+    std::string toString(void) const { return m_uuid; }
+};
+
+class BLEDescriptor {
+  public:
+    virtual ~BLEDescriptor() {}
+};
+
+class BLE2901 : public BLEDescriptor {
+  private:
+    std::string m_description;
+
+  public:
+    void setDescription(const std::string &description) { m_description = description; }
+    std::string getDescription(void) const { return m_description; }
+};
+
+class BLE2902 : public BLEDescriptor {
+  private:
+    bool m_notifications = false;
+
+  public:
+    bool getNotifications(void) const { return m_notifications; }
+    void setNotifications(bool flag) { m_notifications = flag; }
+};
+
+class BLE2904 : public BLEDescriptor {
+  public:
+    static const uint8_t FORMAT_BOOLEAN = 1;
+    static const uint8_t FORMAT_UINT8 = 4;
+    static const uint8_t FORMAT_UINT16 = 6;
+    static const uint8_t FORMAT_UINT24 = 7;
+    static const uint8_t FORMAT_UINT32 = 8;
+    static const uint8_t FORMAT_SINT8 = 12;
+    static const uint8_t FORMAT_SINT16 = 14;
+    static const uint8_t FORMAT_SINT32 = 16;
+    static const uint8_t FORMAT_FLOAT32 = 20;
+    static const uint8_t FORMAT_UTF8 = 25;
+    static const uint8_t FORMAT_OPAQUE = 27;
+
+    void setFormat(uint8_t format) {}
+    void setExponent(int8_t exponent) {}
+    void setUnit(uint16_t unit) {}
+};
+
+class BLECharacteristic;
+
+class BLECharacteristicCallbacks {
+  public:
+    virtual ~BLECharacteristicCallbacks() {}
+    virtual void onWrite(BLECharacteristic *pCharacteristic) {}
+};
+
+class BLECharacteristic {
+  private:
+    BLEUUID m_uuid;
+    std::vector<uint8_t> m_value;
+    std::vector<BLEDescriptor *> m_descriptors;
+    BLECharacteristicCallbacks *m_pCallbacks = NULL;
+    unsigned long m_numNotifications = 0;
+    void (*m_notifyHandler)(const uint8_t *data, size_t len) = NULL;
+
+  public:
+    static const uint32_t PROPERTY_READ = 1 << 0;
+    static const uint32_t PROPERTY_WRITE = 1 << 1;
+    static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+    static const uint32_t PROPERTY_INDICATE = 1 << 4;
+    static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+    BLECharacteristic(const char *uuid, uint32_t properties = 0) : m_uuid(uuid) {}
+    BLECharacteristic(BLEUUID uuid, uint32_t properties = 0) : m_uuid(uuid) {}
+
+    void addDescriptor(BLEDescriptor *pDescriptor) { m_descriptors.push_back(pDescriptor); }
+    void setCallbacks(BLECharacteristicCallbacks *pCallbacks) { m_pCallbacks = pCallbacks; }
+    void setValue(const uint8_t *data, size_t len) { m_value.assign(data, data + len); }
+    uint8_t * getData(void) { return m_value.data(); }
+    size_t getLength(void) const { return m_value.size(); }
+    void notify(bool isNotification = true) {
+      m_numNotifications++;
+      if (m_notifyHandler != NULL) {
+        m_notifyHandler(m_value.data(), m_value.size());
+      }
+    }
+
+    void indicate(void) { m_numNotifications++; }
+
+    /*
+     * Host only: count of notify() calls, a handler that sees each notification, a client enabling notifications, and a client write as
+     * it would arrive from the BLE thread
+     */
+    unsigned long getNumNotifications(void) const { return m_numNotifications; }
+    void setNotifyHandler(void (*handler)(const uint8_t *data, size_t len)) { m_notifyHandler = handler; }
+    void clientSubscribe(bool subscribe) {
+      for (BLEDescriptor *pDescriptor : m_descriptors) {
+        BLE2902 *pCccd = dynamic_cast<BLE2902 *>(pDescriptor);
+        if (pCccd != NULL) {
+          pCccd->setNotifications(subscribe);
+        }
+      }
+    }
+    void clientWrite(const uint8_t *data, size_t len) {
+      setValue(data, len);
+      if (m_pCallbacks != NULL) {
+        m_pCallbacks->onWrite(this);
+      }
+    }
+};
+
+class BLEService {
+  public:
+    void addCharacteristic(BLECharacteristic *pCharacteristic) {}
+    void start(void) {}
+};
+
+class BLEServer;
+
+class BLEServerCallbacks {
+  public:
+    virtual ~BLEServerCallbacks() {}
+    virtual void onConnect(BLEServer *pServer) {}
+    virtual void onDisconnect(BLEServer *pServer) {}
+};
+
+class BLEAdvertising {
+  public:
+    void start(void) {}
+    void stop(void) {}
+};
+
+class BLEServer {
+  private:
+    std::vector<BLEService *> m_services;
+    BLEAdvertising m_advertising;
+    uint32_t m_connectedCount = 0;
+    uint16_t m_peerMtu = 23;
+
+  public:
+    ~BLEServer() {
+      for (BLEService *pService : m_services) {
+        delete pService;
+      }
+    }
+
+    BLEService * createService(BLEUUID uuid, uint32_t numHandles = 15, uint8_t instId = 0) {
+      BLEService *pService = new BLEService();
+      m_services.push_back(pService);
+      return pService;
+    }
+
+    void setCallbacks(BLEServerCallbacks *pCallbacks) {}
+    BLEAdvertising * getAdvertising(void) { return &m_advertising; }
+    uint16_t getConnId(void) const { return 0; }
+    uint16_t getPeerMTU(uint16_t connId) const { return m_peerMtu; }
+    uint32_t getConnectedCount(void) const { return m_connectedCount; }
+
+    /*
+     * Host only: pretend a client is connected, with the MTU it negotiated
+     */
+    void setConnected(bool connected, uint16_t mtu = 23) {
+      m_connectedCount = connected ? 1 : 0;
+      m_peerMtu = mtu;
+    }
+};
+
+class BLEDevice {
+  public:
+    static void init(std::string name) {}
+    static BLEServer * createServer(void) { return new BLEServer(); }
+};
+
+#endif /* __BLEHOST_H */
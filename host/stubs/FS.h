@@ -0,0 +1,67 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: files are ordinary host files, see LittleFS.h
+ */
+
+#ifndef __FS_H
+#define __FS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+class File {
+  private:
+    struct Handle {
+      FILE *pFile = NULL;
+      DIR *pDir = NULL;
+      std::string path;
+      std::string name;
+      ~Handle() {
+        if (pFile != NULL) {
+          fclose(pFile);
+        }
+
+        if (pDir != NULL) {
+          closedir(pDir);
+        }
+      }
+    };
+
+    std::shared_ptr<Handle> m_handle;
+
+  public:
+    File(void) {}
+    static File openFile(const std::string &hostPath, const std::string &name, const char *mode);
+    static File openDir(const std::string &hostPath, const std::string &name);
+
+    operator bool() const { return m_handle != NULL; }
+    size_t read(uint8_t *buf, size_t size);
+    size_t write(const uint8_t *buf, size_t size);
+    bool seek(uint32_t pos);
+    size_t size(void);
+    const char * name(void) const { return m_handle ? m_handle->name.c_str() : ""; }
+    bool isDirectory(void) const { return m_handle && (m_handle->pDir != NULL); }
+    File openNextFile(void);
+    void close(void) { m_handle.reset(); }
+};
+
+}
+
+using fs::File;
+
+#endif /* __FS_H */
@@ -0,0 +1,115 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <LittleFS.h>
+
+#define DEFAULT_ROOT "littlefs"
+
+LittleFSFS LittleFS;
+
+namespace fs {
+
+File File::openFile(const std::string &hostPath, const std::string &name, const char *mode) {
+  File file;
+  FILE *pFile = fopen(hostPath.c_str(), (strcmp(mode, FILE_READ) == 0) ? "rb" : ((strcmp(mode, FILE_WRITE) == 0) ? "wb" : "ab"));
+  if (pFile != NULL) {
+    file.m_handle = std::make_shared<Handle>();
+    file.m_handle->pFile = pFile;
+    file.m_handle->path = hostPath;
+    file.m_handle->name = name;
+  }
+
+  return file;
+}
+
+File File::openDir(const std::string &hostPath, const std::string &name) {
+  File file;
+  DIR *pDir = opendir(hostPath.c_str());
+  if (pDir != NULL) {
+    file.m_handle = std::make_shared<Handle>();
+    file.m_handle->pDir = pDir;
+    file.m_handle->path = hostPath;
+    file.m_handle->name = name;
+  }
+
+  return file;
+}
+
+size_t File::read(uint8_t *buf, size_t size) {
+  return (m_handle && m_handle->pFile) ? fread(buf, 1, size, m_handle->pFile) : 0;
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+  return (m_handle && m_handle->pFile) ? fwrite(buf, 1, size, m_handle->pFile) : 0;
+}
+
+bool File::seek(uint32_t pos) {
+  return m_handle && m_handle->pFile && (fseek(m_handle->pFile, pos, SEEK_SET) == 0);
+}
+
+size_t File::size(void) {
+  if (!m_handle || (m_handle->pFile == NULL)) {
+    return 0;
+  }
+
+  fflush(m_handle->pFile);
+  struct stat st;
+  return (stat(m_handle->path.c_str(), &st) == 0) ? (size_t)st.st_size : 0;
+}
+
+File File::openNextFile(void) {
+  if (!m_handle || (m_handle->pDir == NULL)) {
+    return File();
+  }
+
+  struct dirent *pEntry;
+  while ((pEntry = readdir(m_handle->pDir)) != NULL) {
+    if (pEntry->d_name[0] != '.') {
+      return openFile(m_handle->path + "/" + pEntry->d_name, pEntry->d_name, FILE_READ);
+    }
+  }
+
+  return File();
+}
+
+}
+
+bool LittleFSFS::begin(bool formatOnFail) {
+  const char *root = getenv("GLOVE_FS_ROOT");
+  m_root = (root != NULL) ? root : DEFAULT_ROOT;
+  ::mkdir(m_root.c_str(), 0755);
+  struct stat st;
+  return (stat(m_root.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+File LittleFSFS::open(const char *path, const char *mode) {
+  struct stat st;
+  if ((strcmp(mode, FILE_READ) == 0) && (stat(hostPath(path).c_str(), &st) == 0) && S_ISDIR(st.st_mode)) {
+    return File::openDir(hostPath(path), path);
+  }
+
+  const char *name = strrchr(path, '/');
+  return File::openFile(hostPath(path), (name != NULL) ? (name + 1) : path, mode);
+}
+
+bool LittleFSFS::exists(const char *path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool LittleFSFS::mkdir(const char *path) {
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool LittleFSFS::remove(const char *path) {
+  return ::remove(hostPath(path).c_str()) == 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: the filesystem is a directory on the host, GLOVE_FS_ROOT if set or "littlefs" in the working directory
+ */
+
+#ifndef __LITTLEFS_H
+#define __LITTLEFS_H
+
+#include <FS.h>
+
+class LittleFSFS {
+  private:
+    std::string m_root;
+    std::string hostPath(const char *path) const { return m_root + path; }
+
+  public:
+    bool begin(bool formatOnFail = false);
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool mkdir(const char *path);
+    bool remove(const char *path);
+};
+
+extern LittleFSFS LittleFS;
+
+#endif /* __LITTLEFS_H */
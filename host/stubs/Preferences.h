@@ -0,0 +1,65 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: NVS is held in memory, so it starts empty on every run
+ */
+
+#ifndef __PREFERENCES_H
+#define __PREFERENCES_H
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+  private:
+    typedef std::map<std::string, std::vector<uint8_t>> namespace_t;
+    static std::map<std::string, namespace_t> &storage(void) {
+      static std::map<std::string, namespace_t> s_storage;
+      return s_storage;
+    }
+
+    namespace_t *m_pNamespace = NULL;
+
+  public:
+    bool begin(const char *name, bool readOnly = false) {
+      if (readOnly && (storage().find(name) == storage().end())) {
+        return false;
+      }
+
+      m_pNamespace = &(storage()[name]);
+      return true;
+    }
+
+    void end(void) { m_pNamespace = NULL; }
+
+    size_t putBytes(const char *key, const void *value, size_t len) {
+      const uint8_t *bytes = (const uint8_t *)value;
+      (*m_pNamespace)[key].assign(bytes, bytes + len);
+      return len;
+    }
+
+    size_t getBytes(const char *key, void *buf, size_t maxLen) {
+      namespace_t::iterator it = m_pNamespace->find(key);
+      if ((it == m_pNamespace->end()) || (it->second.size() > maxLen)) {
+        return 0;
+      }
+
+      memcpy(buf, it->second.data(), it->second.size());
+      return it->second.size();
+    }
+
+    size_t putUChar(const char *key, uint8_t value) { return putBytes(key, &value, 1); }
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0) {
+      uint8_t value;
+      return (getBytes(key, &value, 1) == 1) ? value : defaultValue;
+    }
+};
+
+#endif /* __PREFERENCES_H */
@@ -0,0 +1,37 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: no SPI devices are attached. Transfers leave the buffer as it was
+ */
+
+#ifndef __SPI_H
+#define __SPI_H
+
+#include <Arduino.h>
+
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {}
+};
+
+class SPIClass {
+  public:
+    void begin(void) {}
+    void end(void) {}
+    void beginTransaction(SPISettings settings) {}
+    void endTransaction(void) {}
+    void transfer(void *data, uint32_t size) {}
+};
+
+extern SPIClass SPI;
+
+#endif /* __SPI_H */
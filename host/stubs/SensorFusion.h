@@ -0,0 +1,31 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: Madgwick AHRS with the same interface and gain as the SensorFusion library used on the glove
+ */
+
+#ifndef __SENSORFUSION_H
+#define __SENSORFUSION_H
+
+#include <Arduino.h>
+
+class SF {
+  private:
+    float m_beta = 0.1f;
+    float m_q[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+    unsigned long m_lastUpdate = 0;
+    unsigned long m_now = 0;
+
+  public:
+    void MadgwickUpdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float deltat);
+    float deltatUpdate(void);
+    float getRollRadians(void) const;
+    float getPitchRadians(void) const;
+    float getYawRadians(void) const;
+};
+
+#endif /* __SENSORFUSION_H */
@@ -0,0 +1,45 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: no I2C devices are attached. Writes are acknowledged and reads return zeros
+ */
+
+#ifndef __WIRE_H
+#define __WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire {
+  private:
+    uint32_t m_clock = 100000;
+    size_t m_available = 0;
+
+  public:
+    bool begin(void) { return true; }
+    bool end(void) { return true; }
+    bool setClock(uint32_t frequency) { m_clock = frequency; return true; }
+    uint32_t getClock(void) const { return m_clock; }
+    void setTimeOut(uint16_t timeout) {}
+    void beginTransmission(uint8_t address) {}
+    size_t write(uint8_t data) { return 1; }
+    size_t write(const uint8_t *data, size_t len) { return len; }
+    uint8_t endTransmission(bool sendStop = true) { return 0; }
+    size_t requestFrom(uint8_t address, size_t len, bool sendStop = true) { m_available = len; return len; }
+    int available(void) const { return (int)m_available; }
+    int read(void) {
+      if (m_available == 0) {
+        return -1;
+      }
+
+      m_available--;
+      return 0;
+    }
+};
+
+extern TwoWire Wire;
+
+#endif /* __WIRE_H */
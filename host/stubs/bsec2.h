@@ -0,0 +1,119 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: BSEC2 wrapper with no sensor and no BSEC library. Types, output IDs and constants match the Bosch headers, so the
+ * firmware's output handling can be compiled and driven with synthetic outputs. run() never produces data
+ */
+
+#ifndef __BSEC2_H
+#define __BSEC2_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#define ARRAY_LEN(array) (sizeof(array) / sizeof(array[0]))
+
+#define BSEC_NUMBER_OUTPUTS 30
+#define BSEC_MAX_STATE_BLOB_SIZE 221
+#define BSEC_SAMPLE_RATE_ULP 0.0033333f
+#define BSEC_SAMPLE_RATE_LP 0.33333f
+#define BSEC_SAMPLE_RATE_CONT 1.0f
+#define BSEC_SAMPLE_RATE_SCAN 0.055556f
+#define TEMP_OFFSET_LP 1.3255f
+#define TEMP_OFFSET_ULP 0.466f
+
+#define BME68X_OK 0
+#define BME68X_E_COM_FAIL -2
+#define BME68X_INTF_RET_SUCCESS 0
+#define BME68X_GASM_VALID_MSK 0x20
+#define BME68X_HEAT_STAB_MSK 0x10
+
+typedef enum {
+  BSEC_OK = 0
+} bsec_library_return_t;
+
+typedef enum {
+  BSEC_OUTPUT_IAQ = 1,
+  BSEC_OUTPUT_STATIC_IAQ = 2,
+  BSEC_OUTPUT_CO2_EQUIVALENT = 3,
+  BSEC_OUTPUT_BREATH_VOC_EQUIVALENT = 4,
+  BSEC_OUTPUT_RAW_TEMPERATURE = 6,
+  BSEC_OUTPUT_RAW_PRESSURE = 7,
+  BSEC_OUTPUT_RAW_HUMIDITY = 8,
+  BSEC_OUTPUT_RAW_GAS = 9,
+  BSEC_OUTPUT_STABILIZATION_STATUS = 12,
+  BSEC_OUTPUT_RUN_IN_STATUS = 13,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE = 14,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY = 15,
+  BSEC_OUTPUT_GAS_PERCENTAGE = 21,
+  BSEC_OUTPUT_GAS_ESTIMATE_1 = 22,
+  BSEC_OUTPUT_GAS_ESTIMATE_2 = 23,
+  BSEC_OUTPUT_GAS_ESTIMATE_3 = 24,
+  BSEC_OUTPUT_GAS_ESTIMATE_4 = 25,
+  BSEC_OUTPUT_RAW_GAS_INDEX = 26
+} bsecSensor;
+
+typedef struct {
+  int64_t time_stamp;
+  float signal;
+  uint8_t signal_dimensions;
+  uint8_t sensor_id;
+  uint8_t accuracy;
+} bsecData;
+
+typedef struct {
+  bsecData output[BSEC_NUMBER_OUTPUTS];
+  uint8_t nOutputs;
+} bsecOutputs;
+
+typedef struct {
+  uint8_t status;
+  uint8_t gas_index;
+  uint8_t meas_index;
+  uint8_t res_heat;
+  uint8_t idac;
+  uint8_t gas_wait;
+  float temperature;
+  float pressure;
+  float humidity;
+  float gas_resistance;
+} bme68xData;
+
+typedef enum {
+  BME68X_SPI_INTF,
+  BME68X_I2C_INTF
+} bme68xIntf;
+
+typedef int8_t (*bme68x_read_fptr_t)(uint8_t regAddr, uint8_t *regData, uint32_t length, void *intfPtr);
+typedef int8_t (*bme68x_write_fptr_t)(uint8_t regAddr, const uint8_t *regData, uint32_t length, void *intfPtr);
+typedef void (*bme68x_delay_us_fptr_t)(uint32_t period, void *intfPtr);
+
+class Bme68x {
+  public:
+    int8_t status = BME68X_OK;
+};
+
+class Bsec2;
+typedef void (*bsecCallback)(const bme68xData data, const bsecOutputs outputs, Bsec2 bsec);
+
+class Bsec2 {
+  public:
+    Bme68x sensor;
+    bsec_library_return_t status = BSEC_OK;
+
+    bool begin(bme68xIntf intf, bme68x_read_fptr_t read, bme68x_write_fptr_t write, bme68x_delay_us_fptr_t idleTask, void *intfPtr) { return true; }
+    bool begin(uint8_t i2cAddr, TwoWire &i2c) { return true; }
+    bool updateSubscription(bsecSensor sensorList[], uint8_t nSensors, float sampleRate) { return true; }
+    bool run(void) { return true; }
+    void attachCallback(bsecCallback callback) {}
+    bool getState(uint8_t *state) { memset(state, 0, BSEC_MAX_STATE_BLOB_SIZE); return true; }
+    bool setState(uint8_t *state) { return true; }
+    bool setConfig(const uint8_t *config) { return true; }
+    void setTemperatureOffset(float tempOffset) {}
+};
+
+#endif /* __BSEC2_H */
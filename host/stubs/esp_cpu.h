@@ -0,0 +1,18 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: "cycles" are nanoseconds from the host's steady clock, so getCpuFrequencyMhz() reports 1000
+ */
+
+#ifndef __ESP_CPU_H
+#define __ESP_CPU_H
+
+#include <stdint.h>
+
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif /* __ESP_CPU_H */
@@ -0,0 +1,24 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: every run is a power-on reset
+ */
+
+#ifndef __ESP_SLEEP_H
+#define __ESP_SLEEP_H
+
+typedef enum {
+  ESP_RST_UNKNOWN = 0,
+  ESP_RST_POWERON,
+  ESP_RST_DEEPSLEEP = 8
+} esp_reset_reason_t;
+
+static inline esp_reset_reason_t esp_reset_reason(void) {
+  return ESP_RST_POWERON;
+}
+
+#endif /* __ESP_SLEEP_H */
@@ -0,0 +1,30 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Host build: same CRC-32 (little endian, polynomial 0xEDB88320) as the ESP32 ROM
+ */
+
+#ifndef __ROM_CRC_H
+#define __ROM_CRC_H
+
+#include <stdint.h>
+
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  crc = ~crc;
+  uint32_t i;
+  for (i = 0; i < len; i++) {
+    crc ^= buf[i];
+    int bit;
+    for (bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1UL)));
+    }
+  }
+
+  return ~crc;
+}
+
+#endif /* __ROM_CRC_H */
@@ -0,0 +1,201 @@
+/*
+ * Smart Glove Demo v1.0
+ *
+ * Copyright (C) 2025 Soothsayer Systems Ltd. All rights reserved.
+ *
+ * Author: Tom Coates <tom@soothsys.com>
+ *
+ * Writes a synthetic trace in the same format as a record build, for replay tests that don't depend on a glove being to hand.
+ * Eight seconds of every traced source, at the rates the firmware records them:
+ *
+ *    - ADAF1080 at 250Hz: 50Hz field from mains wiring on a small DC offset
+ *    - LSM9DS1 FIFO every 20ms at 952Hz: tool vibration for 3 seconds, then the hand at rest. Mag with each fusion update
+ *    - AS7341 every 100ms: light steps up at 2 seconds and down at 5 seconds, as if walking outside and back in
+ *    - BME688 every 3 seconds (skipped on replay, but must not upset it)
+ *    - Battery every second, with a load dip
+ *
+ * Noise comes from a fixed seed, so the same trace is written every time.
+ *
+ * Usage: glove_tracegen <output>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "trace.h"
+
+#define TRACE_LENGTH 8000000ULL //us
+#define START_TIME 1000000ULL //Timebase at start of trace
+
+#define ADAF1080_PERIOD 4000 //us, 250Hz
+#define AD4002_MIDCODE 131072
+#define MAINS_FREQ 50.0
+#define MAINS_AMPLITUDE 1500.0 //ADC codes
+#define FIELD_OFFSET 400.0
+
+#define LSM9DS1_ODR 952.0
+#define FIFO_PERIOD 20000 //us, fusion and FIFO drain interval while moving
+#define ACCEL_LSB_PER_G 1366.0 //16g range
+#define VIBRATION_FREQ 80.0 //Hz, within the HAVS weighting passband
+#define VIBRATION_AMPLITUDE 2.0 //g
+#define VIBRATION_END 3000000ULL //us
+
+#define AS7341_PERIOD 100000 //us, both SMUX passes of a 50ms integration
+#define LIGHT_STEP_UP 2000000ULL
+#define LIGHT_STEP_DOWN 5000000ULL
+#define AS7341_GAIN_INDEX 8
+#define AS7341_ASTEP 599
+#define AS7341_FULL_SCALE 65535.0
+
+#define BME688_PERIOD 3000000
+#define BATTERY_PERIOD 1000000
+#define BATTERY_MV 1850 //At ADC pin, about 3.7V battery
+#define BATTERY_DIP_TIME 4000000ULL
+
+typedef struct {
+  uint64_t time;
+  uint8_t source;
+  std::vector<uint8_t> payload;
+} event_t;
+
+static std::vector<event_t> m_events;
+static uint32_t m_seed = 12345;
+
+static float noise(float amplitude) {
+  m_seed = m_seed * 1664525UL + 1013904223UL; //Numerical Recipes LCG
+  return amplitude * ((float)(m_seed >> 8) / (float)(1UL << 24) - 0.5f);
+}
+
+static void addEvent(uint64_t time, trace_source_t source, const void *pData, size_t len) {
+  event_t event;
+  event.time = time;
+  event.source = (uint8_t)source;
+  event.payload.assign((const uint8_t *)pData, (const uint8_t *)pData + len);
+  m_events.push_back(event);
+}
+
+static void addAdaf1080(void) {
+  uint64_t t;
+  for (t = 0; t < TRACE_LENGTH; t += ADAF1080_PERIOD) {
+    double s = (double)t / 1.0e6;
+    uint32_t code = (uint32_t)(AD4002_MIDCODE + FIELD_OFFSET + MAINS_AMPLITUDE * sin(2.0 * M_PI * MAINS_FREQ * s) + noise(20.0f));
+    addEvent(t, trace_source_ad4002, &code, sizeof(code));
+  }
+}
+
+static void addLsm9ds1(void) {
+  double samplePeriod = 1.0e6 / LSM9DS1_ODR;
+  double nextSample = 0.0;
+  uint64_t t;
+  for (t = FIFO_PERIOD; t < TRACE_LENGTH; t += FIFO_PERIOD) {
+    int levels = 0;
+    double first = nextSample;
+    while (nextSample < (double)t) {
+      levels++;
+      nextSample += samplePeriod;
+    }
+
+    uint8_t fifoSrc = (uint8_t)levels; //FSS bits, no overrun
+    addEvent(t, trace_source_lsm9ds1Fifo, &fifoSrc, sizeof(fifoSrc));
+
+    int i;
+    for (i = 0; i < levels; i++) {
+      double s = (first + (double)i * samplePeriod) / 1.0e6;
+      bool vibrating = ((uint64_t)(s * 1.0e6) < VIBRATION_END);
+      double vibration = vibrating ? VIBRATION_AMPLITUDE * sin(2.0 * M_PI * VIBRATION_FREQ * s) : 0.0;
+      int16_t raw[6] = {
+        (int16_t)noise(vibrating ? 400.0f : 8.0f), //Gyro
+        (int16_t)noise(vibrating ? 400.0f : 8.0f),
+        (int16_t)noise(vibrating ? 400.0f : 8.0f),
+        (int16_t)(ACCEL_LSB_PER_G * vibration + noise(6.0f)), //Accel, 1g on Z
+        (int16_t)(0.5 * ACCEL_LSB_PER_G * vibration + noise(6.0f)),
+        (int16_t)(ACCEL_LSB_PER_G * (1.0 + 0.2 * vibration) + noise(6.0f))
+      };
+      addEvent(t, trace_source_lsm9ds1Imu, raw, sizeof(raw));
+    }
+
+    int16_t mag[3] = { (int16_t)(1400 + noise(10.0f)), (int16_t)(noise(10.0f)), (int16_t)(-2800 + noise(10.0f)) }; //About 45uT
+    addEvent(t + 300, trace_source_lsm9ds1Mag, mag, sizeof(mag));
+  }
+}
+
+static void addAs7341(void) {
+  /*
+   * Relative response of each channel to warm white light, in library channel order (F1-F4, Clear, NIR, F5-F8, Clear, NIR)
+   */
+  static const float SPECTRUM[12] = { 0.10f, 0.25f, 0.35f, 0.45f, 1.0f, 0.15f, 0.55f, 0.65f, 0.70f, 0.60f, 1.0f, 0.15f };
+  uint64_t t;
+  for (t = AS7341_PERIOD; t < TRACE_LENGTH; t += AS7341_PERIOD) {
+    float level = ((t >= LIGHT_STEP_UP) && (t < LIGHT_STEP_DOWN)) ? 120000.0f : 3000.0f; //Clear channel counts, before clipping
+    trace_as7341_t trace;
+    int i;
+    for (i = 0; i < 12; i++) {
+      float counts = level * SPECTRUM[i] * (1.0f + noise(0.02f));
+      trace.readings[i] = (uint16_t)fminf(counts, AS7341_FULL_SCALE);
+    }
+
+    trace.gainIndex = AS7341_GAIN_INDEX;
+    trace.astep = AS7341_ASTEP;
+    addEvent(t, trace_source_as7341, &trace, sizeof(trace));
+  }
+}
+
+static void addBme688(void) {
+  uint64_t t;
+  for (t = BME688_PERIOD; t < TRACE_LENGTH; t += BME688_PERIOD) {
+    trace_bme688_t trace = { 22.5f, 101325.0f, 45.0f, 85000.0f, 0xB0, 0 };
+    addEvent(t, trace_source_bme688, &trace, sizeof(trace));
+  }
+}
+
+static void addBattery(void) {
+  uint64_t t;
+  for (t = 0; t < TRACE_LENGTH; t += BATTERY_PERIOD) {
+    uint32_t mv = BATTERY_MV - (uint32_t)(t / 2000000ULL) - ((t == BATTERY_DIP_TIME) ? 60 : 0); //Slow discharge, one load dip
+    addEvent(t, trace_source_battery, &mv, sizeof(mv));
+  }
+}
+
+static bool writeTrace(const char *path) {
+  FILE *pFile = fopen(path, "wb");
+  if (pFile == NULL) {
+    fprintf(stderr, "Cannot create %s\n", path);
+    return false;
+  }
+
+  trace_header_t header = { TRACE_MAGIC, TRACE_VERSION, NUM_TRACE_SOURCES, 0, START_TIME };
+  bool ok = (fwrite(&header, sizeof(header), 1, pFile) == 1);
+  uint64_t lastTime = 0;
+  for (const event_t &event : m_events) {
+    record_header_t record = { event.source, (uint8_t)event.payload.size(), (uint32_t)(event.time - lastTime) };
+    lastTime = event.time;
+    ok = ok && (fwrite(&record, sizeof(record), 1, pFile) == 1);
+    ok = ok && (fwrite(event.payload.data(), 1, event.payload.size(), pFile) == event.payload.size());
+  }
+
+  ok = (fclose(pFile) == 0) && ok;
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", path);
+  }
+
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <output>\n", argv[0]);
+    return 2;
+  }
+
+  addAdaf1080();
+  addLsm9ds1();
+  addAs7341();
+  addBme688();
+  addBattery();
+  std::stable_sort(m_events.begin(), m_events.end(), [](const event_t &a, const event_t &b) { return a.time < b.time; });
+  return writeTrace(argv[1]) ? 0 : 1;
+}